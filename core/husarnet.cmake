@@ -244,6 +244,26 @@ if(NOT DEFINED ESP_PLATFORM)
   target_link_libraries(${husarnet_core} quill::quill)
 endif()
 
+# Payload compression (negotiated per peer) for fat platforms
+if(NOT DEFINED ESP_PLATFORM)
+  FetchContent_Declare(
+    zstd
+    URL https://github.com/facebook/zstd/releases/download/v1.5.6/zstd-1.5.6.tar.gz
+    DOWNLOAD_EXTRACT_TIMESTAMP true
+    SOURCE_SUBDIR build/cmake
+  )
+  set(ZSTD_BUILD_PROGRAMS OFF)
+  set(ZSTD_BUILD_SHARED OFF)
+  set(ZSTD_BUILD_STATIC ON)
+  set(ZSTD_BUILD_TESTS OFF)
+  set(ZSTD_LEGACY_SUPPORT OFF)
+  set(ZSTD_MULTITHREAD_SUPPORT OFF)
+  FetchContent_MakeAvailable(zstd)
+  target_include_directories(${husarnet_core} PUBLIC ${zstd_SOURCE_DIR}/lib)
+  target_link_libraries(${husarnet_core} libzstd_static)
+  target_compile_definitions(${husarnet_core} PUBLIC WITH_ZSTD)
+endif()
+
 # Include linux port libraries
 if(${CMAKE_SYSTEM_NAME} STREQUAL Linux OR (${CMAKE_SYSTEM_NAME} STREQUAL Darwin OR (${CMAKE_SYSTEM_NAME} STREQUAL Windows)))
   FetchContent_Declare(
@@ -288,6 +288,74 @@ void ApiServer::runThread()
     }
   });
 
+  svr.Get("/api/scheduler", [&](const httplib::Request& req, httplib::Response& res) {
+    auto scheduler = this->husarnetManager->egressScheduler;
+    returnSuccess(
+        req, res,
+        json::object({
+            {"config", scheduler->getConfig()},
+            {"stats", scheduler->getStats()},
+        }));
+  });
+
+  svr.Post("/api/scheduler", [&](const httplib::Request& req, httplib::Response& res) {
+    if(!validateSecret(req, res)) {
+      return;
+    }
+
+    if(!requireParams(req, res, {"config"})) {
+      return;
+    }
+
+    auto config = json::parse(req.get_param_value("config"), nullptr, false);
+    if(config.is_discarded()) {
+      returnInvalidQuery(req, res, "config is not a valid JSON");
+      return;
+    }
+
+    std::string error;
+    if(!this->husarnetManager->egressScheduler->setConfig(config, error)) {
+      returnInvalidQuery(req, res, error);
+      return;
+    }
+
+    returnSuccess(req, res, this->husarnetManager->egressScheduler->getConfig());
+  });
+
+  svr.Get("/api/relay", [&](const httplib::Request& req, httplib::Response& res) {
+    auto ngsocket = this->husarnetManager->ngsocket;
+    returnSuccess(
+        req, res,
+        json::object({
+            {"config", ngsocket->getRelayConfig()},
+            {"stats", ngsocket->getRelayStats()},
+        }));
+  });
+
+  svr.Post("/api/relay", [&](const httplib::Request& req, httplib::Response& res) {
+    if(!validateSecret(req, res)) {
+      return;
+    }
+
+    if(!requireParams(req, res, {"config"})) {
+      return;
+    }
+
+    auto config = json::parse(req.get_param_value("config"), nullptr, false);
+    if(config.is_discarded()) {
+      returnInvalidQuery(req, res, "config is not a valid JSON");
+      return;
+    }
+
+    std::string error;
+    if(!this->husarnetManager->ngsocket->setRelayConfig(config, error)) {
+      returnInvalidQuery(req, res, error);
+      return;
+    }
+
+    returnSuccess(req, res, this->husarnetManager->ngsocket->getRelayConfig());
+  });
+
   svr.Get(R"(/api/forward/(.*))", [&](const httplib::Request& req, httplib::Response& res) {
     forwardRequestToDashboardApi(req, res);
   });
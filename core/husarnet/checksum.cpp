@@ -0,0 +1,47 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/checksum.h"
+
+uint32_t checksumAdd(uint32_t sum, string_view data)
+{
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  size_t i = 0;
+  for(; i + 1 < data.size(); i += 2) {
+    sum += (bytes[i] << 8) | bytes[i + 1];
+  }
+  if(i < data.size()) {
+    sum += bytes[i] << 8;
+  }
+  // keep the accumulator from overflowing on long inputs
+  return (sum & 0xffff) + (sum >> 16);
+}
+
+uint16_t checksumFinish(uint32_t sum)
+{
+  while(sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return (uint16_t)~sum;
+}
+
+uint16_t ipv6PayloadChecksum(string_view src, string_view dst, uint8_t nextHeader, string_view payload)
+{
+  uint32_t sum = 0;
+  sum = checksumAdd(sum, src);
+  sum = checksumAdd(sum, dst);
+  sum += (uint32_t)(payload.size() >> 16);
+  sum += (uint32_t)(payload.size() & 0xffff);
+  sum += nextHeader;
+  sum = checksumAdd(sum, payload);
+  return checksumFinish(sum);
+}
+
+uint16_t checksumAdjust(uint16_t checksum, uint16_t oldValue, uint16_t newValue)
+{
+  // HC' = ~(~HC + ~m + m')
+  uint32_t sum = (uint16_t)~checksum;
+  sum += (uint16_t)~oldValue;
+  sum += newValue;
+  return checksumFinish(sum);
+}
@@ -0,0 +1,20 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <cstdint>
+
+#include "husarnet/string_view.h"
+
+// Internet checksum (RFC 1071) helpers. Sums are accumulated in host order
+// over big endian 16 bit words and folded only when finishing.
+uint32_t checksumAdd(uint32_t sum, string_view data);
+uint16_t checksumFinish(uint32_t sum);
+
+// Checksum of an upper layer payload (TCP, UDP, ICMPv6) including the IPv6
+// pseudo header. The checksum field inside the payload has to be zeroed.
+uint16_t ipv6PayloadChecksum(string_view src, string_view dst, uint8_t nextHeader, string_view payload);
+
+// Incremental update (RFC 1624) of a checksum after a single 16 bit word of
+// the covered data changed from oldValue to newValue
+uint16_t checksumAdjust(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
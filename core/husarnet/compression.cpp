@@ -0,0 +1,158 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/compression.h"
+
+#include <cstring>
+
+const char FRAME_MARKER = (char)0xFE;
+const char FRAME_RAW = 0x00;
+const char FRAME_ZSTD = 0x01;
+const char FRAME_ZSTD_DICTIONARY = 0x02;
+
+CompressionCodec::CompressionCodec(int level) : level(level)
+{
+  this->compressionBuffer.resize(2100);
+  this->decompressionBuffer.resize(2000);
+
+#ifdef WITH_ZSTD
+  this->cctx = ZSTD_createCCtx();
+  this->dctx = ZSTD_createDCtx();
+#endif
+}
+
+CompressionCodec::~CompressionCodec()
+{
+#ifdef WITH_ZSTD
+  ZSTD_freeCDict(this->cdict);
+  ZSTD_freeDDict(this->ddict);
+  ZSTD_freeCCtx(this->cctx);
+  ZSTD_freeDCtx(this->dctx);
+#endif
+}
+
+bool CompressionCodec::loadDictionary(const std::string& dictionary)
+{
+#ifdef WITH_ZSTD
+  uint32_t id = ZSTD_getDictID_fromDict(dictionary.data(), dictionary.size());
+  if(id == 0) {
+    return false;
+  }
+
+  auto cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), this->level);
+  auto ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+  if(cdict == nullptr || ddict == nullptr) {
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+    return false;
+  }
+
+  ZSTD_freeCDict(this->cdict);
+  ZSTD_freeDDict(this->ddict);
+  this->cdict = cdict;
+  this->ddict = ddict;
+  this->dictionaryId = id;
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint32_t CompressionCodec::getDictionaryId() const
+{
+  return this->dictionaryId;
+}
+
+bool CompressionCodec::encodeRaw(string_view data, string_view& out)
+{
+  if(data.size() == 0 || data[0] != FRAME_MARKER) {
+    out = data;
+    return true;
+  }
+
+  if(data.size() + 2 > this->compressionBuffer.size()) {
+    return false;
+  }
+
+  this->compressionBuffer[0] = FRAME_MARKER;
+  this->compressionBuffer[1] = FRAME_RAW;
+  memcpy(&this->compressionBuffer[2], data.data(), data.size());
+  out = string_view(this->compressionBuffer).substr(0, data.size() + 2);
+  return true;
+}
+
+bool CompressionCodec::encodeCompressed(string_view data, bool useDictionary, string_view& out)
+{
+#ifdef WITH_ZSTD
+  if(data.size() + 2 > this->compressionBuffer.size()) {
+    return false;
+  }
+
+  if(useDictionary && this->cdict == nullptr) {
+    return false;
+  }
+
+  // Output that wouldn't save enough simply doesn't fit
+  size_t capacity = data.size() - (size_t)(data.size() * COMPRESSION_MIN_SAVINGS) - 2;
+
+  size_t size;
+  if(useDictionary) {
+    size = ZSTD_compress_usingCDict(
+        this->cctx, &this->compressionBuffer[2], capacity, data.data(), data.size(), this->cdict);
+  } else {
+    size = ZSTD_compressCCtx(this->cctx, &this->compressionBuffer[2], capacity, data.data(), data.size(), this->level);
+  }
+
+  if(ZSTD_isError(size)) {
+    return false;
+  }
+
+  this->compressionBuffer[0] = FRAME_MARKER;
+  this->compressionBuffer[1] = useDictionary ? FRAME_ZSTD_DICTIONARY : FRAME_ZSTD;
+  out = string_view(this->compressionBuffer).substr(0, size + 2);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool CompressionCodec::decode(string_view data, string_view& out)
+{
+  if(data.size() == 0 || data[0] != FRAME_MARKER) {
+    out = data;
+    return true;
+  }
+
+  if(data.size() < 2) {
+    return false;
+  }
+
+  if(data[1] == FRAME_RAW) {
+    out = data.substr(2);
+    return true;
+  }
+
+#ifdef WITH_ZSTD
+  auto frame = data.substr(2);
+  size_t size;
+  if(data[1] == FRAME_ZSTD) {
+    size = ZSTD_decompressDCtx(
+        this->dctx, &this->decompressionBuffer[0], this->decompressionBuffer.size(), frame.data(), frame.size());
+  } else if(data[1] == FRAME_ZSTD_DICTIONARY && this->ddict != nullptr) {
+    size = ZSTD_decompress_usingDDict(
+        this->dctx, &this->decompressionBuffer[0], this->decompressionBuffer.size(), frame.data(), frame.size(),
+        this->ddict);
+  } else {
+    return false;
+  }
+
+  if(ZSTD_isError(size)) {
+    return false;
+  }
+
+  out = string_view(this->decompressionBuffer).substr(0, size);
+  return true;
+#else
+  return false;
+#endif
+}
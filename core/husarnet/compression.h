@@ -0,0 +1,61 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <string>
+
+#include <stdint.h>
+
+#include "husarnet/string_view.h"
+
+#ifdef WITH_ZSTD
+#include "zstd.h"
+#endif
+
+// Compressed packet has to be at least that much smaller to be sent as such
+const double COMPRESSION_MIN_SAVINGS = 0.05;
+
+// Framing of the payload exchanged by peers that both advertise
+// PeerFlag::compressionFraming:
+//   anything not starting with 0xFE - raw packet
+//   0xFE 0x00 <raw packet>          - raw packet that happens to start with 0xFE
+//   0xFE 0x01 <zstd frame>          - compressed packet
+//   0xFE 0x02 <zstd frame>          - compressed with the shared dictionary
+// Returned views point either into the argument or into the internal buffers,
+// so they are only valid until the next call.
+class CompressionCodec {
+ private:
+  int level;
+  uint32_t dictionaryId = 0;
+
+  std::string compressionBuffer;
+  std::string decompressionBuffer;
+
+#ifdef WITH_ZSTD
+  ZSTD_CCtx* cctx = nullptr;
+  ZSTD_DCtx* dctx = nullptr;
+  ZSTD_CDict* cdict = nullptr;
+  ZSTD_DDict* ddict = nullptr;
+#endif
+
+ public:
+  CompressionCodec(int level);
+  ~CompressionCodec();
+
+  CompressionCodec(const CompressionCodec&) = delete;
+  CompressionCodec& operator=(const CompressionCodec&) = delete;
+
+  // Dictionary has to be trained with zstd --train, as raw content ones have
+  // no id to compare with the peer's. Returns whether it was loaded.
+  bool loadDictionary(const std::string& dictionary);
+  // 0 if no dictionary is loaded
+  uint32_t getDictionaryId() const;
+
+  // Escapes the packet if it could be mistaken for a frame. Returns false if
+  // it doesn't fit anymore.
+  bool encodeRaw(string_view data, string_view& out);
+  // Returns false if the packet doesn't compress well enough
+  bool encodeCompressed(string_view data, bool useDictionary, string_view& out);
+  // Returns false if the frame is malformed or uses an unknown dictionary
+  bool decode(string_view data, string_view& out);
+};
@@ -3,76 +3,205 @@
 // License: specified in project_root/LICENSE.txt
 #include "husarnet/compression_layer.h"
 
+#include <algorithm>
+#include <cmath>
+
+#include "husarnet/ports/port_interface.h"
+
 #include "husarnet/logging.h"
 #include "husarnet/peer.h"
 #include "husarnet/peer_container.h"
 #include "husarnet/peer_flags.h"
 #include "husarnet/util.h"
 
+CompressionLayer::CompressionLayer(PeerContainer* peerContainer, PeerFlags* myFlags, ConfigManager* configManager)
+    : peerContainer(peerContainer), myFlags(myFlags), codec(configManager->getCompressionLevel())
+{
 #ifdef WITH_ZSTD
-#include "zstd.h"
+  this->enabled = configManager->getEnableCompression();
+
+  if(this->enabled) {
+    loadDictionary();
+  }
+
+  // Every build with zstd can decompress, so it's always advertised
+  this->myFlags->setFlag(PeerFlag::compressionFraming);
 #endif
+}
 
-CompressionLayer::CompressionLayer(PeerContainer* peerContainer, PeerFlags* myFlags)
-    : peerContainer(peerContainer), myFlags(myFlags)
+void CompressionLayer::loadDictionary()
 {
-  this->compressionBuffer.resize(2100);
-  this->cleartextBuffer.resize(2010);
+  auto dictionary = Port::readStorage(StorageKey::compressionDictionary);
+  if(dictionary.empty()) {
+    return;
+  }
 
-#ifndef WITH_ZSTD
-  this->myFlags->setFlag(PeerFlag::compression);
-#endif
+  if(!this->codec.loadDictionary(dictionary)) {
+    HLOG_WARNING("unable to load the compression dictionary (it has to be trained with zstd --train)");
+    return;
+  }
+
+  HLOG_INFO("compression dictionary loaded // {id}", this->codec.getDictionaryId());
 }
 
-bool CompressionLayer::shouldProceed(HusarnetAddress peerAddress)
+bool CompressionLayer::shouldProceed(Peer* peer)
 {
 #ifndef WITH_ZSTD
   return false;
 #endif
 
-  auto peer = peerContainer->getPeer(peerAddress);
-  if(!peer->flags.checkFlag(PeerFlag::compression)) {
+  if(peer == nullptr) {
+    return false;
+  }
+
+  return this->myFlags->checkFlag(PeerFlag::compressionFraming) && peer->flags.checkFlag(PeerFlag::compressionFraming);
+}
+
+bool CompressionLayer::peerHasDictionary(Peer* peer)
+{
+  if(this->codec.getDictionaryId() == 0) {
     return false;
   }
 
+  auto it = peer->helloExtensions.find(HelloExtension::compressionDictionary);
+  if(it == peer->helloExtensions.end() || it->second.size() != sizeof(uint32_t)) {
+    return false;
+  }
+
+  return unpack<uint32_t>(it->second) == this->codec.getDictionaryId();
+}
+
+// Shannon entropy of the beginning of the packet. Already compressed or
+// encrypted payloads (TLS, QUIC, media) are close to the maximum and are not
+// worth another try.
+bool CompressionLayer::looksCompressible(string_view data)
+{
+  size_t sampleSize = std::min<size_t>(data.size(), COMPRESSION_ENTROPY_SAMPLE);
+
+  int histogram[256] = {};
+  for(size_t i = 0; i < sampleSize; i++) {
+    histogram[(uint8_t)data[i]]++;
+  }
+
+  double entropy = 0;
+  for(int count : histogram) {
+    if(count == 0) {
+      continue;
+    }
+
+    double p = (double)count / sampleSize;
+    entropy -= p * std::log2(p);
+  }
+
+  double maxEntropy = std::log2((double)std::min<size_t>(sampleSize, 256));
+  return entropy < maxEntropy * COMPRESSION_ENTROPY_THRESHOLD;
+}
+
+void CompressionLayer::sendRaw(Peer* peer, string_view data)
+{
+  string_view frame;
+  if(this->codec.encodeRaw(data, frame)) {
+    sendToLowerLayer(peer->id, frame);
+  }
+}
+
+bool CompressionLayer::sendCompressed(Peer* peer, string_view data)
+{
+  string_view frame;
+  if(!this->codec.encodeCompressed(data, peerHasDictionary(peer), frame)) {
+    return false;
+  }
+
+  this->compressedPackets++;
+  this->bytesIn += data.size();
+  this->bytesOut += frame.size();
+
+  sendToLowerLayer(peer->id, frame);
   return true;
 }
 
 void CompressionLayer::onUpperLayerData(HusarnetAddress peerAddress, string_view data)
 {
-  if(!shouldProceed(peerAddress)) {
+  auto peer = peerContainer->getPeer(peerAddress);
+  if(!shouldProceed(peer)) {
     sendToLowerLayer(peerAddress, data);
+    return;
+  }
+
+  if(!this->enabled || data.size() < MIN_COMPRESSION_SIZE) {
+    sendRaw(peer, data);
+    return;
+  }
+
+  if(peer->compressionSkip > 0) {
+    peer->compressionSkip--;
+    this->skippedPackets++;
+    sendRaw(peer, data);
+    return;
+  }
+
+  if(looksCompressible(data) && sendCompressed(peer, data)) {
+    peer->compressionBackoff = 0;
+    return;
   }
-  // TODO long term - this is left here merely as an example. Reference old code
-  // and rewrite this #ifdef WITH_ZSTD
-  //   size_t s = ZSTD_compress(
-  //       &cleartextBuffer[8], cleartextBuffer.size() - 8, data.data(),
-  //       data.size(),
-  //       /*level=*/1);
-  //   if(ZSTD_isError(s)) {
-  //     LOG("ZSTD compression failed");
-  //     return;
-  //   }
 
-  //   sendToLowerLayer(peerAddress, cleartextBuffer);
-  // #endif
+  // Traffic to this peer doesn't compress at the moment, stop trying for
+  // a while (for longer every time it happens in a row)
+  peer->compressionBackoff = std::min(std::max(peer->compressionBackoff * 2, 1), COMPRESSION_MAX_BACKOFF);
+  peer->compressionSkip = peer->compressionBackoff;
+  this->skippedPackets++;
+  sendRaw(peer, data);
+}
+
+// Multicast is sent as is, so it can be sealed once for all the peers
+void CompressionLayer::onUpperLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data)
+{
+  sendToLowerLayerFanout(peerAddresses, data);
 }
 
 void CompressionLayer::onLowerLayerData(HusarnetAddress peerAddress, string_view data)
 {
-  if(!shouldProceed(peerAddress)) {
+  auto peer = peerContainer->getPeer(peerAddress);
+  if(!shouldProceed(peer)) {
     sendToUpperLayer(peerAddress, data);
+    return;
+  }
+
+  string_view packet;
+  if(!this->codec.decode(data, packet)) {
+    HLOG_WARNING("unable to decode compressed frame // {peer}", peerAddress.toString());
+    return;
   }
 
-  // TODO long term - this is left here merely as an example. Reference old code
-  // and rewrite this #ifdef WITH_ZSTD
-  //   size_t s = ZSTD_decompress(
-  //       data, data.size(), &decryptedBuffer[8],
-  //       decryptedSize - 8);
-  //   if(ZSTD_isError(s)) {
-  //     LOG("ZSTD decompression failed");
-  //     return;
-  //   }
-  //   decryptedData = string_view(compressionBuffer).substr(0, s);
-  // #endif
+  sendToUpperLayer(peerAddress, packet);
+}
+
+bool CompressionLayer::isEnabled() const
+{
+  return this->enabled;
+}
+
+uint32_t CompressionLayer::getDictionaryId() const
+{
+  return this->codec.getDictionaryId();
+}
+
+uint64_t CompressionLayer::getCompressedPackets() const
+{
+  return this->compressedPackets;
+}
+
+uint64_t CompressionLayer::getSkippedPackets() const
+{
+  return this->skippedPackets;
+}
+
+uint64_t CompressionLayer::getBytesIn() const
+{
+  return this->bytesIn;
+}
+
+uint64_t CompressionLayer::getBytesOut() const
+{
+  return this->bytesOut;
 }
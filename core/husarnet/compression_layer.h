@@ -2,27 +2,72 @@
 // Authors: listed in project_root/README.md
 // License: specified in project_root/LICENSE.txt
 #pragma once
+#include <atomic>
 #include <string>
+#include <vector>
 
+#include <stdint.h>
+
+#include "husarnet/compression.h"
+#include "husarnet/config_manager.h"
 #include "husarnet/ipaddress.h"
 #include "husarnet/layer_interfaces.h"
 #include "husarnet/peer_container.h"
 #include "husarnet/peer_flags.h"
 #include "husarnet/string_view.h"
 
+// Packets smaller than this are never worth the CPU time
+const int MIN_COMPRESSION_SIZE = 64;
+// How many bytes of the packet are looked at when estimating its entropy
+const int COMPRESSION_ENTROPY_SAMPLE = 512;
+// Fraction of the maximum possible entropy of the sample above which the
+// packet is considered already compressed/encrypted
+const double COMPRESSION_ENTROPY_THRESHOLD = 0.9;
+// Upper bound of packets sent as is after repeated compression failures
+const int COMPRESSION_MAX_BACKOFF = 64;
+
+// Payload compression between peers that both advertise
+// PeerFlag::compressionFraming (which means "understands the framing" - whether
+// to actually compress is decided by the sending side only, see
+// CompressionCodec for the framing itself). PeerFlag::compression is left
+// unused, as older builds advertise it without understanding the framing.
+// Multicast fan-out is never compressed so it can be sealed once for all the
+// recipients.
 class CompressionLayer : public BidirectionalLayer {
  private:
   PeerContainer* peerContainer;
   PeerFlags* myFlags;
 
-  std::string compressionBuffer;
-  std::string cleartextBuffer;
+  bool enabled = false;
+  CompressionCodec codec;
+
+  std::atomic<uint64_t> compressedPackets{0};
+  std::atomic<uint64_t> skippedPackets{0};
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> bytesOut{0};
+
+  void loadDictionary();
 
-  bool shouldProceed(HusarnetAddress source);
+  bool shouldProceed(Peer* peer);
+  bool peerHasDictionary(Peer* peer);
+  bool looksCompressible(string_view data);
+
+  void sendRaw(Peer* peer, string_view data);
+  bool sendCompressed(Peer* peer, string_view data);
 
  public:
-  CompressionLayer(PeerContainer* peerContainer, PeerFlags* myFlags);
+  CompressionLayer(PeerContainer* peerContainer, PeerFlags* myFlags, ConfigManager* configManager);
 
   void onUpperLayerData(HusarnetAddress peerAddress, string_view data);
+  void onUpperLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data);
   void onLowerLayerData(HusarnetAddress peerAddress, string_view data);
+
+  bool isEnabled() const;
+  // 0 if no dictionary is loaded
+  uint32_t getDictionaryId() const;
+
+  uint64_t getCompressedPackets() const;
+  uint64_t getSkippedPackets() const;
+  uint64_t getBytesIn() const;
+  uint64_t getBytesOut() const;
 };
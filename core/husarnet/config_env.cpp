@@ -3,6 +3,8 @@
 // License: specified in project_root/LICENSE.txt
 #include "husarnet/config_env.h"
 
+#include <algorithm>
+
 #include "husarnet/util.h"
 
 #include "magic_enum/magic_enum.hpp"
@@ -38,6 +40,16 @@ json ConfigEnv::getJson() const
   j["daemonApiInterface"] = getDaemonApiInterface();
   j["daemonApiHost"] = getDaemonApiHost().toString();
   j["daemonApiPort"] = getDaemonApiPort();
+  j["multicastRateLimits"] = getMulticastRateLimits();
+  j["enableCompression"] = getEnableCompression();
+  j["compressionLevel"] = getCompressionLevel();
+  j["tunMtu"] = getTunMtu();
+  j["udpBufferSize"] = getUdpBufferSize();
+  j["enableConnectedSockets"] = getEnableConnectedSockets();
+  j["xdpInterface"] = getXdpInterface();
+  j["enableFec"] = getEnableFec();
+  j["multipath"] = getMultipath();
+  j["livenessInterval"] = getLivenessInterval();
   return j;
 }
 
@@ -127,3 +139,70 @@ int ConfigEnv::getWorkerQueueSize() const
   return std::stoi(
       envPresentOrDefault(this->env, EnvKey::daemonWorkerQueueSize, std::to_string(defaultWorkerQueueSize)));
 }
+
+// Comma separated list of group=rate/burst[/dedup_ms] entries (rate in packets
+// per second), "*" as the group sets the default. Empty means no limits.
+const std::string ConfigEnv::getMulticastRateLimits() const
+{
+  return envPresentOrDefault(this->env, EnvKey::multicastRateLimits, "");
+}
+
+bool ConfigEnv::getEnableCompression() const
+{
+  return strToBool(envPresentOrDefault(this->env, EnvKey::enableCompression, "false"));
+}
+
+// zstd level, negative ones trade ratio for speed
+int ConfigEnv::getCompressionLevel() const
+{
+  return std::stoi(envPresentOrDefault(this->env, EnvKey::compressionLevel, "1"));
+}
+
+// Upper bound, peers on paths that can't carry it get a lower one through
+// path MTU discovery
+int ConfigEnv::getTunMtu() const
+{
+  int mtu = std::stoi(envPresentOrDefault(this->env, EnvKey::tunMtu, std::to_string(TUN_MTU_DEFAULT)));
+  return std::clamp(mtu, TUN_MTU_MIN, TUN_MTU_MAX);
+}
+
+// Receive and send buffer size of the UDP sockets in bytes, 0 means it's
+// tuned automatically
+int ConfigEnv::getUdpBufferSize() const
+{
+  return std::max(0, std::stoi(envPresentOrDefault(this->env, EnvKey::udpBufferSize, "0")));
+}
+
+// Separate connect()ed UDP socket for every peer with a direct path
+bool ConfigEnv::getEnableConnectedSockets() const
+{
+  return strToBool(envPresentOrDefault(this->env, EnvKey::enableConnectedSockets, "false"));
+}
+
+// Interface to attach the AF_XDP receive path of the peer UDP port to, empty
+// (the default) keeps it on regular sockets only
+const std::string ConfigEnv::getXdpInterface() const
+{
+  return envPresentOrDefault(this->env, EnvKey::xdpInterface, "");
+}
+
+// Parity packets for the peers that lose some of the traffic, see FecLayer
+bool ConfigEnv::getEnableFec() const
+{
+  return strToBool(envPresentOrDefault(this->env, EnvKey::enableFec, "false"));
+}
+
+// Use all the working local interface x peer address pairs at once -
+// "balance" spreads the packets over them, "redundant" sends each packet over
+// the two best ones. "off" (the default) sticks to a single path.
+const std::string ConfigEnv::getMultipath() const
+{
+  return envPresentOrDefault(this->env, EnvKey::multipath, "off");
+}
+
+// How often the direct path of a peer is probed while the traffic to it gets
+// no answer (ms). 0 disables the probing.
+int ConfigEnv::getLivenessInterval() const
+{
+  return std::max(0, std::stoi(envPresentOrDefault(this->env, EnvKey::livenessInterval, "250")));
+}
@@ -35,4 +35,14 @@ class ConfigEnv {
   const InternetAddress getDaemonApiHost() const;
   int getDaemonApiPort() const;
   int getWorkerQueueSize() const;
+  const std::string getMulticastRateLimits() const;
+  bool getEnableCompression() const;
+  int getCompressionLevel() const;
+  int getTunMtu() const;
+  int getUdpBufferSize() const;
+  bool getEnableConnectedSockets() const;
+  const std::string getXdpInterface() const;
+  bool getEnableFec() const;
+  const std::string getMultipath() const;
+  int getLivenessInterval() const;
 };
@@ -7,6 +7,7 @@
 #include <sockets.h>
 
 #include "husarnet/dashboardapi/response.h"
+#include "husarnet/epoch.h"
 #include "husarnet/husarnet_config.h"
 #include "husarnet/licensing.h"
 
@@ -24,6 +25,24 @@ ConfigManager::ConfigManager(HooksManager* hooksManager, const ConfigEnv* config
     this->allowEveryone = true;
     HLOG_WARNING("config manager: control plane is disabled, any peer will be let through");
   }
+  this->publishAllowedPeers();
+}
+
+void ConfigManager::publishAllowedPeers()
+{
+  auto snapshot = new AllowedPeers;
+  snapshot->generation = ++this->allowedPeersGeneration;
+  snapshot->allowEveryone = this->allowEveryone;
+  snapshot->addresses.insert(this->allowedPeers.begin(), this->allowedPeers.end());
+  snapshot->addresses.insert(this->userWhitelist.begin(), this->userWhitelist.end());
+  snapshot->addresses.insert(this->apiAddresses.begin(), this->apiAddresses.end());
+  snapshot->addresses.insert(this->ebAddresses.begin(), this->ebAddresses.end());
+  snapshot->multicastDestinations.assign(this->allowedPeers.begin(), this->allowedPeers.end());
+
+  auto previous = this->allowedPeersSnapshot.exchange(snapshot, std::memory_order_acq_rel);
+  if(previous != nullptr) {
+    Epoch::retire(previous);
+  }
 }
 
 bool ConfigManager::fetchLicenseJson()
@@ -86,6 +105,8 @@ void ConfigManager::updateLicenseData()
   for(auto& ip : baseServerIps) {
     this->baseAddresses.push_back(InternetAddress::parse(ip));
   }
+
+  this->publishAllowedPeers();
 }
 
 HusarnetAddress ConfigManager::getApiAddress() const
@@ -169,12 +190,14 @@ void ConfigManager::updateGetConfigData()
 
         HLOG_DEBUG("parsing address from get_config // {address}", addrStr);
         auto addr = HusarnetAddress::parse(addrStr);
-        this->allowedPeers.insert(addr);  // TODO: handle set is full
+        this->allowedPeers.insert(addr);
         hostsEntries.insert({peerHostname, addr});
         for(auto& alias : aliases) {
           hostsEntries.insert({alias, addr});
         }
       }
+
+      this->publishAllowedPeers();
     }  // release locks before doing file IO
 
     // add also our own address as husarnet-local
@@ -232,6 +255,8 @@ void ConfigManager::updateUserConfigData()
         HLOG_WARNING("user whitelist contains invalid Husarnet address // {address}", entry);
       }
     }
+
+    this->publishAllowedPeers();
   }
 }
 
@@ -265,24 +290,12 @@ void ConfigManager::storeCache(const nlohmann::json& jsonDoc)
 
 bool ConfigManager::isPeerAllowed(const HusarnetAddress& address) const
 {
-  std::lock_guard lgFast(this->mutexFast);
-  if(this->allowEveryone) {
+  EpochGuard guard;
+  auto snapshot = this->allowedPeersSnapshot.load(std::memory_order_acquire);
+  if(snapshot->allowEveryone) {
     return true;
   }
-  for(auto& apiAddr : this->apiAddresses) {
-    if(apiAddr == address) {
-      return true;
-    }
-  }
-  for(auto& ebAddr : this->ebAddresses) {
-    if(ebAddr == address) {
-      return true;
-    }
-  }
-  if(this->userWhitelist.contains(address)) {
-    return true;
-  }
-  return this->allowedPeers.contains(address);
+  return snapshot->addresses.contains(address);
 }
 
 bool ConfigManager::isClaimed() const
@@ -297,18 +310,9 @@ etl::vector<InternetAddress, BASE_ADDRESSES_LIMIT> ConfigManager::getBaseAddress
   return this->baseAddresses;
 }
 
-etl::vector<HusarnetAddress, MULTICAST_DESTINATIONS_LIMIT> ConfigManager::getMulticastDestinations(HusarnetAddress id)
+const AllowedPeers* ConfigManager::getAllowedPeers() const
 {
-  std::lock_guard lgFast(this->mutexFast);
-  // TODO: figure out if this check was even relevant
-  //  if(!id == deviceIdFromIpAddress(multicastDestination)) {
-  //    return {};
-  //  }
-  auto result = etl::vector<HusarnetAddress, MULTICAST_DESTINATIONS_LIMIT>();
-  for(auto& peer : this->allowedPeers) {
-    result.push_back(peer);
-  }
-  return result;
+  return this->allowedPeersSnapshot.load(std::memory_order_acquire);
 }
 
 json ConfigManager::getDataForStatus() const
@@ -417,6 +421,7 @@ bool ConfigManager::userWhitelistAdd(const HusarnetAddress& address)
       return false;
     }
     this->userWhitelist.insert(address);
+    this->publishAllowedPeers();
   }  // release fast lock before doing file IO
 
   // Flush to disk
@@ -434,6 +439,7 @@ bool ConfigManager::userWhitelistRm(const HusarnetAddress& address)
   std::lock_guard lock(this->mutexFast);
   if(this->userWhitelist.contains(address)) {
     this->userWhitelist.erase(address);
+    this->publishAllowedPeers();
     return true;
   }
   HLOG_WARNING("config manager: IP is not on the whitelist");
@@ -451,3 +457,43 @@ int ConfigManager::getWorkerQueueSize() const
 {
   return this->configEnv->getWorkerQueueSize();
 }
+
+const std::string ConfigManager::getMulticastRateLimits() const
+{
+  return this->configEnv->getMulticastRateLimits();
+}
+
+bool ConfigManager::getEnableCompression() const
+{
+  return this->configEnv->getEnableCompression();
+}
+
+int ConfigManager::getCompressionLevel() const
+{
+  return this->configEnv->getCompressionLevel();
+}
+
+bool ConfigManager::getEnableConnectedSockets() const
+{
+  return this->configEnv->getEnableConnectedSockets();
+}
+
+const std::string ConfigManager::getXdpInterface() const
+{
+  return this->configEnv->getXdpInterface();
+}
+
+bool ConfigManager::getEnableFec() const
+{
+  return this->configEnv->getEnableFec();
+}
+
+const std::string ConfigManager::getMultipath() const
+{
+  return this->configEnv->getMultipath();
+}
+
+int ConfigManager::getLivenessInterval() const
+{
+  return this->configEnv->getLivenessInterval();
+}
@@ -3,8 +3,11 @@
 // License: specified in project_root/LICENSE.txt
 #pragma once
 #include <chrono>
+#include <atomic>
 #include <condition_variable>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #include "husarnet/config_env.h"
 #include "husarnet/hooks_manager.h"
@@ -19,14 +22,6 @@
 using namespace nlohmann;  // json
 
 // ETL return limits
-#ifndef MULTICAST_DESTINATIONS_LIMIT
-#define MULTICAST_DESTINATIONS_LIMIT 128
-#endif
-
-#ifndef ALLOWED_PEERS_LIMIT
-#define ALLOWED_PEERS_LIMIT 128
-#endif
-
 #ifndef BASE_ADDRESSES_LIMIT
 #define BASE_ADDRESSES_LIMIT 16
 #endif
@@ -79,6 +74,8 @@ using namespace nlohmann;  // json
 #define STATUS_KEY_BASECONNECTION_TYPE "type"
 #define STATUS_KEY_BASECONNECTION_ADDRESS "address"
 #define STATUS_KEY_BASECONNECTION_PORT "port"
+#define STATUS_KEY_BASECONNECTION_TCP_QUEUED "tcp_queued_bytes"
+#define STATUS_KEY_BASECONNECTION_TCP_DROPPED "tcp_dropped_writes"
 #define STATUS_KEY_DASHBOARDCONNECTION "dashboard_connection"
 #define STATUS_KEY_ENVIRONMENT "env"
 #define STATUS_KEY_ENVIRONMENT_INSTANCE_FQDN "instance_fqdn"
@@ -87,6 +84,35 @@ using namespace nlohmann;  // json
 #define STATUS_KEY_ENVIRONMENT_DAEMON_API_HOST "daemon_api_host"
 #define STATUS_KEY_ENVIRONMENT_DAEMON_API_PORT "daemon_api_port"
 #define STATUS_KEY_LIVEPEERS "peers"
+#define STATUS_KEY_PEERSTATS "peer_stats"
+#define STATUS_KEY_PEERSTATS_COUNT "count"
+#define STATUS_KEY_PEERSTATS_CREATED "created"
+#define STATUS_KEY_PEERSTATS_EVICTED "evicted"
+#define STATUS_KEY_PEERSTATS_SKIPPED_KEEPALIVES "skipped_keepalives"
+#define STATUS_KEY_MULTICAST "multicast"
+#define STATUS_KEY_MULTICAST_FORWARDED "forwarded"
+#define STATUS_KEY_MULTICAST_RATE_LIMITED "rate_limited"
+#define STATUS_KEY_MULTICAST_DUPLICATES "duplicates"
+#define STATUS_KEY_COMPRESSION "compression"
+#define STATUS_KEY_COMPRESSION_ENABLED "enabled"
+#define STATUS_KEY_COMPRESSION_COMPRESSED "compressed_packets"
+#define STATUS_KEY_COMPRESSION_SKIPPED "skipped_packets"
+#define STATUS_KEY_COMPRESSION_BYTES_IN "bytes_in"
+#define STATUS_KEY_COMPRESSION_BYTES_OUT "bytes_out"
+#define STATUS_KEY_FEC "fec"
+#define STATUS_KEY_FEC_ENABLED "enabled"
+#define STATUS_KEY_FEC_PARITY "parity_packets"
+#define STATUS_KEY_FEC_RECOVERED "recovered_packets"
+#define STATUS_KEY_LIVENESS "liveness"
+#define STATUS_KEY_LIVENESS_INTERVAL "interval_ms"
+#define STATUS_KEY_LIVENESS_FAILOVERS "failovers"
+#define STATUS_KEY_UDP "udp"
+#define STATUS_KEY_UDP_SEND_QUEUE "send_queue"
+#define STATUS_KEY_UDP_SEND_DROPS "send_drops"
+#define STATUS_KEY_UDP_RECEIVE_DROPS "receive_drops"
+#define STATUS_KEY_UDP_RECEIVE_BUFFER "receive_buffer"
+#define STATUS_KEY_UDP_SEND_BUFFER "send_buffer"
+#define STATUS_KEY_UDP_XDP_RECEIVED "xdp_received"
 #define STATUS_KEY_HEALTH "health"
 #define STATUS_KEY_HEALTH_SUMMARY "summary"
 
@@ -96,6 +122,16 @@ constexpr auto licenseRefreshPeriod = std::chrono::minutes(30);
 
 using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
 
+// Immutable view of everyone we're willing to talk to. A new one is built on
+// every change and published through an atomic pointer, so the data plane can
+// check it without taking any locks (old versions are released through Epoch)
+struct AllowedPeers {
+  uint64_t generation = 0;
+  bool allowEveryone = false;
+  std::unordered_set<HusarnetAddress, iphash> addresses;
+  std::vector<HusarnetAddress> multicastDestinations;
+};
+
 class ConfigManager {
  private:
   HooksManager* hooksManager;
@@ -119,7 +155,7 @@ class ConfigManager {
   TimePoint nextLicenseDownload;
   TimePoint nextGetConfigUpdate;
 
-  etl::set<HusarnetAddress, ALLOWED_PEERS_LIMIT> allowedPeers;
+  std::unordered_set<HusarnetAddress, iphash> allowedPeers;
   etl::set<HusarnetAddress, USER_WHITELIST_SIZE_LIMIT> userWhitelist;
   etl::vector<InternetAddress, BASE_ADDRESSES_LIMIT> baseAddresses;
   etl::vector<HusarnetAddress, DASHBOARD_API_ADDRESSES_LIMIT> apiAddresses;
@@ -128,6 +164,10 @@ class ConfigManager {
   etl::string<EMAIL_MAX_LENGTH> claimedBy;    // empty string if not claimed
   etl::string<HOSTNAME_MAX_LENGTH> hostname;  // the one changeable from the web interface
 
+  std::atomic<const AllowedPeers*> allowedPeersSnapshot{nullptr};
+  uint64_t allowedPeersGeneration = 0;
+  void publishAllowedPeers();  // has to be called with mutexFast held
+
   bool fetchLicenseJson();                 // HTTP call to TLD
   void storeLicense(const json& jsonDoc);  // save JSON doc
   void updateLicenseData();                // Transform JSON to internal structures
@@ -169,12 +209,13 @@ class ConfigManager {
                                   // data (like is connected to base, etc) -
                                   // ideally through the HusarnetManager
 
-  bool isPeerAllowed(const HusarnetAddress& address) const;
+  bool isPeerAllowed(const HusarnetAddress& address) const;  // lock-free
 
   bool isClaimed() const;
 
-  etl::vector<HusarnetAddress, MULTICAST_DESTINATIONS_LIMIT> getMulticastDestinations(
-      HusarnetAddress id);  // This has to be a high performance method
+  // This has to be a high performance method. The returned snapshot is only
+  // valid inside an EpochGuard.
+  const AllowedPeers* getAllowedPeers() const;
 
   // Those may change over time (license, get_config changes) so whoever
   // uses them is responsible for re-reading them periodically
@@ -185,4 +226,12 @@ class ConfigManager {
   HusarnetAddress getEbAddress() const;
 
   int getWorkerQueueSize() const;
+  const std::string getMulticastRateLimits() const;
+  bool getEnableCompression() const;
+  int getCompressionLevel() const;
+  bool getEnableConnectedSockets() const;
+  const std::string getXdpInterface() const;
+  bool getEnableFec() const;
+  const std::string getMultipath() const;
+  int getLivenessInterval() const;
 };
@@ -0,0 +1,640 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/egress_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "husarnet/ports/port_interface.h"
+#include "husarnet/ports/sockets.h"
+
+#include "husarnet/epoch.h"
+#include "husarnet/logging.h"
+
+using namespace nlohmann;  // json
+
+static uint16_t read16(string_view data, int offset)
+{
+  return ((uint8_t)data[offset] << 8) | (uint8_t)data[offset + 1];
+}
+
+static bool isUnicastPacket(string_view packet)
+{
+  return packet.size() >= 40 && ((uint8_t)packet[0] >> 4) == 6 && (uint8_t)packet[24] == 0xfc &&
+         (uint8_t)packet[25] == 0x94;
+}
+
+SchedulerConfig SchedulerConfig::defaults()
+{
+  SchedulerConfig config;
+
+  // EF, CS5, CS6 and CS7 - voice, signalling and network control
+  TrafficClass control;
+  control.name = "control";
+  control.priority = 0;
+  control.dscp = {46, 40, 48, 56};
+
+  // LE and CS1
+  TrafficClass bulk;
+  bulk.name = "bulk";
+  bulk.priority = 1;
+  bulk.weight = 1;
+  bulk.dscp = {1, 8};
+
+  TrafficClass standard;
+  standard.name = "default";
+  standard.priority = 1;
+  standard.weight = 4;
+
+  config.classes = {control, bulk, standard};
+  return config;
+}
+
+template <typename T>
+static bool readNumbers(const json& value, int min, int max, std::vector<T>& out)
+{
+  if(!value.is_array()) {
+    return false;
+  }
+
+  for(const auto& item : value) {
+    if(!item.is_number_integer() || item.get<int64_t>() < min || item.get<int64_t>() > max) {
+      return false;
+    }
+    out.push_back(item.get<int>());
+  }
+
+  return true;
+}
+
+bool SchedulerConfig::fromJson(const json& value, SchedulerConfig& config, std::string& error)
+{
+  config = SchedulerConfig{};
+
+  if(!value.is_object()) {
+    error = "config has to be an object";
+    return false;
+  }
+
+  if(value.contains("rate_limit")) {
+    if(!value["rate_limit"].is_number_unsigned()) {
+      error = "rate_limit has to be a non-negative integer";
+      return false;
+    }
+    config.rateLimit = value["rate_limit"].get<uint64_t>();
+  }
+
+  if(!value.contains("classes") || !value["classes"].is_array() || value["classes"].empty() ||
+     value["classes"].size() > SCHEDULER_MAX_CLASSES) {
+    error = "classes has to be an array of 1 to " + std::to_string(SCHEDULER_MAX_CLASSES) + " elements";
+    return false;
+  }
+
+  for(const auto& item : value["classes"]) {
+    TrafficClass trafficClass;
+    if(!item.is_object() || !item.contains("name") || !item["name"].is_string() ||
+       item["name"].get<std::string>().empty()) {
+      error = "every class needs a name";
+      return false;
+    }
+    trafficClass.name = item["name"].get<std::string>();
+
+    if(item.contains("priority")) {
+      if(!item["priority"].is_number_integer() || item["priority"].get<int64_t>() < 0 ||
+         item["priority"].get<int64_t>() > SCHEDULER_MAX_PRIORITY) {
+        error = "priority of " + trafficClass.name + " is out of range";
+        return false;
+      }
+      trafficClass.priority = item["priority"].get<int>();
+    }
+
+    if(item.contains("weight")) {
+      if(!item["weight"].is_number_integer() || item["weight"].get<int64_t>() < 1 ||
+         item["weight"].get<int64_t>() > SCHEDULER_MAX_WEIGHT) {
+        error = "weight of " + trafficClass.name + " is out of range";
+        return false;
+      }
+      trafficClass.weight = item["weight"].get<int>();
+    }
+
+    if(item.contains("dscp") && !readNumbers(item["dscp"], 0, 63, trafficClass.dscp)) {
+      error = "dscp of " + trafficClass.name + " has to be a list of values from 0 to 63";
+      return false;
+    }
+
+    if(item.contains("ports") && !readNumbers(item["ports"], 1, 65535, trafficClass.ports)) {
+      error = "ports of " + trafficClass.name + " have to be a list of values from 1 to 65535";
+      return false;
+    }
+
+    config.classes.push_back(trafficClass);
+  }
+
+  std::stable_sort(config.classes.begin(), config.classes.end(), [](const auto& a, const auto& b) {
+    return a.priority < b.priority;
+  });
+  return true;
+}
+
+json SchedulerConfig::toJson() const
+{
+  json classesJson = json::array();
+  for(const auto& trafficClass : this->classes) {
+    classesJson.push_back(json::object({
+        {"name", trafficClass.name},
+        {"priority", trafficClass.priority},
+        {"weight", trafficClass.weight},
+        {"dscp", trafficClass.dscp},
+        {"ports", trafficClass.ports},
+    }));
+  }
+
+  return json::object({
+      {"rate_limit", this->rateLimit},
+      {"classes", classesJson},
+  });
+}
+
+int SchedulerConfig::classify(string_view packet) const
+{
+  uint8_t dscp = (((uint8_t)packet[0] & 0x0F) << 2) | ((uint8_t)packet[1] >> 6);
+
+  uint8_t protocol = packet[6];
+  bool hasPorts = (protocol == 6 || protocol == 17) && packet.size() >= 44;
+  uint16_t sourcePort = hasPorts ? read16(packet, 40) : 0;
+  uint16_t destinationPort = hasPorts ? read16(packet, 42) : 0;
+
+  for(size_t i = 0; i < this->classes.size(); i++) {
+    const auto& trafficClass = this->classes[i];
+    if(trafficClass.dscp.empty() && trafficClass.ports.empty()) {
+      return i;
+    }
+
+    if(std::find(trafficClass.dscp.begin(), trafficClass.dscp.end(), dscp) != trafficClass.dscp.end()) {
+      return i;
+    }
+
+    if(hasPorts && std::any_of(trafficClass.ports.begin(), trafficClass.ports.end(), [&](uint16_t port) {
+         return port == sourcePort || port == destinationPort;
+       })) {
+      return i;
+    }
+  }
+
+  return this->classes.size() - 1;
+}
+
+void CoDelQueue::push(std::string&& packet, Time enqueued)
+{
+  this->bytes += packet.size();
+  this->entries.push_back(Entry{std::move(packet), enqueued});
+}
+
+bool CoDelQueue::popEntry(Time now, Entry& entry, bool& okToDrop)
+{
+  okToDrop = false;
+  if(this->entries.empty()) {
+    this->firstAboveTime = 0;
+    return false;
+  }
+
+  entry = std::move(this->entries.front());
+  this->entries.pop_front();
+  this->bytes -= entry.packet.size();
+
+  if(now - entry.enqueued < CODEL_TARGET || this->bytes <= CODEL_MIN_BYTES) {
+    this->firstAboveTime = 0;
+  } else if(this->firstAboveTime == 0) {
+    this->firstAboveTime = now + CODEL_INTERVAL;
+  } else if(now >= this->firstAboveTime) {
+    okToDrop = true;
+  }
+
+  return true;
+}
+
+static Time controlLaw(Time t, uint32_t count)
+{
+  return t + (Time)(CODEL_INTERVAL / std::sqrt((double)count));
+}
+
+// Returns true if the packet was marked and should be sent anyway
+bool CoDelQueue::dropOrMark(Entry& entry)
+{
+  auto& packet = entry.packet;
+  int ecn = ((uint8_t)packet[1] >> 4) & 0x03;
+  if(ecn == 0) {
+    this->drops++;
+    return false;
+  }
+
+  packet[1] = (char)(packet[1] | 0x30);  // CE
+  this->marks++;
+  return true;
+}
+
+bool CoDelQueue::pop(Time now, std::string& packet)
+{
+  Entry entry;
+  bool okToDrop;
+  if(!popEntry(now, entry, okToDrop)) {
+    this->dropping = false;
+    return false;
+  }
+
+  if(this->dropping) {
+    if(!okToDrop) {
+      this->dropping = false;
+    }
+
+    while(this->dropping && now >= this->dropNext) {
+      this->count++;
+      this->dropNext = controlLaw(this->dropNext, this->count);
+      if(dropOrMark(entry)) {
+        break;
+      }
+
+      if(!popEntry(now, entry, okToDrop)) {
+        this->dropping = false;
+        return false;
+      }
+
+      if(!okToDrop) {
+        this->dropping = false;
+      }
+    }
+  } else if(okToDrop) {
+    // Start from the drop rate that was in effect when the previous dropping
+    // state ended if it was recent
+    uint32_t delta = this->count - this->lastCount;
+    this->count = (delta > 1 && now - this->dropNext < 16 * CODEL_INTERVAL) ? delta : 1;
+    this->dropNext = controlLaw(now, this->count);
+    this->lastCount = this->count;
+    this->dropping = true;
+
+    if(!dropOrMark(entry) && !popEntry(now, entry, okToDrop)) {
+      return false;
+    }
+  }
+
+  packet = std::move(entry.packet);
+  return true;
+}
+
+void CoDelQueue::takeAll(std::vector<std::pair<std::string, Time>>& out)
+{
+  for(auto& entry : this->entries) {
+    out.emplace_back(std::move(entry.packet), entry.enqueued);
+  }
+
+  this->entries.clear();
+  this->bytes = 0;
+}
+
+bool CoDelQueue::empty() const
+{
+  return this->entries.empty();
+}
+
+size_t CoDelQueue::size() const
+{
+  return this->entries.size();
+}
+
+size_t CoDelQueue::frontSize() const
+{
+  return this->entries.front().packet.size();
+}
+
+uint64_t CoDelQueue::getDrops() const
+{
+  return this->drops;
+}
+
+uint64_t CoDelQueue::getMarks() const
+{
+  return this->marks;
+}
+
+EgressScheduler::EgressScheduler()
+{
+  auto loaded = SchedulerConfig::defaults();
+
+  auto stored = Port::readStorage(StorageKey::schedulerConfig);
+  if(!stored.empty()) {
+    std::string error;
+    SchedulerConfig parsed;
+    if(SchedulerConfig::fromJson(json::parse(stored, nullptr, false), parsed, error)) {
+      loaded = parsed;
+    } else {
+      HLOG_ERROR("stored scheduler config is invalid, using the default one // {error}", error);
+    }
+  }
+
+  publishConfig(loaded);
+}
+
+void EgressScheduler::publishConfig(const SchedulerConfig& newConfig)
+{
+  auto snapshot = new ConfigSnapshot{++this->generation, newConfig};
+  auto previous = this->config.exchange(snapshot, std::memory_order_acq_rel);
+  if(previous != nullptr) {
+    Epoch::retire(previous);
+  }
+}
+
+// Callers have to be in an epoch critical section
+const EgressScheduler::ConfigSnapshot* EgressScheduler::currentConfig()
+{
+  auto snapshot = this->config.load(std::memory_order_acquire);
+
+  if(snapshot->generation != this->statsGeneration) {
+    this->statsGeneration = snapshot->generation;
+    for(auto& classStats : this->stats) {
+      classStats.dequeued = 0;
+      classStats.tailDrops = 0;
+      classStats.codelDrops = 0;
+      classStats.codelMarks = 0;
+    }
+  }
+
+  return snapshot;
+}
+
+// Packets queued under the previous config are classified again
+void EgressScheduler::syncPeer(PeerState& peer, const ConfigSnapshot* snapshot)
+{
+  if(peer.generation == snapshot->generation) {
+    return;
+  }
+
+  std::vector<std::pair<std::string, Time>> queued;
+  for(auto& classState : peer.classes) {
+    classState.queue.takeAll(queued);
+  }
+
+  const auto& config = snapshot->config;
+  peer.generation = snapshot->generation;
+  peer.classes = std::vector<ClassState>(config.classes.size());
+  std::fill(std::begin(peer.current), std::end(peer.current), 0);
+  peer.tokens = std::min(peer.tokens, getBurst(config));
+
+  for(auto& [packet, enqueued] : queued) {
+    peer.classes[config.classify(packet)].queue.push(std::move(packet), enqueued);
+  }
+}
+
+bool EgressScheduler::isEmpty(const PeerState& peer) const
+{
+  return std::all_of(
+      peer.classes.begin(), peer.classes.end(), [](const ClassState& state) { return state.queue.empty(); });
+}
+
+int64_t EgressScheduler::getBurst(const SchedulerConfig& config) const
+{
+  return std::max<int64_t>(config.rateLimit * SCHEDULER_BURST_MS / 1000, 2 * SCHEDULER_QUANTUM);
+}
+
+void EgressScheduler::refill(PeerState& peer, const SchedulerConfig& config, Time now)
+{
+  if(config.rateLimit == 0) {
+    return;
+  }
+
+  Time elapsed = now - peer.lastRefill;
+  if(elapsed <= 0) {
+    return;
+  }
+
+  peer.tokens = std::min<int64_t>(peer.tokens + config.rateLimit * elapsed / 1000, getBurst(config));
+  peer.lastRefill = now;
+}
+
+// Packets are held back while any of the UDP sockets has a queue of its own,
+// so the priorities apply to the traffic saturating the local uplink too
+bool EgressScheduler::canSend(PeerState& peer, const SchedulerConfig& config)
+{
+  if(OsSocket::getUdpSendQueueDepth() > 0) {
+    return false;
+  }
+
+  return config.rateLimit == 0 || peer.tokens > 0;
+}
+
+bool EgressScheduler::dequeue(PeerState& peer, const SchedulerConfig& config, Time now, std::string& packet)
+{
+  size_t classCount = config.classes.size();
+  for(size_t begin = 0; begin < classCount;) {
+    size_t end = begin;
+    while(end < classCount && config.classes[end].priority == config.classes[begin].priority) {
+      end++;
+    }
+
+    int& current = peer.current[begin];
+    while(std::any_of(peer.classes.begin() + begin, peer.classes.begin() + end, [](const ClassState& state) {
+      return !state.queue.empty();
+    })) {
+      size_t index = begin + current;
+      auto& state = peer.classes[index];
+
+      if(state.queue.empty()) {
+        state.deficit = 0;
+        current = (current + 1) % (end - begin);
+        continue;
+      }
+
+      if(state.deficit < (int)state.queue.frontSize()) {
+        state.deficit += config.classes[index].weight * SCHEDULER_QUANTUM;
+        current = (current + 1) % (end - begin);
+        continue;
+      }
+
+      auto& classStats = this->stats[index];
+      uint64_t drops = state.queue.getDrops();
+      uint64_t marks = state.queue.getMarks();
+      bool popped = state.queue.pop(now, packet);
+      classStats.codelDrops += state.queue.getDrops() - drops;
+      classStats.codelMarks += state.queue.getMarks() - marks;
+
+      if(popped) {
+        state.deficit -= packet.size();
+        classStats.dequeued++;
+        return true;
+      }
+    }
+
+    begin = end;
+  }
+
+  return false;
+}
+
+bool EgressScheduler::drain(HusarnetAddress target, PeerState& peer, const SchedulerConfig& config, Time now)
+{
+  bool sent = false;
+  std::string packet;
+
+  while(canSend(peer, config) && dequeue(peer, config, now, packet)) {
+    peer.tokens -= packet.size();
+    sendToLowerLayer(target, packet);
+    sent = true;
+  }
+
+  // Wake up as soon as the rate limit lets the next packet through, a full
+  // socket wakes the loop up by itself
+  if(config.rateLimit > 0 && peer.tokens <= 0 && !isEmpty(peer)) {
+    OsSocket::limitNextTimeout(1 + (-peer.tokens * 1000) / config.rateLimit);
+  }
+
+  return sent;
+}
+
+void EgressScheduler::drainAll()
+{
+  EpochGuard guard;
+  auto snapshot = currentConfig();
+  const auto& config = snapshot->config;
+  Time now = Port::getCurrentTime();
+
+  bool sent = false;
+  uint64_t queued[SCHEDULER_MAX_CLASSES] = {};
+
+  for(auto it = this->peers.begin(); it != this->peers.end();) {
+    auto& peer = it->second;
+    syncPeer(peer, snapshot);
+    refill(peer, config, now);
+    sent |= drain(it->first, peer, config, now);
+
+    // Idle peers that would start with a full bucket anyway are forgotten
+    if(isEmpty(peer) && (config.rateLimit == 0 || peer.tokens >= getBurst(config))) {
+      it = this->peers.erase(it);
+      continue;
+    }
+
+    for(size_t i = 0; i < peer.classes.size(); i++) {
+      queued[i] += peer.classes[i].queue.size();
+    }
+    it++;
+  }
+
+  for(int i = 0; i < SCHEDULER_MAX_CLASSES; i++) {
+    this->stats[i].queued = queued[i];
+  }
+
+  if(sent) {
+    flushLowerLayer();
+  }
+}
+
+void EgressScheduler::onUpperLayerData(HusarnetAddress target, string_view packet)
+{
+  if(!isUnicastPacket(packet)) {
+    sendToLowerLayer(target, packet);
+    return;
+  }
+
+  EpochGuard guard;
+  auto snapshot = currentConfig();
+  const auto& config = snapshot->config;
+
+  std::lock_guard lg(this->peersMutex);
+  auto destination = HusarnetAddress::fromBinary(&packet[24]);
+  auto it = this->peers.find(destination);
+  if(it == this->peers.end() && config.rateLimit == 0 && OsSocket::getUdpSendQueueDepth() == 0) {
+    sendToLowerLayer(target, packet);
+    return;
+  }
+
+  Time now = Port::getCurrentTime();
+  if(it == this->peers.end()) {
+    it = this->peers.emplace(destination, PeerState{}).first;
+    it->second.tokens = getBurst(config);
+    it->second.lastRefill = now;
+  }
+
+  auto& peer = it->second;
+  syncPeer(peer, snapshot);
+  refill(peer, config, now);
+
+  if(isEmpty(peer) && canSend(peer, config)) {
+    peer.tokens -= packet.size();
+    sendToLowerLayer(target, packet);
+    return;
+  }
+
+  int index = config.classify(packet);
+  auto& queue = peer.classes[index].queue;
+  if(queue.size() >= SCHEDULER_QUEUE_LIMIT) {
+    this->stats[index].tailDrops++;
+    return;
+  }
+
+  queue.push(packet.str(), now);
+  drain(target, peer, config, now);
+}
+
+void EgressScheduler::onUpperLayerFlush()
+{
+  std::lock_guard lg(this->peersMutex);
+  drainAll();
+  flushLowerLayer();
+}
+
+void EgressScheduler::onLowerLayerData(HusarnetAddress source, string_view packet)
+{
+  sendToUpperLayer(source, packet);
+}
+
+void EgressScheduler::periodic()
+{
+  std::lock_guard lg(this->peersMutex);
+  if(!this->peers.empty()) {
+    drainAll();
+  }
+}
+
+json EgressScheduler::getConfig()
+{
+  EpochGuard guard;
+  return this->config.load(std::memory_order_acquire)->config.toJson();
+}
+
+bool EgressScheduler::setConfig(const json& value, std::string& error)
+{
+  SchedulerConfig newConfig;
+  if(!SchedulerConfig::fromJson(value, newConfig, error)) {
+    return false;
+  }
+
+  std::lock_guard lg(this->configMutex);
+  publishConfig(newConfig);
+
+  if(!Port::writeStorage(StorageKey::schedulerConfig, newConfig.toJson().dump())) {
+    HLOG_WARNING("unable to store the scheduler config, it will be lost on restart");
+  }
+
+  HLOG_INFO("scheduler config updated // {classes} {rate_limit}", newConfig.classes.size(), newConfig.rateLimit);
+  return true;
+}
+
+json EgressScheduler::getStats()
+{
+  EpochGuard guard;
+  const auto& config = this->config.load(std::memory_order_acquire)->config;
+
+  json classesJson = json::array();
+  for(size_t i = 0; i < config.classes.size(); i++) {
+    const auto& classStats = this->stats[i];
+    classesJson.push_back(json::object({
+        {"name", config.classes[i].name},
+        {"queued", classStats.queued.load()},
+        {"dequeued", classStats.dequeued.load()},
+        {"tail_drops", classStats.tailDrops.load()},
+        {"codel_drops", classStats.codelDrops.load()},
+        {"codel_marks", classStats.codelMarks.load()},
+    }));
+  }
+
+  return json::object({{"classes", classesJson}});
+}
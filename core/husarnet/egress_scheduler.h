@@ -0,0 +1,191 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/ipaddress.h"
+#include "husarnet/layer_interfaces.h"
+#include "husarnet/string_view.h"
+
+#include "nlohmann/json.hpp"
+
+const int SCHEDULER_MAX_CLASSES = 8;
+const int SCHEDULER_MAX_PRIORITY = 7;
+const int SCHEDULER_MAX_WEIGHT = 100;
+// Bytes a class of weight 1 may send in a single deficit round robin turn
+const int SCHEDULER_QUANTUM = 2000;
+// Shaped peers may send this much above the rate in a burst (at least two
+// quanta)
+const int SCHEDULER_BURST_MS = 10;
+// Packets queued per class and peer, the rest is tail dropped
+#ifdef ESP_PLATFORM
+const size_t SCHEDULER_QUEUE_LIMIT = 16;
+#else
+const size_t SCHEDULER_QUEUE_LIMIT = 256;
+#endif
+
+// CoDel parameters (RFC 8289), in ms
+const Time CODEL_TARGET = 5;
+const Time CODEL_INTERVAL = 100;
+// Queue that holds less than a single packet is never considered standing
+const size_t CODEL_MIN_BYTES = 1500;
+
+struct TrafficClass {
+  std::string name;
+  // Lower goes first - classes of a higher priority are only served when all
+  // of the lower ones are empty
+  int priority = 0;
+  // Share among the classes of the same priority
+  int weight = 1;
+  // Match rules, a class with none of them matches everything
+  std::vector<uint8_t> dscp;
+  std::vector<uint16_t> ports;  // either source or destination
+};
+
+struct SchedulerConfig {
+  // Per peer shaping in bytes per second, 0 disables it. Without it packets
+  // only queue up while the UDP socket is full, so it should be set a bit
+  // below the uplink for the classes to matter on a remote bottleneck.
+  uint64_t rateLimit = 0;
+  // Sorted by priority, matched in this order
+  std::vector<TrafficClass> classes;
+
+  static SchedulerConfig defaults();
+  static bool fromJson(const nlohmann::json& json, SchedulerConfig& config, std::string& error);
+  nlohmann::json toJson() const;
+
+  // Class of the IPv6 packet, the last one if nothing matches
+  int classify(string_view packet) const;
+};
+
+// FIFO with CoDel (RFC 8289) applied on dequeue. ECN capable packets are
+// marked (CE) instead of being dropped.
+class CoDelQueue {
+ private:
+  struct Entry {
+    std::string packet;
+    Time enqueued;
+  };
+
+  std::deque<Entry> entries;
+  size_t bytes = 0;
+
+  Time firstAboveTime = 0;
+  Time dropNext = 0;
+  uint32_t count = 0;
+  uint32_t lastCount = 0;
+  bool dropping = false;
+
+  uint64_t drops = 0;
+  uint64_t marks = 0;
+
+  bool popEntry(Time now, Entry& entry, bool& okToDrop);
+  bool dropOrMark(Entry& entry);
+
+ public:
+  void push(std::string&& packet, Time enqueued);
+  // Returns false once the queue is empty (which may be the result of
+  // dropping everything that was left)
+  bool pop(Time now, std::string& packet);
+  // Removes everything bypassing CoDel, in the FIFO order
+  void takeAll(std::vector<std::pair<std::string, Time>>& out);
+
+  bool empty() const;
+  size_t size() const;
+  size_t frontSize() const;
+
+  uint64_t getDrops() const;
+  uint64_t getMarks() const;
+};
+
+// Per peer queueing discipline, sits between the tun and the multicast
+// layer (the latter strips the IPv6 header, and the DSCP with it). Packets
+// are passed straight through as long as the peer has nothing queued and
+// neither its rate limit nor a full UDP socket holds it back. Otherwise they
+// are queued per class and sent out in strict priority order between the
+// priorities and by deficit round robin (weighted) within a priority, with
+// CoDel keeping each class from building a standing queue.
+// Multicast is not scheduled.
+class EgressScheduler : public BidirectionalLayer {
+ private:
+  struct ClassState {
+    CoDelQueue queue;
+    int deficit = 0;
+  };
+
+  struct PeerState {
+    uint64_t generation = 0;
+    std::vector<ClassState> classes;
+    // Position of the round robin within every priority, indexed by its
+    // first class
+    int current[SCHEDULER_MAX_CLASSES] = {};
+    int64_t tokens = 0;
+    Time lastRefill = 0;
+  };
+
+  // Only the packets that had to wait are accounted, the ones passed
+  // straight through are not classified at all
+  struct ClassStats {
+    std::atomic<uint64_t> dequeued{0};
+    std::atomic<uint64_t> tailDrops{0};
+    std::atomic<uint64_t> codelDrops{0};
+    std::atomic<uint64_t> codelMarks{0};
+    std::atomic<uint64_t> queued{0};
+  };
+
+  struct ConfigSnapshot {
+    uint64_t generation;
+    SchedulerConfig config;
+  };
+
+  std::atomic<ConfigSnapshot*> config{nullptr};
+  std::mutex configMutex;  // serializes the writers
+  uint64_t generation = 0;
+
+  // Packets come from the tun reader thread on some platforms while the
+  // rate limited ones are drained from the main loop, so the whole path
+  // through the scheduler (and down the stack) is serialized with this
+  std::mutex peersMutex;
+  std::unordered_map<HusarnetAddress, PeerState, iphash> peers;
+  uint64_t statsGeneration = 0;
+  ClassStats stats[SCHEDULER_MAX_CLASSES];
+
+  void publishConfig(const SchedulerConfig& newConfig);
+  const ConfigSnapshot* currentConfig();
+
+  void syncPeer(PeerState& peer, const ConfigSnapshot* snapshot);
+  bool isEmpty(const PeerState& peer) const;
+  int64_t getBurst(const SchedulerConfig& config) const;
+  void refill(PeerState& peer, const SchedulerConfig& config, Time now);
+  bool canSend(PeerState& peer, const SchedulerConfig& config);
+  bool dequeue(PeerState& peer, const SchedulerConfig& config, Time now, std::string& packet);
+  // Returns whether anything was sent
+  bool drain(HusarnetAddress target, PeerState& peer, const SchedulerConfig& config, Time now);
+  // Has to be called with peersMutex held
+  void drainAll();
+
+ public:
+  EgressScheduler();
+
+  void onUpperLayerData(HusarnetAddress target, string_view packet) override;
+  void onUpperLayerFlush() override;
+  void onLowerLayerData(HusarnetAddress source, string_view packet) override;
+
+  // Sends what the rate limits let through since the last call
+  void periodic();
+
+  // Thread safe
+  nlohmann::json getConfig();
+  bool setConfig(const nlohmann::json& json, std::string& error);
+  nlohmann::json getStats();
+};
@@ -0,0 +1,100 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/epoch.h"
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+
+namespace Epoch {
+  // Readers register themselves under the parity of the epoch they have
+  // observed. The epoch may only move from E to E+1 when nobody is registered
+  // under E-1 anymore, so an object retired during E is unreachable once the
+  // epoch reaches E+2.
+  struct alignas(64) ReaderCounter {
+    std::atomic<int> count{0};
+  };
+
+  struct Retired {
+    uint64_t epoch;
+    std::function<void()> deleter;
+  };
+
+  static std::atomic<uint64_t> globalEpoch{0};
+  static ReaderCounter readers[2];
+
+  static std::mutex retiredMutex;
+  static std::list<Retired> retired;
+
+  static thread_local int nesting = 0;
+  static thread_local int slot = 0;
+
+  void enter()
+  {
+    if(nesting++ > 0) {
+      return;
+    }
+
+    while(true) {
+      uint64_t epoch = globalEpoch.load();
+      readers[epoch & 1].count.fetch_add(1);
+
+      // The epoch could have advanced between the load and the registration
+      // in which case our counter might have been already checked as empty
+      if(globalEpoch.load() == epoch) {
+        slot = epoch & 1;
+        return;
+      }
+
+      readers[epoch & 1].count.fetch_sub(1);
+    }
+  }
+
+  void leave()
+  {
+    if(--nesting > 0) {
+      return;
+    }
+
+    readers[slot].count.fetch_sub(1);
+  }
+
+  void retire(std::function<void()> deleter)
+  {
+    std::scoped_lock lock(retiredMutex);
+    retired.push_back({globalEpoch.load(), std::move(deleter)});
+  }
+
+  void reclaim()
+  {
+    std::list<Retired> ready;
+
+    {
+      std::scoped_lock lock(retiredMutex);
+      if(retired.empty()) {
+        return;
+      }
+
+      uint64_t epoch = globalEpoch.load();
+      if(readers[(epoch + 1) & 1].count.load() == 0) {
+        globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+      }
+
+      epoch = globalEpoch.load();
+      for(auto it = retired.begin(); it != retired.end();) {
+        auto next = std::next(it);
+        if(it->epoch + 2 <= epoch) {
+          ready.splice(ready.end(), retired, it);
+        }
+        it = next;
+      }
+    }
+
+    // Deleters run without the lock as they may retire objects on their own
+    for(auto& item : ready) {
+      item.deleter();
+    }
+  }
+}  // namespace Epoch
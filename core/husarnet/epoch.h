@@ -0,0 +1,46 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <functional>
+
+// Epoch based reclamation for data structures that are read without locks.
+// Readers wrap their accesses in an EpochGuard, writers unlink objects first
+// and then hand them over to retire(). Retired objects are freed by reclaim()
+// once every reader that could still observe them has left its critical
+// section.
+namespace Epoch {
+  // Critical sections may be nested, only the outermost one is tracked
+  void enter();
+  void leave();
+
+  // Schedule the callback to run once no reader can access the unlinked
+  // object anymore
+  void retire(std::function<void()> deleter);
+
+  template <typename T>
+  void retire(T* object)
+  {
+    retire([object]() { delete object; });
+  }
+
+  // Try to advance the global epoch and free everything that became safe.
+  // Must not be called from within a critical section.
+  void reclaim();
+}  // namespace Epoch
+
+class EpochGuard {
+ public:
+  EpochGuard()
+  {
+    Epoch::enter();
+  }
+
+  ~EpochGuard()
+  {
+    Epoch::leave();
+  }
+
+  EpochGuard(const EpochGuard&) = delete;
+  EpochGuard& operator=(const EpochGuard&) = delete;
+};
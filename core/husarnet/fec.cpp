@@ -0,0 +1,319 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/fec.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <string.h>
+
+static uint16_t read16(string_view data, int offset)
+{
+  return ((uint8_t)data[offset] << 8) | (uint8_t)data[offset + 1];
+}
+
+static void write16(std::string& data, int offset, uint16_t value)
+{
+  data[offset] = (char)(value >> 8);
+  data[offset + 1] = (char)(value & 0xFF);
+}
+
+static uint32_t read32(string_view data, int offset)
+{
+  return ((uint32_t)read16(data, offset) << 16) | read16(data, offset + 2);
+}
+
+static void write32(std::string& data, int offset, uint32_t value)
+{
+  write16(data, offset, (uint16_t)(value >> 16));
+  write16(data, offset + 2, (uint16_t)(value & 0xFFFF));
+}
+
+// A single parity packet recovers a single loss, so the group has to be small
+// enough for two losses within one to stay unlikely. Below the lowest
+// threshold the overhead isn't worth it.
+int fecGroupSize(double loss)
+{
+  if(loss < 0.005) {
+    return 0;
+  }
+  if(loss < 0.02) {
+    return 16;
+  }
+  if(loss < 0.05) {
+    return 8;
+  }
+  return 4;
+}
+
+void FecEncoder::encode(string_view packet, Time now, std::string& out, std::string& parityOut)
+{
+  uint16_t seq = this->nextSeq++;
+
+  out.resize(FEC_DATA_HEADER_SIZE + packet.size());
+  out[0] = FEC_DATA_PACKET_TYPE;
+  write16(out, 1, seq);
+  memcpy(&out[FEC_DATA_HEADER_SIZE], packet.data(), packet.size());
+
+  parityOut.clear();
+  if(this->groupSize == 0) {
+    return;
+  }
+
+  if(this->groupCount == 0) {
+    this->groupStart = seq;
+    this->groupStarted = now;
+    this->lengthXor = 0;
+    this->parity.clear();
+  }
+
+  if(this->parity.size() < packet.size()) {
+    this->parity.resize(packet.size(), 0);
+  }
+  for(size_t i = 0; i < packet.size(); i++) {
+    this->parity[i] ^= packet[i];
+  }
+  this->lengthXor ^= (uint16_t)packet.size();
+  this->groupCount++;
+
+  if(this->groupCount >= this->groupSize) {
+    writeParity(parityOut);
+  }
+}
+
+void FecEncoder::writeParity(std::string& out)
+{
+  out.resize(FEC_PARITY_HEADER_SIZE + this->parity.size());
+  out[0] = FEC_PARITY_PACKET_TYPE;
+  write16(out, 1, this->groupStart);
+  out[3] = (char)this->groupCount;
+  write16(out, 4, this->lengthXor);
+  memcpy(&out[FEC_PARITY_HEADER_SIZE], this->parity.data(), this->parity.size());
+
+  this->groupCount = 0;
+}
+
+bool FecEncoder::expire(Time now, std::string& parityOut)
+{
+  if(this->groupCount == 0 || now - this->groupStarted < FEC_GROUP_TIMEOUT) {
+    return false;
+  }
+
+  if(this->groupCount < 2) {
+    this->groupCount = 0;
+    return false;
+  }
+
+  writeParity(parityOut);
+  return true;
+}
+
+Time FecEncoder::getDeadline() const
+{
+  if(this->groupCount == 0) {
+    return -1;
+  }
+
+  return this->groupStarted + FEC_GROUP_TIMEOUT;
+}
+
+void FecEncoder::handleReport(string_view report)
+{
+  if(report.size() < FEC_REPORT_SIZE) {
+    return;
+  }
+
+  uint32_t counter = read32(report, 1);
+  if(counter <= this->lastReportCounter) {
+    return;
+  }
+  this->lastReportCounter = counter;
+
+  double reported = std::min(read16(report, 5), (uint16_t)10000) / 10000.0;
+  this->loss = (this->loss + reported) / 2;
+  this->groupSize = fecGroupSize(this->loss);
+
+  // Groups are always made of consecutive packets, so the open one can't be
+  // continued after a pause
+  if(this->groupSize == 0) {
+    this->groupCount = 0;
+  }
+}
+
+int FecEncoder::getGroupSize() const
+{
+  return this->groupSize;
+}
+
+double FecEncoder::getLoss() const
+{
+  return this->loss;
+}
+
+FecDecoder::Slot& FecDecoder::getSlot(uint16_t seq)
+{
+  if(this->window.empty()) {
+    this->window.resize(FEC_WINDOW);
+  }
+
+  return this->window[seq % FEC_WINDOW];
+}
+
+void FecDecoder::advance(uint16_t seq)
+{
+  if(!this->started) {
+    this->started = true;
+    this->highestSeq = seq;
+    this->expected++;
+    return;
+  }
+
+  int16_t distance = (int16_t)(seq - this->highestSeq);
+  if(distance > 0) {
+    this->expected += distance;
+    this->highestSeq = seq;
+  }
+}
+
+void FecDecoder::decode(string_view packet, const DeliverCallback& deliver)
+{
+  if(packet.size() == 0) {
+    return;
+  }
+
+  if(packet[0] == FEC_DATA_PACKET_TYPE) {
+    handleData(packet, deliver);
+  } else if(packet[0] == FEC_PARITY_PACKET_TYPE) {
+    handleParity(packet, deliver);
+  }
+}
+
+void FecDecoder::handleData(string_view packet, const DeliverCallback& deliver)
+{
+  if(packet.size() <= FEC_DATA_HEADER_SIZE) {
+    return;
+  }
+
+  uint16_t seq = read16(packet, 1);
+  auto payload = packet.substr(FEC_DATA_HEADER_SIZE);
+
+  auto& slot = getSlot(seq);
+  if(slot.valid && slot.seq == seq) {
+    return;  // a duplicate or already recovered
+  }
+
+  if(!deliver(payload)) {
+    return;
+  }
+
+  slot.valid = true;
+  slot.seq = seq;
+  slot.packet.assign(payload.data(), payload.size());
+
+  advance(seq);
+  this->received++;
+}
+
+void FecDecoder::handleParity(string_view packet, const DeliverCallback& deliver)
+{
+  if(packet.size() <= FEC_PARITY_HEADER_SIZE) {
+    return;
+  }
+
+  uint16_t start = read16(packet, 1);
+  int count = (uint8_t)packet[3];
+  uint16_t length = read16(packet, 4);
+  if(count < 2 || count > FEC_MAX_GROUP_SIZE) {
+    return;
+  }
+
+  int missing = -1;
+  for(int i = 0; i < count; i++) {
+    uint16_t seq = start + i;
+    auto& slot = getSlot(seq);
+    if(slot.valid && slot.seq == seq) {
+      continue;
+    }
+
+    if(slot.valid && (int16_t)(slot.seq - seq) > 0) {
+      return;  // the group is already out of the window
+    }
+
+    if(missing >= 0) {
+      return;  // XOR can't help with two
+    }
+    missing = i;
+  }
+
+  if(missing < 0) {
+    return;
+  }
+
+  auto parity = packet.substr(FEC_PARITY_HEADER_SIZE);
+  this->recoveryBuffer.assign(parity.data(), parity.size());
+
+  for(int i = 0; i < count; i++) {
+    if(i == missing) {
+      continue;
+    }
+
+    const auto& slot = getSlot(start + i);
+    if(slot.packet.size() > this->recoveryBuffer.size()) {
+      return;
+    }
+    for(size_t j = 0; j < slot.packet.size(); j++) {
+      this->recoveryBuffer[j] ^= slot.packet[j];
+    }
+    length ^= (uint16_t)slot.packet.size();
+  }
+
+  if(length == 0 || length > this->recoveryBuffer.size()) {
+    return;
+  }
+
+  // Forged parity recovers garbage, which is rejected upstream
+  if(!deliver(string_view(this->recoveryBuffer).substr(0, length))) {
+    return;
+  }
+
+  uint16_t seq = start + missing;
+  auto& slot = getSlot(seq);
+  slot.valid = true;
+  slot.seq = seq;
+  slot.packet.assign(this->recoveryBuffer.data(), length);
+  this->recovered++;
+
+  // Losses at the end of the group are only visible here
+  if(this->started) {
+    advance(seq);
+  }
+}
+
+bool FecDecoder::takeReport(Time now, std::string& out)
+{
+  if(this->expected < FEC_REPORT_MIN_PACKETS || now - this->lastReport < FEC_REPORT_INTERVAL) {
+    return false;
+  }
+
+  // Reordering may push received above expected for a moment
+  double loss = 0;
+  if(this->received < this->expected) {
+    loss = double(this->expected - this->received) / this->expected;
+  }
+
+  out.resize(FEC_REPORT_SIZE);
+  out[0] = FEC_REPORT_PACKET_TYPE;
+  write32(out, 1, ++this->reportCounter);
+  write16(out, 5, (uint16_t)std::lround(loss * 10000));
+
+  this->expected = 0;
+  this->received = 0;
+  this->lastReport = now;
+  return true;
+}
+
+uint64_t FecDecoder::getRecovered() const
+{
+  return this->recovered;
+}
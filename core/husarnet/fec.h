@@ -0,0 +1,126 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/string_view.h"
+
+// Packet types added by FEC on top of the sealed ones (see SecurityLayer for
+// the rest). Those values are hardcoded in the protocol.
+const char FEC_DATA_PACKET_TYPE = 10;
+const char FEC_PARITY_PACKET_TYPE = 11;
+const char FEC_REPORT_PACKET_TYPE = 12;
+
+// <type> <seq:16>
+const int FEC_DATA_HEADER_SIZE = 3;
+// <type> <first seq:16> <count> <xor of the lengths:16>
+const int FEC_PARITY_HEADER_SIZE = 6;
+// <type> <counter:32> <loss:16 in 1/10000>, FecLayer authenticates it with
+// a tag appended after that
+const int FEC_REPORT_SIZE = 7;
+
+const int FEC_MAX_GROUP_SIZE = 16;
+// Packets the receiver keeps around to recover the lost ones from. Has to be
+// a divisor of 2^16 and hold at least a full group.
+#ifdef ESP_PLATFORM
+const int FEC_WINDOW = 32;
+#else
+const int FEC_WINDOW = 64;
+#endif
+// Incomplete group is closed with its parity after that long (in ms)
+const Time FEC_GROUP_TIMEOUT = 20;
+const Time FEC_REPORT_INTERVAL = 1000;
+// Reports based on fewer packets than that would be mostly noise
+const uint32_t FEC_REPORT_MIN_PACKETS = 20;
+
+// Number of packets protected by a single parity packet at the given loss
+// rate, 0 means no parity at all
+int fecGroupSize(double loss);
+
+// Sending side of the XOR based FEC for a single peer. Every packet gets
+// a sequence number, every group of consecutive packets gets a parity packet
+// (XOR of all of them, padded to the longest one), which lets the receiver
+// recover a single lost packet of the group without waiting for the end to end
+// retransmission. Group size follows the loss reported by the receiver.
+class FecEncoder {
+ private:
+  uint16_t nextSeq = 0;
+  int groupSize = 0;
+  double loss = 0;
+
+  // Current group
+  uint16_t groupStart = 0;
+  int groupCount = 0;
+  uint16_t lengthXor = 0;
+  Time groupStarted = 0;
+  std::string parity;
+
+  // Older reports (replayed or reordered) are ignored
+  uint32_t lastReportCounter = 0;
+
+  void writeParity(std::string& out);
+
+ public:
+  // Frames the packet into out. If it completes a group, the parity to send
+  // right after it is written to parityOut (which is cleared otherwise).
+  void encode(string_view packet, Time now, std::string& out, std::string& parityOut);
+  // Closes the group that's been open for too long. Returns whether there is
+  // parity to send (a lone packet is not worth it).
+  bool expire(Time now, std::string& parityOut);
+  // Time at which expire() has something to do, -1 if there is no open group
+  Time getDeadline() const;
+
+  void handleReport(string_view report);
+
+  int getGroupSize() const;
+  double getLoss() const;
+};
+
+// Receiving side - unwraps the data packets and recovers the ones missing
+// from a group with a single loss. Also measures the loss of the incoming
+// traffic for the reports.
+class FecDecoder {
+ public:
+  // Returns whether the packet was authenticated by the upper layer. The
+  // headers are not sealed, so only those take their slot of the window (and
+  // count as received) - a forged packet can't shadow the real one.
+  using DeliverCallback = std::function<bool(string_view packet)>;
+
+ private:
+  struct Slot {
+    bool valid = false;
+    uint16_t seq = 0;
+    std::string packet;
+  };
+
+  std::vector<Slot> window;
+  std::string recoveryBuffer;
+
+  bool started = false;
+  uint16_t highestSeq = 0;
+  uint32_t expected = 0;
+  uint32_t received = 0;
+  Time lastReport = 0;
+  uint32_t reportCounter = 0;
+
+  uint64_t recovered = 0;
+
+  Slot& getSlot(uint16_t seq);
+  void advance(uint16_t seq);
+  void handleData(string_view packet, const DeliverCallback& deliver);
+  void handleParity(string_view packet, const DeliverCallback& deliver);
+
+ public:
+  void decode(string_view packet, const DeliverCallback& deliver);
+  // Writes the loss report into out if one is due
+  bool takeReport(Time now, std::string& out);
+
+  uint64_t getRecovered() const;
+};
@@ -0,0 +1,168 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/fec_layer.h"
+
+#include <sodium.h>
+
+#include "husarnet/ports/port_interface.h"
+#include "husarnet/ports/sockets.h"
+
+#include "husarnet/fec.h"
+#include "husarnet/logging.h"
+#include "husarnet/peer.h"
+
+// Reports are authenticated with a key of their own, derived from the
+// direction's session key
+static fstring<32> deriveReportKey(const fstring<32>& key)
+{
+  static const char context[] = "husarnet fec report";
+  fstring<32> res;
+  crypto_generichash(&res[0], res.size(), (const unsigned char*)context, sizeof(context) - 1, key.data(), key.size());
+  return res;
+}
+
+FecLayer::FecLayer(PeerContainer* peerContainer, PeerFlags* myFlags, ConfigManager* configManager)
+    : peerContainer(peerContainer), myFlags(myFlags)
+{
+  this->enabled = configManager->getEnableFec();
+  if(this->enabled) {
+    this->myFlags->setFlag(PeerFlag::fec);
+  }
+}
+
+bool FecLayer::shouldProceed(Peer* peer)
+{
+  return this->enabled && peer->flags.checkFlag(PeerFlag::fec);
+}
+
+void FecLayer::sendParity(Peer* peer)
+{
+  if(!peer->connected) {
+    return;
+  }
+
+  this->parityPackets++;
+  sendToLowerLayer(peer->id, this->parityBuffer);
+}
+
+void FecLayer::sendReport(Peer* peer)
+{
+  auto key = deriveReportKey(peer->txKey);
+  size_t size = this->reportBuffer.size();
+  this->reportBuffer.resize(size + crypto_auth_BYTES);
+  crypto_auth(
+      (unsigned char*)&this->reportBuffer[size], (const unsigned char*)this->reportBuffer.data(), size, key.data());
+  sendToLowerLayer(peer->id, this->reportBuffer);
+}
+
+void FecLayer::handleReport(Peer* peer, string_view report)
+{
+  if(!peer->negotiated || report.size() != FEC_REPORT_SIZE + crypto_auth_BYTES) {
+    return;
+  }
+
+  auto key = deriveReportKey(peer->rxKey);
+  if(crypto_auth_verify(
+         (const unsigned char*)&report[FEC_REPORT_SIZE], (const unsigned char*)report.data(), FEC_REPORT_SIZE,
+         key.data()) != 0) {
+    HLOG_INFO("received forged FEC report // {peer}", peer->getIpAddressString());
+    return;
+  }
+
+  int previousGroupSize = peer->fecEncoder.getGroupSize();
+  peer->fecEncoder.handleReport(report);
+  if(peer->fecEncoder.getGroupSize() != previousGroupSize) {
+    HLOG_INFO(
+        "FEC group size changed // {peer} {loss} {group_size}", peer->getIpAddressString(), peer->fecEncoder.getLoss(),
+        peer->fecEncoder.getGroupSize());
+  }
+}
+
+void FecLayer::onUpperLayerData(HusarnetAddress peerAddress, string_view data)
+{
+  // Only the data packets and coalesced frames are protected
+  if(data.size() == 0 || (data[0] != 0 && data[0] != 8)) {
+    sendToLowerLayer(peerAddress, data);
+    return;
+  }
+
+  Peer* peer = peerContainer->getPeer(peerAddress);
+  if(peer == nullptr || !shouldProceed(peer)) {
+    sendToLowerLayer(peerAddress, data);
+    return;
+  }
+
+  peer->fecEncoder.encode(data, Port::getCurrentTime(), this->framedBuffer, this->parityBuffer);
+  sendToLowerLayer(peerAddress, this->framedBuffer);
+  if(!this->parityBuffer.empty()) {
+    sendParity(peer);
+  }
+}
+
+void FecLayer::onLowerLayerData(HusarnetAddress peerAddress, string_view data)
+{
+  if(data.size() == 0 || data[0] < FEC_DATA_PACKET_TYPE || data[0] > FEC_REPORT_PACKET_TYPE) {
+    sendToUpperLayer(peerAddress, data);
+    return;
+  }
+
+  Peer* peer = peerContainer->getPeer(peerAddress);
+  if(peer == nullptr || !shouldProceed(peer)) {
+    return;
+  }
+
+  if(data[0] == FEC_REPORT_PACKET_TYPE) {
+    handleReport(peer, data);
+    return;
+  }
+
+  // The security layer counts what it authenticates
+  uint64_t recoveredBefore = peer->fecDecoder.getRecovered();
+  peer->fecDecoder.decode(data, [&](string_view packet) {
+    uint64_t validPackets = peer->validPackets;
+    sendToUpperLayer(peerAddress, packet);
+    return peer->validPackets != validPackets;
+  });
+  this->recoveredPackets += peer->fecDecoder.getRecovered() - recoveredBefore;
+
+  if(peer->negotiated && peer->fecDecoder.takeReport(Port::getCurrentTime(), this->reportBuffer)) {
+    sendReport(peer);
+  }
+}
+
+void FecLayer::periodic()
+{
+  if(!this->enabled) {
+    return;
+  }
+
+  Time now = Port::getCurrentTime();
+  peerContainer->forEachPeer([this, now](Peer* peer) {
+    Time deadline = peer->fecEncoder.getDeadline();
+    if(deadline < 0) {
+      return;
+    }
+
+    if(deadline > now) {
+      OsSocket::limitNextTimeout(deadline - now);
+    } else if(peer->fecEncoder.expire(now, this->parityBuffer)) {
+      sendParity(peer);
+    }
+  });
+}
+
+bool FecLayer::isEnabled() const
+{
+  return this->enabled;
+}
+
+uint64_t FecLayer::getParityPackets() const
+{
+  return this->parityPackets;
+}
+
+uint64_t FecLayer::getRecoveredPackets() const
+{
+  return this->recoveredPackets;
+}
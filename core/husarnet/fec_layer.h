@@ -0,0 +1,56 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+#include "husarnet/config_manager.h"
+#include "husarnet/ipaddress.h"
+#include "husarnet/layer_interfaces.h"
+#include "husarnet/peer_container.h"
+#include "husarnet/peer_flags.h"
+#include "husarnet/string_view.h"
+
+// Forward error correction of the sealed data packets (see FecEncoder),
+// between peers that both enable it and advertise PeerFlag::fec. It works on
+// the ciphertext, so a recovered packet is authenticated by the security
+// layer like any other. Handshakes, heartbeats and control packets are passed
+// as they are. Parity is only sent on direct paths - relayed traffic goes
+// over TCP and has nothing to recover.
+// Packets take their place in the FEC window only once the security layer has
+// authenticated them. Loss reports are not sealed, but carry a counter and
+// a tag keyed with the session key.
+class FecLayer : public BidirectionalLayer {
+ private:
+  PeerContainer* peerContainer;
+  PeerFlags* myFlags;
+  bool enabled = false;
+
+  std::string framedBuffer;
+  std::string parityBuffer;
+  std::string reportBuffer;
+
+  std::atomic<uint64_t> parityPackets{0};
+  std::atomic<uint64_t> recoveredPackets{0};
+
+  bool shouldProceed(Peer* peer);
+  void sendParity(Peer* peer);
+  void sendReport(Peer* peer);
+  void handleReport(Peer* peer, string_view report);
+
+ public:
+  FecLayer(PeerContainer* peerContainer, PeerFlags* myFlags, ConfigManager* configManager);
+
+  void onUpperLayerData(HusarnetAddress peerAddress, string_view data) override;
+  void onLowerLayerData(HusarnetAddress peerAddress, string_view data) override;
+
+  // Closes the groups that waited for too long
+  void periodic();
+
+  bool isEnabled() const;
+  uint64_t getParityPackets() const;
+  uint64_t getRecoveredPackets() const;
+};
@@ -0,0 +1,359 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/header_compression.h"
+
+const char HEADER_COMPRESSION_MARKER = (char)0xFF;
+const char HEADER_COMPRESSION_IR = 0x02;
+const char HEADER_COMPRESSION_COMPRESSED = 0x03;
+
+const int UDP_HEADER_SIZE = 8;
+const int TCP_HEADER_SIZE = 20;
+const uint8_t TCP_FLAG_URG = 0x20;
+
+// Deltas that don't fit in 3 varint bytes start a new reference instead
+const uint32_t MAX_DELTA = 1 << 21;
+
+static uint16_t read16(string_view data, int offset)
+{
+  return ((uint8_t)data[offset] << 8) | (uint8_t)data[offset + 1];
+}
+
+static uint32_t read32(string_view data, int offset)
+{
+  return ((uint32_t)read16(data, offset) << 16) | read16(data, offset + 2);
+}
+
+static void append16(std::string& out, uint16_t value)
+{
+  out += (char)(value >> 8);
+  out += (char)(value & 0xFF);
+}
+
+static void append32(std::string& out, uint32_t value)
+{
+  append16(out, value >> 16);
+  append16(out, value & 0xFFFF);
+}
+
+static bool appendVarint(std::string& out, uint32_t value)
+{
+  if(value >= MAX_DELTA) {
+    return false;
+  }
+
+  while(value >= 0x80) {
+    out += (char)((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out += (char)value;
+  return true;
+}
+
+static bool readVarint(string_view data, size_t& offset, uint32_t& value)
+{
+  value = 0;
+  for(int shift = 0; shift < 21; shift += 7) {
+    if(offset >= data.size()) {
+      return false;
+    }
+
+    uint8_t byte = data[offset++];
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Checks that the segment has a complete header of the given protocol
+static bool isValidSegment(uint8_t protocol, string_view segment)
+{
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_UDP) {
+    return segment.size() >= UDP_HEADER_SIZE;
+  }
+
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_TCP) {
+    if(segment.size() < TCP_HEADER_SIZE) {
+      return false;
+    }
+
+    size_t dataOffset = ((uint8_t)segment[12] >> 4) * 4;
+    return dataOffset >= TCP_HEADER_SIZE && dataOffset <= segment.size();
+  }
+
+  return false;
+}
+
+int HeaderCompressor::findContext(uint8_t protocol, uint16_t sourcePort, uint16_t destinationPort)
+{
+  int oldest = 0;
+  for(int i = 0; i < HEADER_COMPRESSION_CONTEXTS; i++) {
+    auto& context = contexts[i];
+    if(context.valid && context.protocol == protocol && context.sourcePort == sourcePort &&
+       context.destinationPort == destinationPort) {
+      return i;
+    }
+
+    if(!context.valid) {
+      oldest = i;
+      break;
+    }
+
+    if(context.lastUsed < contexts[oldest].lastUsed) {
+      oldest = i;
+    }
+  }
+
+  // Generation is kept (and bumped by the IR) so the receiver won't apply
+  // the new flow's deltas to the previous one
+  auto& context = contexts[oldest];
+  context.valid = true;
+  context.protocol = protocol;
+  context.sourcePort = sourcePort;
+  context.destinationPort = destinationPort;
+  context.irRemaining = 0;
+  context.packetsSinceIr = HEADER_COMPRESSION_REFRESH_PACKETS;  // forces an IR
+  return oldest;
+}
+
+void HeaderCompressor::startGeneration(Context& context, string_view segment, Time now)
+{
+  context.generation = (context.generation + 1) & 0x0F;
+  context.irRemaining = HEADER_COMPRESSION_IR_REPEAT;
+  context.packetsSinceIr = 0;
+  context.lastIr = now;
+
+  if(context.protocol == HEADER_COMPRESSION_PROTOCOL_TCP) {
+    context.referenceSeq = read32(segment, 4);
+    context.referenceAck = read32(segment, 8);
+  }
+}
+
+bool HeaderCompressor::writeIr(int cid, string_view segment, std::string& out)
+{
+  auto& context = contexts[cid];
+
+  out.clear();
+  out += HEADER_COMPRESSION_MARKER;
+  out += HEADER_COMPRESSION_IR;
+  out += (char)((cid << 4) | context.generation);
+  out += (char)context.protocol;
+
+  if(context.protocol == HEADER_COMPRESSION_PROTOCOL_TCP) {
+    if(!appendVarint(out, read32(segment, 4) - context.referenceSeq) ||
+       !appendVarint(out, read32(segment, 8) - context.referenceAck)) {
+      return false;
+    }
+  }
+
+  out += segment;
+  return true;
+}
+
+bool HeaderCompressor::writeTcp(int cid, string_view segment, std::string& out)
+{
+  auto& context = contexts[cid];
+  uint8_t flags = segment[13];
+
+  out.clear();
+  out += HEADER_COMPRESSION_MARKER;
+  out += HEADER_COMPRESSION_COMPRESSED;
+  out += (char)((cid << 4) | context.generation);
+  out += segment[12];
+  out += segment[13];
+
+  if(!appendVarint(out, read32(segment, 4) - context.referenceSeq) ||
+     !appendVarint(out, read32(segment, 8) - context.referenceAck)) {
+    return false;
+  }
+
+  out += segment.substr(14, 4);  // window and checksum
+  if(flags & TCP_FLAG_URG) {
+    out += segment.substr(18, 2);
+  }
+  out += segment.substr(TCP_HEADER_SIZE);  // options and payload
+  return true;
+}
+
+bool HeaderCompressor::compress(uint8_t protocol, string_view segment, Time now, std::string& out)
+{
+  if(segment.size() > HEADER_COMPRESSION_MAX_SIZE || !isValidSegment(protocol, segment)) {
+    return false;
+  }
+
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_UDP && read16(segment, 4) != segment.size()) {
+    return false;
+  }
+
+  // Urgent pointer is implied to be zero when the flag is not set
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_TCP && ((uint8_t)segment[13] & TCP_FLAG_URG) == 0 &&
+     read16(segment, 18) != 0) {
+    return false;
+  }
+
+  int cid = findContext(protocol, read16(segment, 0), read16(segment, 2));
+  auto& context = contexts[cid];
+  context.lastUsed = now;
+  context.packetsSinceIr++;
+
+  if(context.irRemaining == 0 &&
+     (context.packetsSinceIr > HEADER_COMPRESSION_REFRESH_PACKETS ||
+      now - context.lastIr >= HEADER_COMPRESSION_REFRESH_TIMEOUT)) {
+    startGeneration(context, segment, now);
+  }
+
+  if(context.irRemaining > 0) {
+    if(!writeIr(cid, segment, out)) {
+      startGeneration(context, segment, now);
+      writeIr(cid, segment, out);
+    }
+    context.irRemaining--;
+    return true;
+  }
+
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_UDP) {
+    out.clear();
+    out += HEADER_COMPRESSION_MARKER;
+    out += HEADER_COMPRESSION_COMPRESSED;
+    out += (char)((cid << 4) | context.generation);
+    out += segment.substr(6);  // checksum and payload
+    return true;
+  }
+
+  if(!writeTcp(cid, segment, out)) {
+    startGeneration(context, segment, now);
+    writeIr(cid, segment, out);
+    context.irRemaining--;
+  }
+
+  return true;
+}
+
+bool HeaderDecompressor::isCompressed(string_view message)
+{
+  return message.size() >= 3 && message[0] == HEADER_COMPRESSION_MARKER &&
+         (message[1] == HEADER_COMPRESSION_IR || message[1] == HEADER_COMPRESSION_COMPRESSED);
+}
+
+bool HeaderDecompressor::readIr(int cid, uint8_t generation, string_view data, uint8_t& protocol, std::string& segment)
+{
+  if(data.size() < 1) {
+    return false;
+  }
+
+  protocol = data[0];
+  size_t offset = 1;
+
+  uint32_t seqDelta = 0;
+  uint32_t ackDelta = 0;
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_TCP) {
+    if(!readVarint(data, offset, seqDelta) || !readVarint(data, offset, ackDelta)) {
+      return false;
+    }
+  }
+
+  auto fullSegment = data.substr(offset);
+  if(!isValidSegment(protocol, fullSegment)) {
+    return false;
+  }
+
+  auto& context = contexts[cid];
+  context.valid = true;
+  context.generation = generation;
+  context.protocol = protocol;
+  context.sourcePort = read16(fullSegment, 0);
+  context.destinationPort = read16(fullSegment, 2);
+
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_TCP) {
+    context.referenceSeq = read32(fullSegment, 4) - seqDelta;
+    context.referenceAck = read32(fullSegment, 8) - ackDelta;
+  }
+
+  segment = fullSegment.str();
+  return true;
+}
+
+bool HeaderDecompressor::readTcp(const Context& context, string_view data, std::string& segment)
+{
+  if(data.size() < 2) {
+    return false;
+  }
+
+  size_t dataOffset = ((uint8_t)data[0] >> 4) * 4;
+  uint8_t flags = data[1];
+  size_t offset = 2;
+
+  uint32_t seqDelta;
+  uint32_t ackDelta;
+  if(dataOffset < TCP_HEADER_SIZE || !readVarint(data, offset, seqDelta) || !readVarint(data, offset, ackDelta)) {
+    return false;
+  }
+
+  size_t fixedSize = (flags & TCP_FLAG_URG) ? 6 : 4;
+  size_t optionsSize = dataOffset - TCP_HEADER_SIZE;
+  if(data.size() < offset + fixedSize + optionsSize) {
+    return false;
+  }
+
+  segment.clear();
+  segment.reserve(TCP_HEADER_SIZE + data.size());
+  append16(segment, context.sourcePort);
+  append16(segment, context.destinationPort);
+  append32(segment, context.referenceSeq + seqDelta);
+  append32(segment, context.referenceAck + ackDelta);
+  segment += data[0];
+  segment += data[1];
+  segment += data.substr(offset, 4);  // window and checksum
+  offset += 4;
+
+  if(flags & TCP_FLAG_URG) {
+    segment += data.substr(offset, 2);
+    offset += 2;
+  } else {
+    append16(segment, 0);
+  }
+
+  segment += data.substr(offset);  // options and payload
+  return true;
+}
+
+bool HeaderDecompressor::decompress(string_view message, uint8_t& protocol, std::string& segment)
+{
+  if(!isCompressed(message)) {
+    return false;
+  }
+
+  int cid = (uint8_t)message[2] >> 4;
+  uint8_t generation = message[2] & 0x0F;
+  auto data = message.substr(3);
+
+  if(message[1] == HEADER_COMPRESSION_IR) {
+    return readIr(cid, generation, data, protocol, segment);
+  }
+
+  const auto& context = contexts[cid];
+  if(!context.valid || context.generation != generation) {
+    return false;
+  }
+
+  protocol = context.protocol;
+
+  if(protocol == HEADER_COMPRESSION_PROTOCOL_UDP) {
+    if(data.size() < 2) {
+      return false;
+    }
+
+    segment.clear();
+    segment.reserve(UDP_HEADER_SIZE + data.size());
+    append16(segment, context.sourcePort);
+    append16(segment, context.destinationPort);
+    append16(segment, UDP_HEADER_SIZE + data.size() - 2);
+    segment += data;  // checksum and payload
+    return true;
+  }
+
+  return readTcp(context, data, segment);
+}
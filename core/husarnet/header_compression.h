@@ -0,0 +1,102 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <string>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/string_view.h"
+
+// Flows tracked per peer (and per direction) - it's 4 bits on the wire
+const int HEADER_COMPRESSION_CONTEXTS = 16;
+// Every new context state is announced with this many full headers in a row,
+// so a single lost packet doesn't break the flow
+const int HEADER_COMPRESSION_IR_REPEAT = 3;
+const int HEADER_COMPRESSION_REFRESH_PACKETS = 64;
+const int HEADER_COMPRESSION_REFRESH_TIMEOUT = 2000;  // in ms
+// Only the small packets are worth it, bulk transfers would mostly trigger
+// context refreshes
+const int HEADER_COMPRESSION_MAX_SIZE = 512;
+
+const uint8_t HEADER_COMPRESSION_PROTOCOL_TCP = 6;
+const uint8_t HEADER_COMPRESSION_PROTOCOL_UDP = 17;
+
+// ROHC-like (U-mode) compression of TCP and UDP headers exchanged with
+// a single peer. Addresses are already implied by the peer id, ports are
+// stored in a context identified by a 4 bit id, sequence and ack numbers are
+// sent as varint deltas from the values carried by the full header that
+// established the context state (IR packet). Deltas are never taken from the
+// previous compressed packet, so losing one doesn't corrupt the following
+// ones. Each new reference bumps the 4 bit generation of the context and
+// compressed packets referencing a generation the receiver has not seen are
+// dropped.
+// Transport checksums are carried as they are, the receiving kernel verifies
+// them against the reconstructed header.
+//
+// Wire format (after the 0xFF marker, which is an invalid IPv6 next header):
+//   0x02 <cid:4 generation:4> <protocol> [<seq delta> <ack delta>]
+//        <full transport header and payload>
+//   0x03 <cid:4 generation:4> <compressed header> <payload>
+// IR packets of TCP flows carry the deltas of their own sequence and ack
+// numbers from the reference, so any of the repeated IRs sets the same one.
+// compressed UDP header:
+//   <checksum:16>
+// compressed TCP header:
+//   <data offset:4 reserved:4> <flags> <seq delta> <ack delta> <window:16>
+//   <checksum:16> [urgent pointer:16 if URG] <options>
+class HeaderCompressor {
+ private:
+  struct Context {
+    bool valid = false;
+    uint8_t generation = 0;
+    uint8_t protocol = 0;
+    uint16_t sourcePort = 0;
+    uint16_t destinationPort = 0;
+    uint32_t referenceSeq = 0;
+    uint32_t referenceAck = 0;
+    int irRemaining = 0;
+    int packetsSinceIr = 0;
+    Time lastIr = 0;
+    Time lastUsed = 0;
+  };
+
+  Context contexts[HEADER_COMPRESSION_CONTEXTS];
+
+  int findContext(uint8_t protocol, uint16_t sourcePort, uint16_t destinationPort);
+  void startGeneration(Context& context, string_view segment, Time now);
+  bool writeIr(int cid, string_view segment, std::string& out);
+  bool writeTcp(int cid, string_view segment, std::string& out);
+
+ public:
+  // Encodes the transport segment (protocol is the IPv6 next header) into
+  // out. Returns false if the segment should be sent uncompressed.
+  bool compress(uint8_t protocol, string_view segment, Time now, std::string& out);
+};
+
+class HeaderDecompressor {
+ private:
+  struct Context {
+    bool valid = false;
+    uint8_t generation = 0;
+    uint8_t protocol = 0;
+    uint16_t sourcePort = 0;
+    uint16_t destinationPort = 0;
+    uint32_t referenceSeq = 0;
+    uint32_t referenceAck = 0;
+  };
+
+  Context contexts[HEADER_COMPRESSION_CONTEXTS];
+
+  bool readIr(int cid, uint8_t generation, string_view data, uint8_t& protocol, std::string& segment);
+  bool readTcp(const Context& context, string_view data, std::string& segment);
+
+ public:
+  static bool isCompressed(string_view message);
+
+  // Restores the transport segment. Returns false if the message has to be
+  // dropped.
+  bool decompress(string_view message, uint8_t& protocol, std::string& segment);
+};
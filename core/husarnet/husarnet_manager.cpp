@@ -9,16 +9,20 @@
 #include <response.h>
 
 #include "husarnet/ports/port.h"
+#include "husarnet/ports/sockets.h"
 
 #include "husarnet/compression_layer.h"
+#include "husarnet/epoch.h"
 #include "husarnet/dashboardapi/response.h"
 #include "husarnet/eventbus.h"
+#include "husarnet/fec_layer.h"
 #include "husarnet/husarnet_config.h"
 #include "husarnet/ipaddress.h"
 #include "husarnet/layer_interfaces.h"
 #include "husarnet/licensing.h"
 #include "husarnet/logging.h"
 #include "husarnet/multicast_layer.h"
+#include "husarnet/multipath.h"
 #include "husarnet/peer_flags.h"
 #include "husarnet/security_layer.h"
 #include "husarnet/util.h"
@@ -76,19 +80,37 @@ void HusarnetManager::runHusarnet()
   // ngsocket layers)
   this->peerContainer = new PeerContainer(this->configManager, this->myIdentity);
 
-  auto tt = Port::startTun(this->myIdentity->getIpAddress(), this->configEnv->getDaemonInterface());
+  auto tt = Port::startTun(
+      this->myIdentity->getIpAddress(), this->configEnv->getDaemonInterface(), this->configEnv->getTunMtu());
   this->tun = static_cast<Tun*>(tt);
 
-  auto multicast = new MulticastLayer(this->myIdentity->getDeviceId(), this->configManager);
-  auto compression = new CompressionLayer(this->peerContainer, this->myFlags);
-  this->securityLayer = new SecurityLayer(this->myIdentity, this->myFlags, this->peerContainer);
-  this->ngsocket = new NgSocket(this->myIdentity, this->peerContainer, this->configManager);
+  this->egressScheduler = new EgressScheduler();
+  this->multicastLayer =
+      new MulticastLayer(this->myIdentity->getDeviceId(), this->configManager, this->peerContainer, this->myFlags);
+  this->compressionLayer = new CompressionLayer(this->peerContainer, this->myFlags, this->configManager);
+  this->securityLayer = new SecurityLayer(
+      this->myIdentity, this->myFlags, this->peerContainer, this->configEnv->getTunMtu(),
+      this->configEnv->getLivenessInterval());
+  if(this->compressionLayer->getDictionaryId() != 0) {
+    this->securityLayer->setHelloExtension(
+        HelloExtension::compressionDictionary, pack(this->compressionLayer->getDictionaryId()));
+  }
+  this->fecLayer = new FecLayer(this->peerContainer, this->myFlags, this->configManager);
+  OsSocket::setUdpBufferSize(this->configEnv->getUdpBufferSize());
+  // Both the connected and the multipath sockets share the port with the main
+  // one
+  OsSocket::setUdpReusePort(
+      this->configEnv->getEnableConnectedSockets() ||
+      parseMultipathMode(this->configEnv->getMultipath()) != MultipathMode::off);
+  this->ngsocket = new NgSocket(this->myIdentity, this->peerContainer, this->configManager, this->myFlags);
   this->eventBus = new EventBus(this->myIdentity->getIpAddress(), this->configManager);
 
-  stackUpperOnLower(tun, multicast);
-  stackUpperOnLower(multicast, compression);
-  stackUpperOnLower(compression, securityLayer);
-  stackUpperOnLower(securityLayer, ngsocket);
+  stackUpperOnLower(tun, this->egressScheduler);
+  stackUpperOnLower(this->egressScheduler, this->multicastLayer);
+  stackUpperOnLower(this->multicastLayer, this->compressionLayer);
+  stackUpperOnLower(this->compressionLayer, securityLayer);
+  stackUpperOnLower(securityLayer, this->fecLayer);
+  stackUpperOnLower(this->fecLayer, ngsocket);
 
   if(this->configEnv->getEnableControlplane()) {
     Port::threadStart(
@@ -133,9 +155,18 @@ void HusarnetManager::runHusarnet()
 
   // This is an actual event loop
   while(true) {
-    ngsocket->periodic();
-
-    Port::processSocketEvents(this->tun);
+    {
+      EpochGuard guard;
+      ngsocket->periodic();
+      this->egressScheduler->periodic();
+      this->multicastLayer->periodic();
+      this->securityLayer->periodic();
+      this->fecLayer->periodic();
+
+      Port::processSocketEvents(this->tun);
+    }
+
+    Epoch::reclaim();
   }
 }
 
@@ -154,6 +185,8 @@ json HusarnetManager::getDataForStatus() const
       {STATUS_KEY_BASECONNECTION_TYPE, magic_enum::enum_name(baseConnectionType)},
       {STATUS_KEY_BASECONNECTION_ADDRESS, currentBaseAddress.ip.toString()},
       {STATUS_KEY_BASECONNECTION_PORT, currentBaseAddress.port},
+      {STATUS_KEY_BASECONNECTION_TCP_QUEUED, this->ngsocket->getBaseTcpQueuedBytes()},
+      {STATUS_KEY_BASECONNECTION_TCP_DROPPED, this->ngsocket->getBaseTcpDroppedWrites()},
   });
 
   bool isEventBusConnected = this->eventBus->isConnected();
@@ -164,18 +197,63 @@ json HusarnetManager::getDataForStatus() const
 
   // add peers from peerContainer
   result[STATUS_KEY_LIVEPEERS] = json::array();
-  auto peers = this->peerContainer->getPeers();
-  for(auto& [peerId, rawPeer] : peers) {
+  this->peerContainer->forEachPeer([this, &result](Peer* rawPeer) {
     json newPeer = {
         {"address", rawPeer->getIpAddress().toString()},
         {"is_active", rawPeer->isActive()},
         {"is_reestablishing", rawPeer->isReestablishing()},
         {"is_tunelled", rawPeer->isTunelled()},
         {"is_secure", rawPeer->isSecure()},
+        {"path_mtu", rawPeer->getPathMtu()},
+        {"candidate_paths", this->ngsocket->getPeerCandidatePaths(rawPeer)},
+        {"paths", this->ngsocket->getPeerPaths(rawPeer)},
     };
 
     result[STATUS_KEY_LIVEPEERS].push_back(newPeer);
-  }
+  });
+
+  result[STATUS_KEY_PEERSTATS] = json::object({
+      {STATUS_KEY_PEERSTATS_COUNT, this->peerContainer->size()},
+      {STATUS_KEY_PEERSTATS_CREATED, this->peerContainer->getPeersCreated()},
+      {STATUS_KEY_PEERSTATS_EVICTED, this->peerContainer->getPeersEvicted()},
+      {STATUS_KEY_PEERSTATS_SKIPPED_KEEPALIVES, this->ngsocket->getSkippedKeepalives()},
+  });
+
+  const auto& multicastLimiter = this->multicastLayer->getLimiter();
+  result[STATUS_KEY_MULTICAST] = json::object({
+      {STATUS_KEY_MULTICAST_FORWARDED, multicastLimiter.getForwarded()},
+      {STATUS_KEY_MULTICAST_RATE_LIMITED, multicastLimiter.getRateLimited()},
+      {STATUS_KEY_MULTICAST_DUPLICATES, multicastLimiter.getDuplicates()},
+  });
+
+  result[STATUS_KEY_COMPRESSION] = json::object({
+      {STATUS_KEY_COMPRESSION_ENABLED, this->compressionLayer->isEnabled()},
+      {STATUS_KEY_COMPRESSION_COMPRESSED, this->compressionLayer->getCompressedPackets()},
+      {STATUS_KEY_COMPRESSION_SKIPPED, this->compressionLayer->getSkippedPackets()},
+      {STATUS_KEY_COMPRESSION_BYTES_IN, this->compressionLayer->getBytesIn()},
+      {STATUS_KEY_COMPRESSION_BYTES_OUT, this->compressionLayer->getBytesOut()},
+  });
+
+  result[STATUS_KEY_FEC] = json::object({
+      {STATUS_KEY_FEC_ENABLED, this->fecLayer->isEnabled()},
+      {STATUS_KEY_FEC_PARITY, this->fecLayer->getParityPackets()},
+      {STATUS_KEY_FEC_RECOVERED, this->fecLayer->getRecoveredPackets()},
+  });
+
+  result[STATUS_KEY_LIVENESS] = json::object({
+      {STATUS_KEY_LIVENESS_INTERVAL, this->securityLayer->getLivenessInterval()},
+      {STATUS_KEY_LIVENESS_FAILOVERS, this->securityLayer->getPathFailovers()},
+  });
+
+  // Uplink saturation shows up here rather than as peer packet loss
+  result[STATUS_KEY_UDP] = json::object({
+      {STATUS_KEY_UDP_SEND_QUEUE, OsSocket::getUdpSendQueueDepth()},
+      {STATUS_KEY_UDP_SEND_DROPS, OsSocket::getUdpSendDrops()},
+      {STATUS_KEY_UDP_RECEIVE_DROPS, OsSocket::getUdpReceiveDrops()},
+      {STATUS_KEY_UDP_RECEIVE_BUFFER, OsSocket::getUdpReceiveBufferSize()},
+      {STATUS_KEY_UDP_SEND_BUFFER, OsSocket::getUdpSendBufferSize()},
+      {STATUS_KEY_UDP_XDP_RECEIVED, this->ngsocket->getXdpReceivedPackets()},
+  });
   return result;
 }
 
@@ -3,11 +3,15 @@
 // License: specified in project_root/LICENSE.txt
 #pragma once
 
+#include "husarnet/compression_layer.h"
 #include "husarnet/config_env.h"
 #include "husarnet/config_manager.h"
+#include "husarnet/egress_scheduler.h"
 #include "husarnet/eventbus.h"
+#include "husarnet/fec_layer.h"
 #include "husarnet/hooks_manager.h"
 #include "husarnet/identity.h"
+#include "husarnet/multicast_layer.h"
 #include "husarnet/ngsocket.h"
 #include "husarnet/peer_container.h"
 #include "husarnet/security_layer.h"
@@ -27,7 +31,11 @@ class HusarnetManager {
   PeerContainer* peerContainer = nullptr;
 
   Tun* tun = nullptr;
+  EgressScheduler* egressScheduler = nullptr;
+  MulticastLayer* multicastLayer = nullptr;
+  CompressionLayer* compressionLayer = nullptr;
   SecurityLayer* securityLayer = nullptr;
+  FecLayer* fecLayer = nullptr;
   NgSocket* ngsocket = nullptr;
 
   HusarnetManager();
@@ -5,6 +5,22 @@
 #include "husarnet/logging.h"
 #include "husarnet/util.h"
 
+void FromUpperConsumer::onUpperLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data)
+{
+  for(auto& peerId : peerAddresses) {
+    onUpperLayerData(peerId, data);
+  }
+}
+
+void FromUpperConsumer::onUpperLayerFlush()
+{
+}
+
+void BidirectionalLayer::onUpperLayerFlush()
+{
+  flushLowerLayer();
+}
+
 ForUpperProducer::ForUpperProducer()
     : fromUpperConsumer([](HusarnetAddress peerId, string_view data) {
         HLOG_DEBUG("dropping frame for upper layer // {peer}", peerId.toString());
@@ -25,22 +41,52 @@ void ForUpperProducer::sendToUpperLayer(HusarnetAddress peerId, string_view data
 ForLowerProducer::ForLowerProducer()
     : fromLowerConsumer([](HusarnetAddress peerId, string_view data) {
         HLOG_DEBUG("dropping frame for lower layer // {peer}", peerId.toString().c_str());
-      }){};
+      }),
+      fromLowerFanoutConsumer([this](const std::vector<HusarnetAddress>& peerIds, string_view data) {
+        for(auto& peerId : peerIds) {
+          fromLowerConsumer(peerId, data);
+        }
+      }),
+      fromLowerFlushConsumer([]() {}){};
 
 void ForLowerProducer::setLowerLayerConsumer(std::function<void(HusarnetAddress peerId, string_view data)> func)
 {
   fromLowerConsumer = func;
 }
 
+void ForLowerProducer::setLowerLayerFanoutConsumer(
+    std::function<void(const std::vector<HusarnetAddress>& peerIds, string_view data)> func)
+{
+  fromLowerFanoutConsumer = func;
+}
+
+void ForLowerProducer::setLowerLayerFlushConsumer(std::function<void()> func)
+{
+  fromLowerFlushConsumer = func;
+}
+
 void ForLowerProducer::sendToLowerLayer(HusarnetAddress peerId, string_view data)
 {
   fromLowerConsumer(peerId, data);
 }
 
+void ForLowerProducer::sendToLowerLayerFanout(const std::vector<HusarnetAddress>& peerIds, string_view data)
+{
+  fromLowerFanoutConsumer(peerIds, data);
+}
+
+void ForLowerProducer::flushLowerLayer()
+{
+  fromLowerFlushConsumer();
+}
+
 void stackUpperOnLower(UpperLayer* upper, LowerLayer* lower)
 {
   upper->setLowerLayerConsumer(
       std::bind(&FromUpperConsumer::onUpperLayerData, lower, std::placeholders::_1, std::placeholders::_2));
+  upper->setLowerLayerFanoutConsumer(
+      std::bind(&FromUpperConsumer::onUpperLayerFanout, lower, std::placeholders::_1, std::placeholders::_2));
+  upper->setLowerLayerFlushConsumer(std::bind(&FromUpperConsumer::onUpperLayerFlush, lower));
 
   lower->setUpperLayerConsumer(
       std::bind(&FromLowerConsumer::onLowerLayerData, upper, std::placeholders::_1, std::placeholders::_2));
@@ -3,6 +3,7 @@
 // License: specified in project_root/LICENSE.txt
 #pragma once
 #include <functional>
+#include <vector>
 
 #include "husarnet/ipaddress.h"
 #include "husarnet/string_view.h"
@@ -13,9 +14,11 @@
 // Layers are ordered like this:
 //
 // Tun (top) (think - this is your "raw data")
+// EgressScheduler
 // Multicast
 // Compression
 // Security
+// Fec
 // NgSocket (bottom) (think - layer "2", the most packed)
 //
 // FromUpperConsumer consumes data from ForUpperProducer, thus FromUpperConsumer
@@ -25,6 +28,15 @@
 class FromUpperConsumer {
  public:
   virtual void onUpperLayerData(HusarnetAddress peerAddress, string_view data) = 0;
+
+  // The same data destined to a number of peers (i.e. multicast). By default
+  // every peer is handled separately, layers that can do better override it.
+  virtual void onUpperLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data);
+
+  // Marks the end of a burst of data from the upper layer (i.e. everything
+  // that was read from the tun in one go). Layers holding data back to batch
+  // it have to send it out now.
+  virtual void onUpperLayerFlush();
 };
 
 class ForUpperProducer {
@@ -46,17 +58,28 @@ class FromLowerConsumer {
 class ForLowerProducer {
  protected:
   std::function<void(HusarnetAddress peerAddress, string_view data)> fromLowerConsumer;
+  std::function<void(const std::vector<HusarnetAddress>& peerAddresses, string_view data)> fromLowerFanoutConsumer;
+  std::function<void()> fromLowerFlushConsumer;
 
  public:
   ForLowerProducer();
 
   void setLowerLayerConsumer(std::function<void(HusarnetAddress peerAddress, string_view data)> func);
+  void setLowerLayerFanoutConsumer(
+      std::function<void(const std::vector<HusarnetAddress>& peerAddresses, string_view data)> func);
+  void setLowerLayerFlushConsumer(std::function<void()> func);
   void sendToLowerLayer(HusarnetAddress peerAddress, string_view data);
+  void sendToLowerLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data);
+  void flushLowerLayer();
 };
 
 class UpperLayer : public ForLowerProducer, public FromLowerConsumer {};
 class LowerLayer : public ForUpperProducer, public FromUpperConsumer {};
 
-class BidirectionalLayer : public UpperLayer, public LowerLayer {};
+class BidirectionalLayer : public UpperLayer, public LowerLayer {
+ public:
+  // Layers that don't hold anything back just pass it down
+  void onUpperLayerFlush() override;
+};
 
 void stackUpperOnLower(UpperLayer* upper, LowerLayer* lower);
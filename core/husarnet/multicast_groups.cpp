@@ -0,0 +1,244 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/multicast_groups.h"
+
+#include "husarnet/logging.h"
+
+const uint8_t NEXT_HEADER_HOP_BY_HOP = 0;
+const uint8_t NEXT_HEADER_ICMPV6 = 58;
+
+const uint8_t ICMPV6_MLD_QUERY = 130;
+const uint8_t ICMPV6_MLD_REPORT = 131;
+const uint8_t ICMPV6_MLD_DONE = 132;
+const uint8_t ICMPV6_MLD2_REPORT = 143;
+
+// MLDv2 multicast address record types
+const int MLD2_MODE_IS_INCLUDE = 1;
+const int MLD2_MODE_IS_EXCLUDE = 2;
+const int MLD2_CHANGE_TO_INCLUDE = 3;
+const int MLD2_CHANGE_TO_EXCLUDE = 4;
+const int MLD2_ALLOW_NEW_SOURCES = 5;
+
+bool MulticastGroups::isAlwaysFlooded(IpAddress group)
+{
+  for(int i = 2; i < 15; i++) {
+    if(group.data[i] != 0) {
+      return false;
+    }
+  }
+
+  uint8_t last = group.data[15];
+  bool linkScope = (group.data[1] & 0x0f) == 2;
+
+  // all nodes in any scope, all routers and MLDv2 capable routers on link
+  return last == 0x01 || (linkScope && (last == 0x02 || last == 0x16));
+}
+
+void MulticastGroups::join(HusarnetAddress listener, IpAddress group, Time now)
+{
+  if(!group.isMulticast()) {
+    return;
+  }
+
+  auto& members = groups[group];
+  if(members.find(listener) == members.end()) {
+    HLOG_DEBUG("multicast group joined // {peer} {group}", listener.toString(), group.toString());
+    membershipGeneration++;
+  }
+  members[listener] = now;
+}
+
+void MulticastGroups::leave(HusarnetAddress listener, IpAddress group)
+{
+  auto it = groups.find(group);
+  if(it == groups.end()) {
+    return;
+  }
+
+  if(it->second.erase(listener) > 0) {
+    HLOG_DEBUG("multicast group left // {peer} {group}", listener.toString(), group.toString());
+    membershipGeneration++;
+  }
+
+  if(it->second.empty()) {
+    groups.erase(it);
+  }
+}
+
+void MulticastGroups::processRecord(
+    HusarnetAddress listener,
+    int recordType,
+    int sourceCount,
+    IpAddress group,
+    Time now)
+{
+  // Source filters are not tracked - anyone who wants any source of the group
+  // gets all of it
+  switch(recordType) {
+    case MLD2_MODE_IS_INCLUDE:
+    case MLD2_CHANGE_TO_INCLUDE:
+      if(sourceCount == 0) {
+        leave(listener, group);
+      } else {
+        join(listener, group, now);
+      }
+      break;
+    case MLD2_MODE_IS_EXCLUDE:
+    case MLD2_CHANGE_TO_EXCLUDE:
+      join(listener, group, now);
+      break;
+    case MLD2_ALLOW_NEW_SOURCES:
+      if(sourceCount > 0) {
+        join(listener, group, now);
+      }
+      break;
+    default:
+      // BLOCK_OLD_SOURCES never ends the membership on its own
+      break;
+  }
+}
+
+bool MulticastGroups::processPacket(HusarnetAddress listener, uint8_t nextHeader, string_view payload)
+{
+  // MLD messages always carry the router alert option
+  if(nextHeader != NEXT_HEADER_HOP_BY_HOP || payload.size() < 8) {
+    return false;
+  }
+
+  nextHeader = payload[0];
+  size_t extensionSize = ((uint8_t)payload[1] + 1) * 8;
+  if(nextHeader != NEXT_HEADER_ICMPV6 || payload.size() < extensionSize + 4) {
+    return false;
+  }
+
+  string_view icmp = payload.substr(extensionSize);
+  uint8_t type = icmp[0];
+  if(type != ICMPV6_MLD_QUERY && type != ICMPV6_MLD_REPORT && type != ICMPV6_MLD_DONE && type != ICMPV6_MLD2_REPORT) {
+    return false;
+  }
+
+  Time now = Port::getCurrentTime();
+  std::scoped_lock lock(this->mutex);
+
+  if(type == ICMPV6_MLD_QUERY) {
+    return true;
+  }
+
+  if(type == ICMPV6_MLD_REPORT || type == ICMPV6_MLD_DONE) {
+    if(icmp.size() < 24) {
+      return true;
+    }
+
+    auto group = IpAddress::fromBinary(&icmp[8]);
+    if(type == ICMPV6_MLD_REPORT) {
+      join(listener, group, now);
+    } else {
+      leave(listener, group);
+    }
+    listeners[listener] = now;
+    return true;
+  }
+
+  if(icmp.size() < 8) {
+    return true;
+  }
+
+  int recordCount = ((uint8_t)icmp[6] << 8) | (uint8_t)icmp[7];
+  size_t offset = 8;
+  for(int i = 0; i < recordCount; i++) {
+    if(icmp.size() < offset + 20) {
+      break;
+    }
+
+    int recordType = (uint8_t)icmp[offset];
+    int auxDataLength = (uint8_t)icmp[offset + 1];
+    int sourceCount = ((uint8_t)icmp[offset + 2] << 8) | (uint8_t)icmp[offset + 3];
+    auto group = IpAddress::fromBinary(&icmp[offset + 4]);
+
+    processRecord(listener, recordType, sourceCount, group, now);
+    offset += 20 + sourceCount * 16 + auxDataLength * 4;
+  }
+
+  listeners[listener] = now;
+  return true;
+}
+
+MulticastDestinations MulticastGroups::getDestinations(IpAddress group, const AllowedPeers* allowedPeers)
+{
+  Time now = Port::getCurrentTime();
+  std::scoped_lock lock(this->mutex);
+
+  auto cached = cache.find(group);
+  if(cached != cache.end() && cached->second.allowedPeersGeneration == allowedPeers->generation &&
+     cached->second.membershipGeneration == membershipGeneration &&
+     now - cached->second.built < MLD_DESTINATIONS_CACHE_TIMEOUT) {
+    return cached->second.destinations;
+  }
+
+  bool flood = isAlwaysFlooded(group);
+  auto members = groups.find(group);
+
+  auto destinations = std::make_shared<std::vector<HusarnetAddress>>();
+  for(auto& peer : allowedPeers->multicastDestinations) {
+    auto listener = listeners.find(peer);
+    bool reporting = listener != listeners.end() && now - listener->second < MLD_MEMBERSHIP_TIMEOUT;
+    if(flood || !reporting) {
+      destinations->push_back(peer);
+      continue;
+    }
+
+    if(members == groups.end()) {
+      continue;
+    }
+
+    auto member = members->second.find(peer);
+    if(member != members->second.end() && now - member->second < MLD_MEMBERSHIP_TIMEOUT) {
+      destinations->push_back(peer);
+    }
+  }
+
+  cache[group] = CachedDestinations{
+      .destinations = destinations,
+      .allowedPeersGeneration = allowedPeers->generation,
+      .membershipGeneration = membershipGeneration,
+      .built = now,
+  };
+
+  return destinations;
+}
+
+void MulticastGroups::expire()
+{
+  Time now = Port::getCurrentTime();
+  std::scoped_lock lock(this->mutex);
+
+  for(auto group = groups.begin(); group != groups.end();) {
+    auto& members = group->second;
+    for(auto member = members.begin(); member != members.end();) {
+      if(now - member->second >= MLD_MEMBERSHIP_TIMEOUT) {
+        member = members.erase(member);
+        membershipGeneration++;
+      } else {
+        member++;
+      }
+    }
+
+    if(members.empty()) {
+      group = groups.erase(group);
+    } else {
+      group++;
+    }
+  }
+
+  for(auto listener = listeners.begin(); listener != listeners.end();) {
+    if(now - listener->second >= MLD_MEMBERSHIP_TIMEOUT) {
+      listener = listeners.erase(listener);
+    } else {
+      listener++;
+    }
+  }
+
+  // Also keeps groups nobody sends to anymore from piling up
+  cache.clear();
+}
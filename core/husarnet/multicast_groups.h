@@ -0,0 +1,67 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/config_manager.h"
+#include "husarnet/ipaddress.h"
+#include "husarnet/string_view.h"
+
+const int MLD_QUERY_INTERVAL = 60 * 1000;
+// Multicast Address Listening Interval from RFC 3810 with robustness of 2
+const int MLD_MEMBERSHIP_TIMEOUT = 2 * MLD_QUERY_INTERVAL + 10 * 1000;
+const int MLD_DESTINATIONS_CACHE_TIMEOUT = 1000;
+
+using MulticastDestinations = std::shared_ptr<const std::vector<HusarnetAddress>>;
+
+// MLD snooping for the overlay. Every daemon periodically queries its own
+// tun, the kernel answers with MLD reports which are flooded to all peers
+// like the rest of link scoped control traffic. Those reports (both the local
+// and the received ones) are tracked here so data can be sent only to the
+// peers that have actually joined the group.
+// Peers that haven't reported anything lately (i.e. older daemons that do not
+// query their kernels) still get every multicast packet.
+class MulticastGroups {
+ private:
+  struct CachedDestinations {
+    MulticastDestinations destinations;
+    uint64_t allowedPeersGeneration;
+    uint64_t membershipGeneration;
+    Time built;
+  };
+
+  std::mutex mutex;
+  uint64_t membershipGeneration = 0;
+
+  // group -> listener -> time of the last report
+  std::unordered_map<IpAddress, std::unordered_map<HusarnetAddress, Time, iphash>, iphash> groups;
+  // listener -> time of the last report of any kind
+  std::unordered_map<HusarnetAddress, Time, iphash> listeners;
+  std::unordered_map<IpAddress, CachedDestinations, iphash> cache;
+
+  void join(HusarnetAddress listener, IpAddress group, Time now);
+  void leave(HusarnetAddress listener, IpAddress group);
+  void processRecord(HusarnetAddress listener, int recordType, int sourceCount, IpAddress group, Time now);
+
+ public:
+  // Inspects a packet destined to a multicast address. Returns true if it was
+  // an MLD message - those have to reach everyone.
+  bool processPacket(HusarnetAddress listener, uint8_t nextHeader, string_view payload);
+
+  // Peers (out of the allowed ones) that should receive traffic sent to the
+  // given group
+  MulticastDestinations getDestinations(IpAddress group, const AllowedPeers* allowedPeers);
+
+  // Drops memberships that were not refreshed in time
+  void expire();
+
+  static bool isAlwaysFlooded(IpAddress group);
+};
@@ -3,19 +3,84 @@
 // License: specified in project_root/LICENSE.txt
 #include "husarnet/multicast_layer.h"
 
+#include <algorithm>
 #include <array>
 #include <string>
 
 #include <stdint.h>
 
+#include "husarnet/checksum.h"
+#include "husarnet/epoch.h"
 #include "husarnet/fstring.h"
 #include "husarnet/identity.h"
 #include "husarnet/logging.h"
+#include "husarnet/peer.h"
 #include "husarnet/util.h"
 
-MulticastLayer::MulticastLayer(HusarnetAddress myDeviceId, ConfigManager* configmanager)
-    : myDeviceId(myDeviceId), configManager(configmanager)
+MulticastLayer::MulticastLayer(
+    HusarnetAddress myDeviceId,
+    ConfigManager* configmanager,
+    PeerContainer* peerContainer,
+    PeerFlags* myFlags)
+    : myDeviceId(myDeviceId),
+      configManager(configmanager),
+      peerContainer(peerContainer),
+      myFlags(myFlags),
+      limiter(configmanager->getMulticastRateLimits())
 {
+  this->myFlags->setFlag(PeerFlag::headerCompression);
+}
+
+const MulticastLimiter& MulticastLayer::getLimiter() const
+{
+  return this->limiter;
+}
+
+void MulticastLayer::periodic()
+{
+  if(Port::getCurrentTime() - this->lastQuery < MLD_QUERY_INTERVAL) {
+    return;
+  }
+
+  this->lastQuery = Port::getCurrentTime();
+  this->groups.expire();
+  this->sendQueryToUpperLayer();
+}
+
+// MLDv2 general query, so the OS reports all groups joined on the tun
+void MulticastLayer::sendQueryToUpperLayer()
+{
+  // link local source is required for the query to be accepted
+  const auto source = IpAddress::parse("fe80::4875:7361:726e:6574");
+  const auto destination = IpAddress::parse("ff02::1");
+
+  const int maxResponseDelay = 10 * 1000;  // in ms
+
+  std::string icmp(28, 0);
+  icmp[0] = (char)130;  // multicast listener query
+  icmp[4] = (char)(maxResponseDelay >> 8);
+  icmp[5] = (char)(maxResponseDelay & 0xFF);
+  icmp[24] = 2;  // robustness
+  icmp[25] = (char)(MLD_QUERY_INTERVAL / 1000);
+
+  uint16_t checksum = ipv6PayloadChecksum(source.toBinaryString(), destination.toBinaryString(), 58, icmp);
+  icmp[2] = (char)(checksum >> 8);
+  icmp[3] = (char)(checksum & 0xFF);
+
+  // hop-by-hop header with router alert and padding
+  const char hopByHop[8] = {58, 0, 5, 2, 0, 0, 1, 0};
+
+  std::string packet(8, 0);
+  packet[0] = 6 << 4;
+  packet[5] = (char)(sizeof(hopByHop) + icmp.size());
+  packet[6] = 0;  // hop-by-hop options
+  packet[7] = 1;  // hop limit
+  packet += source.data;
+  packet += destination.data;
+  packet += std::string(hopByHop, sizeof(hopByHop));
+  packet += icmp;
+
+  sendToUpperLayer(IpAddress(), packet);
 }
 
 void MulticastLayer::onLowerLayerData(HusarnetAddress source, string_view data)
@@ -52,24 +117,207 @@ void MulticastLayer::onLowerLayerData(HusarnetAddress source, string_view data)
 
     HLOG_INFO("received multicast packet // {source}", source.toString());
 
+    this->groups.processPacket(source, protocol, data.substr(19));
+
     sendToUpperLayer(IpAddress(), packet);
+  } else if(HeaderDecompressor::isCompressed(data)) {
+    onCompressedLowerLayerData(source, data);
   } else {
-    // unicast
-    int payloadSize = (int)data.size() - 1;
+    sendUnicastToUpperLayer(source, protocol, data.substr(1));
+  }
+}
 
-    packet.reserve(payloadSize + 40);
-    packet.resize(8);
-    packet[0] = 6 << 4;
-    packet[4] = (char)(payloadSize >> 8);
-    packet[5] = (char)(payloadSize & 0xFF);
-    packet[6] = protocol;
-    packet[7] = 3;          // hop limit
-    packet += source.data;  // TODO : ympek : check if binary data is appended correctly
-    packet += this->myDeviceId.data;
-    packet += data.substr(1);
+const uint8_t TCP_PROTOCOL = 6;
+const uint8_t TCP_FLAG_SYN = 0x02;
+const uint8_t TCP_OPTION_END = 0;
+const uint8_t TCP_OPTION_NOP = 1;
+const uint8_t TCP_OPTION_MSS = 2;
+
+// Only the MSS option of the segment is modified (in place) and the checksum
+// adjusted accordingly, so the segment doesn't need to be copied
+static void rewriteTcpMss(string_view segment, uint16_t maxMss)
+{
+  if(segment.size() < 20) {
+    return;
+  }
+
+  size_t dataOffset = ((uint8_t)segment[12] >> 4) * 4;
+  if(dataOffset < 20 || dataOffset > segment.size()) {
+    return;
+  }
+
+  auto bytes = (uint8_t*)segment.data();
+  size_t offset = 20;
+  while(offset < dataOffset) {
+    uint8_t kind = bytes[offset];
+    if(kind == TCP_OPTION_END) {
+      return;
+    }
+    if(kind == TCP_OPTION_NOP) {
+      offset++;
+      continue;
+    }
+
+    if(offset + 1 >= dataOffset || bytes[offset + 1] < 2 || offset + bytes[offset + 1] > dataOffset) {
+      return;
+    }
+
+    if(kind == TCP_OPTION_MSS && bytes[offset + 1] == 4) {
+      uint16_t mss = (bytes[offset + 2] << 8) | bytes[offset + 3];
+      if(mss <= maxMss) {
+        return;
+      }
+
+      uint16_t checksum = (bytes[16] << 8) | bytes[17];
+      checksum = checksumAdjust(checksum, mss, maxMss);
+
+      bytes[offset + 2] = maxMss >> 8;
+      bytes[offset + 3] = maxMss & 0xFF;
+      bytes[16] = checksum >> 8;
+      bytes[17] = checksum & 0xFF;
+      return;
+    }
+
+    offset += bytes[offset + 1];
+  }
+}
+
+int MulticastLayer::getMssClampMtu(HusarnetAddress peerAddress)
+{
+  EpochGuard guard;
+  auto peer = this->peerContainer->getPeer(peerAddress);
+  if(peer == nullptr) {
+    return 0;
+  }
+
+  if(peer->getPathMtu() > 0) {
+    return peer->getPathMtu();
+  }
+
+  if(peer->isTunelled()) {
+    return MSS_CLAMP_RELAYED_MTU;
+  }
 
-    sendToUpperLayer(source, packet);
+  return 0;
+}
+
+// Applied to SYN and SYN-ACK segments in both directions, so neither end
+// sends segments that don't fit the current path
+void MulticastLayer::clampTcpMss(HusarnetAddress peerAddress, uint8_t protocol, string_view segment)
+{
+  if(protocol != TCP_PROTOCOL || segment.size() < 20 || ((uint8_t)segment[13] & TCP_FLAG_SYN) == 0) {
+    return;
+  }
+
+  int mtu = getMssClampMtu(peerAddress);
+  if(mtu == 0) {
+    return;
+  }
+
+  rewriteTcpMss(segment, mtu - 40 - 20);  // IPv6 and TCP headers
+}
+
+void MulticastLayer::sendUnicastToUpperLayer(HusarnetAddress source, uint8_t protocol, string_view payload)
+{
+  std::string packet;
+  int payloadSize = (int)payload.size();
+
+  packet.reserve(payloadSize + 40);
+  packet.resize(8);
+  packet[0] = 6 << 4;
+  packet[4] = (char)(payloadSize >> 8);
+  packet[5] = (char)(payloadSize & 0xFF);
+  packet[6] = protocol;
+  packet[7] = 3;          // hop limit
+  packet += source.data;  // TODO : ympek : check if binary data is appended correctly
+  packet += this->myDeviceId.data;
+  packet += payload;
+
+  clampTcpMss(source, protocol, string_view(packet).substr(40));
+
+  sendToUpperLayer(source, packet);
+}
+
+void MulticastLayer::onCompressedLowerLayerData(HusarnetAddress source, string_view data)
+{
+  EpochGuard guard;
+  auto peer = this->peerContainer->getPeer(source);
+  if(peer == nullptr) {
+    return;
+  }
+
+  uint8_t protocol;
+  if(!peer->headerDecompressor.decompress(data, protocol, this->headerDecompressionBuffer)) {
+    HLOG_DEBUG("dropping packet with unknown header compression context // {peer}", source.toString());
+    return;
+  }
+
+  sendUnicastToUpperLayer(source, protocol, this->headerDecompressionBuffer);
+}
+
+bool MulticastLayer::sendCompressedToLowerLayer(HusarnetAddress target, uint8_t protocol, string_view segment)
+{
+  if(!this->myFlags->checkFlag(PeerFlag::headerCompression)) {
+    return false;
+  }
+
+  EpochGuard guard;
+  auto peer = this->peerContainer->getPeer(target);
+  if(peer == nullptr || !peer->flags.checkFlag(PeerFlag::headerCompression)) {
+    return false;
+  }
+
+  if(!peer->headerCompressor.compress(protocol, segment, Port::getCurrentTime(), this->headerCompressionBuffer)) {
+    return false;
   }
+
+  sendToLowerLayer(target, this->headerCompressionBuffer);
+  return true;
+}
+
+int MulticastLayer::getPathMtu(HusarnetAddress target)
+{
+  EpochGuard guard;
+  auto peer = this->peerContainer->getPeer(target);
+  if(peer == nullptr) {
+    return 0;
+  }
+
+  return peer->getPathMtu();
+}
+
+// ICMPv6 Packet Too Big, as if sent by the peer, so the OS lowers its path
+// MTU for this destination and TCP adjusts its segment size
+void MulticastLayer::sendPacketTooBigToUpperLayer(string_view packet, int mtu)
+{
+  const int maxSize = 1280;  // a PTB must fit in the IPv6 minimum MTU
+
+  auto source = packet.substr(24, 16);
+  auto destination = packet.substr(8, 16);
+
+  std::string icmp(8, 0);
+  icmp[0] = 2;  // packet too big
+  icmp[4] = (char)(mtu >> 24);
+  icmp[5] = (char)((mtu >> 16) & 0xFF);
+  icmp[6] = (char)((mtu >> 8) & 0xFF);
+  icmp[7] = (char)(mtu & 0xFF);
+  icmp += packet.substr(0, std::min<size_t>(packet.size(), maxSize - 40 - 8));
+
+  uint16_t checksum = ipv6PayloadChecksum(source, destination, 58, icmp);
+  icmp[2] = (char)(checksum >> 8);
+  icmp[3] = (char)(checksum & 0xFF);
+
+  std::string response(8, 0);
+  response[0] = 6 << 4;
+  response[4] = (char)(icmp.size() >> 8);
+  response[5] = (char)(icmp.size() & 0xFF);
+  response[6] = 58;  // ICMPv6
+  response[7] = 64;  // hop limit
+  response += source;
+  response += destination;
+  response += icmp;
+
+  sendToUpperLayer(IpAddress(), response);
 }
 
 void MulticastLayer::onUpperLayerData(HusarnetAddress target, string_view packet)
@@ -95,13 +343,25 @@ void MulticastLayer::onUpperLayerData(HusarnetAddress target, string_view packet
     msgData += dstAddress;
     msgData += packet.substr(40);
 
-    auto dst = this->configManager->getMulticastDestinations(dstAddress);
-    for(auto dest : dst) {
-      sendToLowerLayer(dest, msgData);
+    EpochGuard guard;
+    auto allowedPeers = this->configManager->getAllowedPeers();
+
+    // Our own reports are what lets the peers narrow their fan-out down,
+    // so they're never filtered
+    if(this->groups.processPacket(this->myDeviceId, protocol, packet.substr(40))) {
+      sendToLowerLayerFanout(allowedPeers->multicastDestinations, msgData);
+      return;
+    }
+
+    if(!this->limiter.allow(dstAddress, packet.substr(40))) {
+      return;
     }
 
-    if(dst.size() > 0) {
-      HLOG_INFO("send multicast to multiple destinations // {num_destinations}", (int)dst.size());
+    auto dst = this->groups.getDestinations(dstAddress, allowedPeers);
+    sendToLowerLayerFanout(*dst, msgData);
+
+    if(dst->size() > 0) {
+      HLOG_INFO("send multicast to multiple destinations // {num_destinations}", (int)dst->size());
     }
   }
 
@@ -111,6 +371,18 @@ void MulticastLayer::onUpperLayerData(HusarnetAddress target, string_view packet
     if(srcAddress != this->myDeviceId)
       return;
 
+    int pathMtu = getPathMtu(dstAddress);
+    if(pathMtu > 0 && (int)packet.size() > pathMtu) {
+      sendPacketTooBigToUpperLayer(packet, pathMtu);
+      return;
+    }
+
+    // we assume we can modify `packet`, as below
+    clampTcpMss(dstAddress, protocol, packet.substr(40));
+
+    if(sendCompressedToLowerLayer(dstAddress, protocol, packet.substr(40)))
+      return;
+
     string_view msgData = packet.substr(39);
     *(char*)(&msgData[0]) = (char)protocol;  // a bit hacky, but we assume we can modify `packet`
     sendToLowerLayer(dstAddress, msgData);
@@ -2,18 +2,56 @@
 // Authors: listed in project_root/README.md
 // License: specified in project_root/LICENSE.txt
 #pragma once
+#include "husarnet/ports/port_interface.h"
+
 #include "husarnet/config_manager.h"
 #include "husarnet/ipaddress.h"
 #include "husarnet/layer_interfaces.h"
+#include "husarnet/multicast_groups.h"
+#include "husarnet/multicast_limiter.h"
+#include "husarnet/peer_container.h"
+#include "husarnet/peer_flags.h"
 #include "husarnet/string_view.h"
 
+// TCP connections set up while the peer is relayed get their MSS clamped as if
+// the path had the IPv6 minimum MTU, as the relay overhead varies
+const int MSS_CLAMP_RELAYED_MTU = 1280;
+
 class MulticastLayer : public BidirectionalLayer {
  private:
   HusarnetAddress myDeviceId;
   ConfigManager* configManager;
+  PeerContainer* peerContainer;
+  PeerFlags* myFlags;
+
+  MulticastGroups groups;
+  MulticastLimiter limiter;
+  Time lastQuery = 0;
+
+  std::string headerCompressionBuffer;
+  std::string headerDecompressionBuffer;
+
+  void sendQueryToUpperLayer();
+  void sendUnicastToUpperLayer(HusarnetAddress source, uint8_t protocol, string_view payload);
+  bool sendCompressedToLowerLayer(HusarnetAddress target, uint8_t protocol, string_view segment);
+  void onCompressedLowerLayerData(HusarnetAddress source, string_view data);
+  // 0 if the path to the peer is not known to be smaller than the tun MTU
+  int getPathMtu(HusarnetAddress target);
+  void sendPacketTooBigToUpperLayer(string_view packet, int mtu);
+  // 0 if TCP segments exchanged with the peer don't need their MSS clamped
+  int getMssClampMtu(HusarnetAddress peerAddress);
+  void clampTcpMss(HusarnetAddress peerAddress, uint8_t protocol, string_view segment);
 
  public:
-  MulticastLayer(HusarnetAddress myDeviceId, ConfigManager* configmanager);
+  MulticastLayer(
+      HusarnetAddress myDeviceId,
+      ConfigManager* configmanager,
+      PeerContainer* peerContainer,
+      PeerFlags* myFlags);
+
+  void periodic();
+
+  const MulticastLimiter& getLimiter() const;
 
   void onUpperLayerData(HusarnetAddress source, string_view data) override;
   void onLowerLayerData(HusarnetAddress target, string_view packet) override;
@@ -0,0 +1,168 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/multicast_limiter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string_view>
+
+#include "husarnet/logging.h"
+#include "husarnet/util.h"
+
+static std::optional<MulticastLimit> parseLimit(const std::string& value)
+{
+  auto parts = split(value, '/', 2);
+  if(parts.size() < 2) {
+    return std::nullopt;
+  }
+
+  MulticastLimit limit;
+  limit.rate = strtod(parts[0].c_str(), nullptr);
+  limit.burst = strtod(parts[1].c_str(), nullptr);
+  if(parts.size() > 2) {
+    limit.dedupWindow = atoi(parts[2].c_str());
+  }
+
+  if(limit.rate <= 0 || limit.burst < 1 || limit.dedupWindow < 0) {
+    return std::nullopt;
+  }
+
+  return limit;
+}
+
+MulticastLimiter::MulticastLimiter(const std::string& spec)
+{
+  for(auto& entry : split(spec, ',', 1024)) {
+    entry = trim(entry);
+    if(entry.empty()) {
+      continue;
+    }
+
+    auto keyValue = split(entry, '=', 1);
+    if(keyValue.size() != 2) {
+      HLOG_WARNING("invalid multicast rate limit entry // {entry}", entry);
+      continue;
+    }
+
+    auto group = trim(keyValue[0]);
+    auto limit = parseLimit(trim(keyValue[1]));
+    if(!limit) {
+      HLOG_WARNING("invalid multicast rate limit entry // {entry}", entry);
+      continue;
+    }
+
+    if(group == "*") {
+      this->defaultLimit = limit;
+      continue;
+    }
+
+    auto address = IpAddress::parse(group);
+    if(!address.isMulticast()) {
+      HLOG_WARNING("multicast rate limit set for a non-multicast group // {group}", group);
+      continue;
+    }
+
+    this->limits[address] = *limit;
+  }
+}
+
+bool MulticastLimiter::isEnabled() const
+{
+  return this->defaultLimit.has_value() || !this->limits.empty();
+}
+
+static size_t hashPayload(string_view payload)
+{
+  return std::hash<std::string_view>{}(std::string_view(payload.data(), payload.size()));
+}
+
+bool MulticastLimiter::isDuplicate(GroupState& state, const MulticastLimit& limit, string_view payload, Time now)
+{
+  if(limit.dedupWindow == 0) {
+    return false;
+  }
+
+  auto it = state.recentPayloads.find(hashPayload(payload));
+  return it != state.recentPayloads.end() && now - it->second < limit.dedupWindow;
+}
+
+// Only the payloads that were actually forwarded count - a retransmission of
+// a rate limited one is the sender's way of getting through
+void MulticastLimiter::rememberPayload(GroupState& state, const MulticastLimit& limit, string_view payload, Time now)
+{
+  if(limit.dedupWindow == 0) {
+    return;
+  }
+
+  if(state.recentPayloads.size() >= MULTICAST_DEDUP_ENTRIES_LIMIT) {
+    std::erase_if(state.recentPayloads, [&](const auto& item) { return now - item.second >= limit.dedupWindow; });
+  }
+
+  // Still full of fresh entries - the window is way too long for the traffic,
+  // start over rather than grow
+  if(state.recentPayloads.size() >= MULTICAST_DEDUP_ENTRIES_LIMIT) {
+    state.recentPayloads.clear();
+  }
+
+  state.recentPayloads[hashPayload(payload)] = now;
+}
+
+bool MulticastLimiter::allow(IpAddress group, string_view payload)
+{
+  return allow(group, payload, Port::getCurrentTime());
+}
+
+bool MulticastLimiter::allow(IpAddress group, string_view payload, Time now)
+{
+  const MulticastLimit* limit = nullptr;
+  auto configured = this->limits.find(group);
+  if(configured != this->limits.end()) {
+    limit = &configured->second;
+  } else if(this->defaultLimit) {
+    limit = &*this->defaultLimit;
+  }
+
+  if(limit == nullptr) {
+    this->forwarded++;
+    return true;
+  }
+
+  std::scoped_lock lock(this->mutex);
+
+  auto [it, inserted] = this->groups.try_emplace(group, GroupState{.tokens = limit->burst, .lastRefill = now});
+  auto& state = it->second;
+
+  if(isDuplicate(state, *limit, payload, now)) {
+    this->duplicates++;
+    return false;
+  }
+
+  state.tokens = std::min(limit->burst, state.tokens + (now - state.lastRefill) * limit->rate / 1000.0);
+  state.lastRefill = now;
+
+  if(state.tokens < 1) {
+    this->rateLimited++;
+    return false;
+  }
+
+  state.tokens -= 1;
+  rememberPayload(state, *limit, payload, now);
+  this->forwarded++;
+  return true;
+}
+
+uint64_t MulticastLimiter::getForwarded() const
+{
+  return this->forwarded;
+}
+
+uint64_t MulticastLimiter::getRateLimited() const
+{
+  return this->rateLimited;
+}
+
+uint64_t MulticastLimiter::getDuplicates() const
+{
+  return this->duplicates;
+}
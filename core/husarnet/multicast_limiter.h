@@ -0,0 +1,62 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/ipaddress.h"
+#include "husarnet/string_view.h"
+
+const int MULTICAST_DEDUP_ENTRIES_LIMIT = 256;
+
+struct MulticastLimit {
+  double rate;   // packets per second
+  double burst;  // bucket size
+  int dedupWindow = 0;  // in ms, 0 disables duplicate suppression
+};
+
+// Outgoing multicast throttling. Each group gets a token bucket and an
+// optional window in which packets with a payload identical to an already
+// sent one are dropped (discovery protocols tend to repeat themselves).
+class MulticastLimiter {
+ private:
+  struct GroupState {
+    double tokens;
+    Time lastRefill;
+    std::unordered_map<size_t, Time> recentPayloads;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<IpAddress, MulticastLimit, iphash> limits;
+  std::optional<MulticastLimit> defaultLimit;
+  std::unordered_map<IpAddress, GroupState, iphash> groups;
+
+  std::atomic<uint64_t> forwarded{0};
+  std::atomic<uint64_t> rateLimited{0};
+  std::atomic<uint64_t> duplicates{0};
+
+  bool isDuplicate(GroupState& state, const MulticastLimit& limit, string_view payload, Time now);
+  void rememberPayload(GroupState& state, const MulticastLimit& limit, string_view payload, Time now);
+
+ public:
+  // See ConfigEnv::getMulticastRateLimits for the format
+  explicit MulticastLimiter(const std::string& spec);
+
+  bool isEnabled() const;
+
+  // Returns false if the packet should be dropped
+  bool allow(IpAddress group, string_view payload);
+  bool allow(IpAddress group, string_view payload, Time now);
+
+  uint64_t getForwarded() const;
+  uint64_t getRateLimited() const;
+  uint64_t getDuplicates() const;
+};
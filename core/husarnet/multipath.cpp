@@ -0,0 +1,287 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/multipath.h"
+
+#include <algorithm>
+
+// Weight of a new sample in the EWMAs (as in the TCP RTT estimator)
+const double MULTIPATH_EWMA_GAIN = 0.125;
+// How much a lost probe inflates the cost of the path
+const double MULTIPATH_LOSS_PENALTY = 10;
+
+MultipathMode parseMultipathMode(const std::string& value)
+{
+  if(value == "balance") {
+    return MultipathMode::balance;
+  }
+  if(value == "redundant") {
+    return MultipathMode::redundant;
+  }
+  return MultipathMode::off;
+}
+
+bool MultipathPath::isUsable(Time now) const
+{
+  return this->fd != -1 && this->lastReply != 0 && now - this->lastReply < MULTIPATH_PATH_TIMEOUT;
+}
+
+double MultipathPath::getCost() const
+{
+  return std::max(this->srtt, 1.0) * (1 + MULTIPATH_LOSS_PENALTY * this->loss);
+}
+
+void MultipathPath::probeSentAt(Time now, const std::string& cookie)
+{
+  // The previous probe had its chance
+  if(this->probeSent != 0 && this->lastReply != 0) {
+    double sample = this->probeAnswered ? 0 : 1;
+    this->loss += MULTIPATH_EWMA_GAIN * (sample - this->loss);
+  }
+
+  this->probeCookie = cookie;
+  this->probeSent = now;
+  this->probeAnswered = false;
+}
+
+void MultipathPath::replyReceivedAt(Time now)
+{
+  if(this->probeAnswered) {
+    return;  // the probe was sent twice
+  }
+
+  double sample = now - this->probeSent;
+  if(this->lastReply == 0) {
+    this->srtt = sample;
+  } else {
+    this->srtt += MULTIPATH_EWMA_GAIN * (sample - this->srtt);
+  }
+
+  this->probeAnswered = true;
+  this->lastReply = now;
+}
+
+void pickMultipathPaths(std::vector<MultipathPath>& paths, MultipathMode mode, Time now, std::vector<int>& out)
+{
+  out.clear();
+
+  int best = -1;
+  int second = -1;
+  for(int i = 0; i < (int)paths.size(); i++) {
+    if(!paths[i].isUsable(now)) {
+      continue;
+    }
+
+    if(best == -1 || paths[i].getCost() < paths[best].getCost()) {
+      second = best;
+      best = i;
+    } else if(second == -1 || paths[i].getCost() < paths[second].getCost()) {
+      second = i;
+    }
+  }
+
+  if(best == -1) {
+    return;
+  }
+
+  if(mode == MultipathMode::redundant) {
+    out.push_back(best);
+    if(second != -1) {
+      out.push_back(second);
+    }
+    return;
+  }
+
+  double maxCost = paths[best].getCost() * MULTIPATH_MAX_COST_RATIO;
+  double total = 0;
+  int pick = -1;
+  for(int i = 0; i < (int)paths.size(); i++) {
+    auto& path = paths[i];
+    if(!path.isUsable(now) || path.getCost() > maxCost) {
+      path.credit = 0;
+      continue;
+    }
+
+    double weight = 1 / path.getCost();
+    path.credit += weight;
+    total += weight;
+    if(pick == -1 || path.credit > paths[pick].credit) {
+      pick = i;
+    }
+  }
+
+  paths[pick].credit -= total;
+  out.push_back(pick);
+}
+
+void ReorderBuffer::markDelivered()
+{
+  this->deliveredMask = (this->deliveredMask << 1) | 1;
+  this->nextSeq++;
+}
+
+void ReorderBuffer::skip(uint32_t count)
+{
+  this->deliveredMask = count >= 64 ? 0 : this->deliveredMask << count;
+  this->nextSeq += count;
+}
+
+void ReorderBuffer::hold(uint32_t seq, HeldPacket&& packet, Time now)
+{
+  if(this->held.empty()) {
+    this->heldSince = now;
+  }
+  this->held.emplace(seq, std::move(packet));
+}
+
+// Moves past the held packet at nextSeq. One that turns out to be forged
+// leaves its place open, so the real one may still come late.
+void ReorderBuffer::release(std::map<uint32_t, HeldPacket>::iterator it, const DeliverCallback& deliver)
+{
+  if(it->second.delivered || deliver(it->second.packet)) {
+    markDelivered();
+  } else {
+    skip(1);
+  }
+  this->held.erase(it);
+}
+
+// Held packets are all ahead of nextSeq, the closest one is either the
+// smallest one above it or (once the sequence numbers wrap) the smallest one
+void ReorderBuffer::releaseUntil(uint32_t seq, const DeliverCallback& deliver)
+{
+  while(!this->held.empty()) {
+    auto it = this->held.lower_bound(this->nextSeq);
+    if(it == this->held.end()) {
+      it = this->held.begin();
+    }
+
+    if((int32_t)(it->first - seq) >= 0) {
+      break;
+    }
+
+    skip(it->first - this->nextSeq);
+    release(it, deliver);
+  }
+
+  if((int32_t)(seq - this->nextSeq) > 0) {
+    skip(seq - this->nextSeq);
+  }
+}
+
+void ReorderBuffer::releaseInOrder(const DeliverCallback& deliver)
+{
+  for(auto it = this->held.find(this->nextSeq); it != this->held.end(); it = this->held.find(this->nextSeq)) {
+    release(it, deliver);
+  }
+}
+
+void ReorderBuffer::push(uint32_t seq, string_view packet, Time now, const DeliverCallback& deliver)
+{
+  if(!this->started) {
+    if(deliver(packet)) {
+      this->started = true;
+      this->nextSeq = seq;
+      markDelivered();
+    }
+    return;
+  }
+
+  int32_t distance = (int32_t)(seq - this->nextSeq);
+
+  if(distance < 0) {
+    // Late - passed through unless it was already delivered (or is too old to
+    // tell)
+    uint32_t age = this->nextSeq - 1 - seq;
+    if(age >= 64 || (this->deliveredMask >> age) & 1) {
+      this->duplicates++;
+      return;
+    }
+
+    if(deliver(packet)) {
+      this->deliveredMask |= 1ull << age;
+    }
+    return;
+  }
+
+  if(distance == 0) {
+    if(deliver(packet)) {
+      markDelivered();
+      releaseInOrder(deliver);
+    }
+    return;
+  }
+
+  auto it = this->held.find(seq);
+  if(it != this->held.end()) {
+    if(it->second.delivered || it->second.packet == packet) {
+      this->duplicates++;
+      return;
+    }
+
+    // One of the two is forged, and the held one would only be checked once
+    // it's released
+    if(deliver(packet)) {
+      it->second.packet.clear();
+      it->second.delivered = true;
+    }
+    return;
+  }
+
+  if((uint32_t)distance >= MULTIPATH_REORDER_WINDOW) {
+    // Gives up on the gaps before the new window, which a forged sequence
+    // number must not be able to do
+    if(!deliver(packet)) {
+      return;
+    }
+
+    releaseUntil(seq - MULTIPATH_REORDER_WINDOW + 1, deliver);
+    releaseInOrder(deliver);
+
+    if(seq == this->nextSeq) {
+      markDelivered();
+      releaseInOrder(deliver);
+    } else {
+      hold(seq, HeldPacket{"", true}, now);
+    }
+    return;
+  }
+
+  hold(seq, HeldPacket{packet.str(), false}, now);
+  this->reordered++;
+}
+
+void ReorderBuffer::expire(Time now, const DeliverCallback& deliver)
+{
+  if(this->held.empty() || now - this->heldSince < MULTIPATH_REORDER_TIMEOUT) {
+    return;
+  }
+
+  // Everything held is past the gap, so all of it goes. The last one is the
+  // largest one, unless some of them wrapped around.
+  uint32_t last = std::prev(this->held.end())->first;
+  auto firstAbove = this->held.lower_bound(this->nextSeq);
+  if(firstAbove != this->held.begin() && firstAbove != this->held.end()) {
+    last = std::prev(firstAbove)->first;
+  }
+  releaseUntil(last + 1, deliver);
+}
+
+Time ReorderBuffer::getDeadline() const
+{
+  if(this->held.empty()) {
+    return -1;
+  }
+
+  return this->heldSince + MULTIPATH_REORDER_TIMEOUT;
+}
+
+uint64_t ReorderBuffer::getReordered() const
+{
+  return this->reordered;
+}
+
+uint64_t ReorderBuffer::getDuplicates() const
+{
+  return this->duplicates;
+}
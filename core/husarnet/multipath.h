@@ -0,0 +1,126 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/ipaddress.h"
+#include "husarnet/string_view.h"
+
+// Paths are set up, probed and dropped in steps of that much
+const Time MULTIPATH_UPDATE_INTERVAL = 100;
+// Validated paths are probed that often, the candidates that never answered
+// a lot less
+const Time MULTIPATH_PROBE_INTERVAL = 500;
+const Time MULTIPATH_DISCOVERY_INTERVAL = 5000;
+// Path that hasn't answered for that long is not used anymore
+const Time MULTIPATH_PATH_TIMEOUT = 1500;
+// Local address x remote candidate pairs kept per peer
+const int MULTIPATH_MAX_PATHS = 8;
+// Paths that cost more than that many times the best one are left out of the
+// balancing (they would mostly add reordering)
+const double MULTIPATH_MAX_COST_RATIO = 2.0;
+// Longest a packet waits for the ones before it, and how far ahead of the
+// first missing one it may be
+const Time MULTIPATH_REORDER_TIMEOUT = 30;
+const uint32_t MULTIPATH_REORDER_WINDOW = 64;
+
+enum class MultipathMode
+{
+  off,
+  // Packets are spread over the paths in proportion to their quality
+  balance,
+  // Every packet goes over the two best paths
+  redundant,
+};
+
+MultipathMode parseMultipathMode(const std::string& value);
+
+// Single local address x remote address pair of a peer, validated and
+// measured with the same signed HELLO exchange as the primary path
+struct MultipathPath {
+  InetAddress localAddress;
+  InetAddress remoteAddress;
+  int fd = -1;  // bound to the local address and connect()ed to the remote one
+
+  std::string probeCookie;
+  Time probeSent = 0;
+  bool probeAnswered = true;
+  Time lastReply = 0;  // 0 until the path is validated
+
+  // EWMA of the probe round trip (ms) and of the probe loss
+  double srtt = 0;
+  double loss = 0;
+
+  double credit = 0;  // for the weighted round robin
+  uint64_t sentPackets = 0;
+
+  bool isUsable(Time now) const;
+  // Round trip inflated by the loss, lower is better
+  double getCost() const;
+
+  void probeSentAt(Time now, const std::string& cookie);
+  void replyReceivedAt(Time now);
+};
+
+// Indices of the paths the next packet should be sent over - either the pick
+// of the smooth weighted round robin (weights inverse to the cost) or the two
+// best paths in the redundant mode. Empty if none of them is usable.
+void pickMultipathPaths(std::vector<MultipathPath>& paths, MultipathMode mode, Time now, std::vector<int>& out);
+
+// Restores the order of the packets of a single peer sent over a number of
+// paths and drops the duplicates (of the redundant mode). Packets after
+// a gap are held until it's filled, for at most MULTIPATH_REORDER_TIMEOUT.
+// Packets older than the ones already delivered are passed through as long as
+// they are not duplicates.
+// The sequence numbers are sent in the clear, so a packet only counts as
+// delivered once the upper layer has authenticated it. A packet that would
+// start the buffer or push the window forward is checked (and so delivered)
+// right away, out of the order.
+class ReorderBuffer {
+ public:
+  // Returns whether the upper layer accepted the packet
+  using DeliverCallback = std::function<bool(string_view packet)>;
+
+ private:
+  struct HeldPacket {
+    std::string packet;
+    // Already delivered ahead of the order, only kept to move the window
+    bool delivered = false;
+  };
+
+  bool started = false;
+  uint32_t nextSeq = 0;
+  // Bit n is set if nextSeq - 1 - n was delivered
+  uint64_t deliveredMask = 0;
+
+  std::map<uint32_t, HeldPacket> held;
+  Time heldSince = 0;
+
+  uint64_t reordered = 0;
+  uint64_t duplicates = 0;
+
+  void markDelivered();
+  void skip(uint32_t count);
+  void hold(uint32_t seq, HeldPacket&& packet, Time now);
+  void release(std::map<uint32_t, HeldPacket>::iterator it, const DeliverCallback& deliver);
+  void releaseInOrder(const DeliverCallback& deliver);
+  void releaseUntil(uint32_t seq, const DeliverCallback& deliver);
+
+ public:
+  void push(uint32_t seq, string_view packet, Time now, const DeliverCallback& deliver);
+  // Gives up on the gaps that were waited for too long
+  void expire(Time now, const DeliverCallback& deliver);
+  // Time at which expire() has something to do, -1 if nothing is held
+  Time getDeadline() const;
+
+  uint64_t getReordered() const;
+  uint64_t getDuplicates() const;
+};
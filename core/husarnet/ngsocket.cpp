@@ -14,6 +14,7 @@
 #include "husarnet/ports/port_interface.h"
 #include "husarnet/ports/sockets.h"
 
+#include "husarnet/epoch.h"
 #include "husarnet/fstring.h"
 #include "husarnet/husarnet_config.h"
 #include "husarnet/logging.h"
@@ -21,20 +22,52 @@
 #include "husarnet/ngsocket_crypto.h"
 #include "husarnet/util.h"
 
+#ifdef PORT_LINUX
+#include "husarnet/ports/linux/xdp.h"
+#endif
+
 using namespace OsSocket;
 
-NgSocket::NgSocket(Identity* myIdentity, PeerContainer* peerContainer, ConfigManager* configManager)
-    : myIdentity(myIdentity), peerContainer(peerContainer), configManager(configManager)
+NgSocket::NgSocket(
+    Identity* myIdentity,
+    PeerContainer* peerContainer,
+    ConfigManager* configManager,
+    PeerFlags* myFlags)
+    : myIdentity(myIdentity),
+      peerContainer(peerContainer),
+      myFlags(myFlags),
+      configManager(configManager),
+      relayQueue(
+          [this](HusarnetAddress peerAddress, string_view data) { sendRelayed(peerAddress, data); },
+          [this]() { return canRelay(); })
 {
   init();
 }
 
 void NgSocket::periodic()
 {
+  Time relayWait = relayQueue.drain(Port::getCurrentTime());
+  if(relayWait >= 0) {
+    OsSocket::limitNextTimeout(relayWait);
+  }
+
+  expireReorderBuffers();
+
+  if(multipathMode != MultipathMode::off && Port::getCurrentTime() - lastPathUpdate >= MULTIPATH_UPDATE_INTERVAL) {
+    lastPathUpdate = Port::getCurrentTime();
+    EpochGuard guard;
+    peerContainer->forEachPeer([this](Peer* peer) { updatePaths(peer); });
+    OsSocket::limitNextTimeout(MULTIPATH_UPDATE_INTERVAL);
+  }
+
+  closeDroppedPathSockets();
+
   if(Port::getCurrentTime() < lastPeriodic + 1000)
     return;
   lastPeriodic = Port::getCurrentTime();
 
+  relayQueue.cleanup(lastPeriodic);
+
   if(reloadLocalAddresses()) {
     // new addresses, accelerate reconnection
     {
@@ -56,6 +89,9 @@ void NgSocket::periodic()
   if(Port::getCurrentTime() - lastRefresh > REFRESH_TIMEOUT)
     requestRefresh();
 
+  if(Port::getCurrentTime() - lastKeepalive >= KEEPALIVE_TICK)
+    requestKeepalive();
+
   if(!natInitConfirmed && Port::getCurrentTime() - lastNatInitSent > NAT_INIT_TIMEOUT) {
     // retry nat init in case the packet gets lost
     sendNatInitToBase();
@@ -63,6 +99,9 @@ void NgSocket::periodic()
 
   if(Port::getCurrentTime() - lastBaseTcpAction > (baseConnection ? TCP_PONG_TIMEOUT : NAT_INIT_TIMEOUT))
     connectToBase();
+
+  if(connectedSockets)
+    closeStalePeerSockets();
 }
 
 BaseConnectionType NgSocket::getCurrentBaseConnectionType()
@@ -87,6 +126,51 @@ InetAddress NgSocket::getCurrentBaseAddress()
   return baseAddress;
 };
 
+size_t NgSocket::getBaseTcpQueuedBytes()
+{
+  auto conn = baseConnection;
+  return conn ? conn->getQueuedBytes() : 0;
+}
+
+uint64_t NgSocket::getBaseTcpDroppedWrites()
+{
+  auto conn = baseConnection;
+  return conn ? conn->getDroppedWrites() : 0;
+}
+
+json NgSocket::getRelayConfig()
+{
+  return relayQueue.getConfig();
+}
+
+bool NgSocket::setRelayConfig(const json& value, std::string& error)
+{
+  if(!relayQueue.setConfig(value, error)) {
+    return false;
+  }
+
+  if(!Port::writeStorage(StorageKey::relayConfig, relayQueue.getConfig().dump())) {
+    HLOG_WARNING("unable to store the relay config, it will be lost on restart");
+  }
+
+  return true;
+}
+
+json NgSocket::getRelayStats()
+{
+  return relayQueue.getStats();
+}
+
+uint64_t NgSocket::getXdpReceivedPackets()
+{
+#ifdef PORT_LINUX
+  if(xdpSocket != nullptr) {
+    return xdpSocket->getReceivedPackets();
+  }
+#endif
+  return 0;
+}
+
 void NgSocket::requestRefresh()
 {
   if(workerQueue.qsize() < this->workerQueueSize) {
@@ -96,10 +180,21 @@ void NgSocket::requestRefresh()
   }
 }
 
+void NgSocket::requestKeepalive()
+{
+  lastKeepalive = Port::getCurrentTime();
+  if(workerQueue.qsize() < this->workerQueueSize) {
+    workerQueue.push(std::bind(&NgSocket::keepalive, this));
+  } else {
+    HLOG_ERROR("ngsocket worker queue full");
+  }
+}
+
 void NgSocket::workerLoop()
 {
   while(true) {
     std::function<void()> f = workerQueue.pop_blocking();
+    EpochGuard guard;
     f();
   }
 }
@@ -112,11 +207,49 @@ void NgSocket::refresh()
   sendNatInitToBase();
   sendMulticast();
 
-  for(Peer* peer : iteratePeers()) {
-    periodicPeer(peer);
+  std::vector<Peer*> idlePeers;
+  peerContainer->forEachPeer([&idlePeers](Peer* peer) {
+    if(peer->isIdle() && peer->packetQueue.empty()) {
+      idlePeers.push_back(peer);
+    }
+  });
+
+  for(Peer* peer : idlePeers) {
+    evictPeer(peer);
   }
 }
 
+void NgSocket::keepalive()
+{
+  peerContainer->forEachPeer([this](Peer* peer) { periodicPeer(peer); });
+}
+
+uint64_t NgSocket::getSkippedKeepalives()
+{
+  return skippedKeepalives;
+}
+
+void NgSocket::evictPeer(Peer* peer)
+{
+  {
+    std::scoped_lock lock(pathsMutex);
+    closePaths(peer);
+  }
+
+  {
+    std::scoped_lock lock(peerSourceAddressesMutex);
+    for(auto& address : peer->sourceAddresses) {
+      auto it = peerSourceAddresses.find(address);
+      if(it != peerSourceAddresses.end() && it->second == peer) {
+        peerSourceAddresses.erase(it);
+      }
+    }
+    peer->sourceAddresses.clear();
+  }
+
+  peerContainer->evictPeer(peer->id);
+}
+
 void NgSocket::periodicPeer(Peer* peer)
 {
   if(peer->negotiated && peer->lastValidPacket < Port::getCurrentTime() - RENEGOTIATION_TIMEOUT) {
@@ -136,6 +269,28 @@ void NgSocket::periodicPeer(Peer* peer)
       HLOG_WARNING("falling back to relay // {peer}", peer->getIpAddressString());
     }
 
+    // Every peer has a schedule of its own, so the hellos don't all go out in
+    // a single burst
+    Time now = Port::getCurrentTime();
+    if(peer->nextKeepalive == 0) {
+      peer->nextKeepalive = now + rand() % REFRESH_TIMEOUT;
+    }
+    if(now < peer->nextKeepalive) {
+      return;
+    }
+    peer->nextKeepalive = now + REFRESH_TIMEOUT - KEEPALIVE_JITTER + rand() % (2 * KEEPALIVE_JITTER + 1);
+
+    // Authenticated data from the target proves the path (and keeps the NAT
+    // mapping) just as well as the hello would. A path that dies in between
+    // is caught by the liveness probes.
+    if(peer->connected && !peer->reestablishing && now - peer->lastTargetData < REFRESH_TIMEOUT &&
+       peer->skippedKeepalives < KEEPALIVE_MAX_SKIPPED) {
+      peer->skippedKeepalives++;
+      skippedKeepalives++;
+      return;
+    }
+
+    peer->skippedKeepalives = 0;
     attemptReestablish(peer);
   }
 }
@@ -154,14 +309,23 @@ bool NgSocket::isBaseUdp()
 
 void NgSocket::sendDataToPeer(Peer* peer, string_view data)
 {
-  if(peer->connected) {
-    PeerToPeerMessage msg = {
-        .kind = PeerToPeerMessageKind::DATA,
-        .data = data,
-    };
+  // Path MTU and liveness probes are only meaningful on the direct path, the
+  // former must not be fragmented on the way either
+  if(data.size() > 0 && (data[0] == PATH_MTU_PROBE_PACKET_TYPE || data[0] == LIVENESS_PROBE_PACKET_TYPE)) {
+    if(!peer->connected)
+      return;
+
+    sendToPeer(
+        peer->targetAddress, makeDataMessage(peer, data), /*dontFragment=*/data[0] == PATH_MTU_PROBE_PACKET_TYPE,
+        getPeerSocket(peer));
+    return;
+  }
 
+  if(sendMultipath(peer, data)) {
+    HLOG_DEBUG("send to peer over multipath // {peer} {num_bytes}", peer->getIpAddressString(), data.size());
+  } else if(peer->connected) {
     HLOG_DEBUG("send to peer // {peer} {num_bytes}", peer->targetAddress.str(), data.size());
-    sendToPeer(peer->targetAddress, msg);
+    sendToPeer(peer->targetAddress, makeDataMessage(peer, data), /*dontFragment=*/false, getPeerSocket(peer));
   } else {
     if(!peer->reestablishing || (Port::getCurrentTime() - peer->lastReestablish > REESTABLISH_TIMEOUT &&
                                  peer->failedEstablishments <= MAX_FAILED_ESTABLISHMENTS))
@@ -169,16 +333,9 @@ void NgSocket::sendDataToPeer(Peer* peer, string_view data)
 
     HLOG_DEBUG("send to peer tunnelled // {peer}", peer->getIpAddressString());
     // Not (yet) connected, relay via base.
-    PeerToBaseMessage msg = {
-        .kind = PeerToBaseMessageKind::DATA,
-        .target = peer->id.data,
-        .data = data,
-    };
-
-    if(isBaseUdp()) {
-      sendToBaseUdp(msg);
-    } else {
-      sendToBaseTcp(msg);
+    Time relayWait = relayQueue.send(peer->id, data, Port::getCurrentTime());
+    if(relayWait >= 0) {
+      OsSocket::limitNextTimeout(relayWait);
     }
   }
 
@@ -188,6 +345,313 @@ void NgSocket::sendDataToPeer(Peer* peer, string_view data)
   peer->lastPacket = Port::getCurrentTime();
 }
 
+// Peers that gave us their session index get it in every data packet
+PeerToPeerMessage NgSocket::makeDataMessage(Peer* peer, string_view data)
+{
+  if(peer->remoteSessionIndex != 0) {
+    return PeerToPeerMessage{
+        .kind = PeerToPeerMessageKind::INDEXED_DATA,
+        .data = data,
+        .sessionIndex = peer->remoteSessionIndex,
+    };
+  }
+
+  return PeerToPeerMessage{
+      .kind = PeerToPeerMessageKind::DATA,
+      .data = data,
+  };
+}
+
+// Opened lazily on the event loop thread, once the hello reply confirmed the
+// target address. The socket of the previous target (if any) is closed by
+// closeStalePeerSockets.
+int NgSocket::getPeerSocket(Peer* peer)
+{
+  if(!connectedSockets) {
+    return -1;
+  }
+
+  if(peer->connectedSocketTarget == peer->targetAddress) {
+    return peer->connectedSocket;
+  }
+
+  peer->connectedSocketTarget = peer->targetAddress;
+  peer->connectedSocket = -1;
+  if(peerSockets.size() >= MAX_PEER_SOCKETS) {
+    return -1;
+  }
+
+  int fd = OsSocket::udpConnect(sourcePort, peer->targetAddress, udpCallback);
+  if(fd != -1) {
+    HLOG_DEBUG("opened peer socket // {peer} {address}", peer->getIpAddressString(), peer->targetAddress.str());
+    peerSockets[fd] = peer->id;
+  }
+
+  peer->connectedSocket = fd;
+  return fd;
+}
+
+void NgSocket::closeStalePeerSockets()
+{
+  EpochGuard guard;
+  for(auto it = peerSockets.begin(); it != peerSockets.end();) {
+    int fd = it->first;
+    Peer* peer = peerContainer->getPeer(it->second);
+    if(peer != nullptr && peer->connectedSocket == fd) {
+      if(peer->connected && peer->connectedSocketTarget == peer->targetAddress) {
+        it++;
+        continue;
+      }
+
+      // Back to relaying, next direct path gets a new socket
+      peer->connectedSocket = -1;
+      peer->connectedSocketTarget = InetAddress();
+    }
+
+    OsSocket::udpClose(fd);
+    it = peerSockets.erase(it);
+  }
+}
+
+bool NgSocket::supportsMultipath(Peer* peer)
+{
+  return multipathMode != MultipathMode::off && peer->negotiated && peer->flags.checkFlag(PeerFlag::multipath);
+}
+
+// Every local address is paired with every known address of the peer (of the
+// same family). Each pair gets its own socket, bound to the local address (and
+// its interface), so the traffic actually leaves through it.
+void NgSocket::updatePaths(Peer* peer)
+{
+  std::scoped_lock lock(pathsMutex);
+  Time now = Port::getCurrentTime();
+
+  if(!supportsMultipath(peer) || !peer->isActive()) {
+    closePaths(peer);
+    return;
+  }
+
+  std::vector<InetAddress> remotes = peer->targetAddresses;
+  if(peer->targetAddress)
+    remotes.push_back(peer->targetAddress);
+  {
+    std::scoped_lock sourceLock(peerSourceAddressesMutex);
+    remotes.insert(remotes.end(), peer->sourceAddresses.begin(), peer->sourceAddresses.end());
+  }
+  std::sort(remotes.begin(), remotes.end());
+  remotes.erase(std::unique(remotes.begin(), remotes.end()), remotes.end());
+
+  std::vector<std::pair<InetAddress, InetAddress>> candidates;
+  for(auto& local : localAddresses) {
+    if(local.ip.isLinkLocal() || local.ip.isLoopback())
+      continue;
+
+    for(auto& remote : remotes) {
+      if(!remote || remote.ip.isFC94() || remote.ip.isLinkLocal())
+        continue;
+      if(local.ip.isMappedV4() != remote.ip.isMappedV4())
+        continue;
+      if(candidates.size() < MULTIPATH_MAX_PATHS)
+        candidates.push_back({local, remote});
+    }
+  }
+
+  auto isCandidate = [&candidates](const MultipathPath& path) {
+    return std::find(
+               candidates.begin(), candidates.end(), std::make_pair(path.localAddress, path.remoteAddress)) !=
+           candidates.end();
+  };
+  for(auto it = peer->paths.begin(); it != peer->paths.end();) {
+    if(isCandidate(*it)) {
+      it++;
+      continue;
+    }
+
+    if(it->fd != -1)
+      OsSocket::udpClose(it->fd);
+    it = peer->paths.erase(it);
+  }
+
+  for(auto& candidate : candidates) {
+    auto existing = std::find_if(peer->paths.begin(), peer->paths.end(), [&candidate](const MultipathPath& path) {
+      return path.localAddress == candidate.first && path.remoteAddress == candidate.second;
+    });
+    if(existing != peer->paths.end())
+      continue;
+
+    MultipathPath path;
+    path.localAddress = candidate.first;
+    path.remoteAddress = candidate.second;
+    path.fd = OsSocket::udpConnect(sourcePort, path.remoteAddress, udpCallback, path.localAddress.ip);
+    HLOG_DEBUG(
+        "new multipath path // {peer} {local} {remote} {fd}", peer->getIpAddressString(), path.localAddress.str(),
+        path.remoteAddress.str(), path.fd);
+    peer->paths.push_back(std::move(path));
+  }
+
+  // Same signed HELLO as the primary path, just with a cookie of its own
+  for(auto& path : peer->paths) {
+    if(path.fd == -1)
+      continue;
+
+    bool validated = path.lastReply != 0 && now - path.lastReply < MULTIPATH_DISCOVERY_INTERVAL;
+    if(now - path.probeSent < (validated ? MULTIPATH_PROBE_INTERVAL : MULTIPATH_DISCOVERY_INTERVAL))
+      continue;
+
+    path.probeSentAt(now, generateRandomString(16));
+    PeerToPeerMessage msg = {
+        .kind = PeerToPeerMessageKind::HELLO,
+        .yourId = peer->id.data,
+        .helloCookie = path.probeCookie,
+    };
+    sendToPeer(path.remoteAddress, msg, /*dontFragment=*/false, path.fd);
+  }
+}
+
+// Caller has to hold pathsMutex. May be called from the worker thread (when
+// the peer is evicted), so the sockets are only closed by the next periodic.
+void NgSocket::closePaths(Peer* peer)
+{
+  for(auto& path : peer->paths) {
+    if(path.fd != -1)
+      closingPathSockets.push_back(path.fd);
+  }
+  peer->paths.clear();
+}
+
+void NgSocket::closeDroppedPathSockets()
+{
+  std::scoped_lock lock(pathsMutex);
+  for(int fd : closingPathSockets) {
+    OsSocket::udpClose(fd);
+  }
+  closingPathSockets.clear();
+}
+
+bool NgSocket::sendMultipath(Peer* peer, string_view data)
+{
+  if(!supportsMultipath(peer))
+    return false;
+
+  std::scoped_lock lock(pathsMutex);
+  pickMultipathPaths(peer->paths, multipathMode, Port::getCurrentTime(), pathPicks);
+  if(pathPicks.empty())
+    return false;
+
+  PeerToPeerMessage msg = {
+      .kind = PeerToPeerMessageKind::MULTIPATH_DATA,
+      .data = data,
+      .seq = peer->multipathSeq++,
+  };
+  std::string serialized = serializePeerToPeerMessage(msg);
+
+  for(int index : pathPicks) {
+    auto& path = peer->paths[index];
+    path.sentPackets++;
+    udpSend(path.remoteAddress, serialized, path.fd);
+  }
+
+  return true;
+}
+
+bool NgSocket::pathReplyReceived(Peer* peer, const PeerToPeerMessage& msg)
+{
+  std::scoped_lock lock(pathsMutex);
+  for(auto& path : peer->paths) {
+    if(path.probeCookie.empty() || path.probeCookie != msg.helloCookie)
+      continue;
+
+    if(path.lastReply == 0) {
+      HLOG_INFO(
+          "multipath path validated // {peer} {local} {remote}", peer->getIpAddressString(), path.localAddress.str(),
+          path.remoteAddress.str());
+    }
+    path.replyReceivedAt(Port::getCurrentTime());
+    return true;
+  }
+
+  return false;
+}
+
+void NgSocket::multipathDataReceived(InetAddress source, const PeerToPeerMessage& msg)
+{
+  Peer* peer = findPeerBySourceAddress(source);
+  if(peer == nullptr) {
+    HLOG_ERROR("unknown UDP data packet // {source}", source.str());
+    return;
+  }
+
+  peer->reorderBuffer.push(msg.seq, msg.data, Port::getCurrentTime(), [this, peer](string_view packet) {
+    return deliverReordered(peer, packet);
+  });
+}
+
+// Whatever the security layer authenticates counts as delivered. Packets it
+// doesn't seal (parity, heartbeats) just leave their place in the order open.
+// Multipath packets only come over the direct paths, so the authenticated ones
+// keep the liveness probes and the keepalive rounds quiet, like plain data
+// from the target address does.
+bool NgSocket::deliverReordered(Peer* peer, string_view packet)
+{
+  uint64_t validPackets = peer->validPackets;
+  sendToUpperLayer(peer->id, packet);
+  if(peer->validPackets == validPackets)
+    return false;
+
+  peer->lastTargetData = Port::getCurrentTime();
+  return true;
+}
+
+void NgSocket::expireReorderBuffers()
+{
+  Time now = Port::getCurrentTime();
+  peerContainer->forEachPeer([this, now](Peer* peer) {
+    peer->reorderBuffer.expire(now, [this, peer](string_view packet) { return deliverReordered(peer, packet); });
+
+    Time deadline = peer->reorderBuffer.getDeadline();
+    if(deadline >= 0) {
+      OsSocket::limitNextTimeout(std::max<Time>(deadline - now, 1));
+    }
+  });
+}
+
+json NgSocket::getPeerPaths(Peer* peer)
+{
+  std::scoped_lock lock(pathsMutex);
+  Time now = Port::getCurrentTime();
+
+  json paths = json::array();
+  for(auto& path : peer->paths) {
+    paths.push_back({
+        {"local", path.localAddress.str()},
+        {"remote", path.remoteAddress.str()},
+        {"usable", path.isUsable(now)},
+        {"rtt_ms", path.srtt},
+        {"loss", path.loss},
+        {"sent_packets", path.sentPackets},
+    });
+  }
+  return paths;
+}
+
+json NgSocket::getPeerCandidatePaths(Peer* peer)
+{
+  std::scoped_lock lock(pathsMutex);
+
+  json paths = json::array();
+  for(auto& [address, stats] : peer->pathLatency) {
+    paths.push_back({
+        {"address", address.str()},
+        {"is_target", address == peer->targetAddress},
+        {"rtt_ms", stats.srtt},
+        {"jitter_ms", stats.jitter},
+        {"samples", stats.samples},
+        {"last_sample_age_ms", Port::getCurrentTime() - stats.lastSample},
+    });
+  }
+  return paths;
+}
+
 void NgSocket::attemptReestablish(Peer* peer)
 {
   // TODO long term - if (peer->reestablishing) something;
@@ -202,30 +666,44 @@ void NgSocket::attemptReestablish(Peer* peer)
   if(peer->linkLocalAddress)
     addresses.push_back(peer->linkLocalAddress);
 
-  for(InetAddress address : peer->sourceAddresses)
-    addresses.push_back(address);
+  // The event loop adds to sourceAddresses as the peer shows up from new ones
+  {
+    std::scoped_lock sourceLock(peerSourceAddressesMutex);
+    addresses.insert(addresses.end(), peer->sourceAddresses.begin(), peer->sourceAddresses.end());
+  }
 
   std::sort(addresses.begin(), addresses.end());
   addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
 
+  {
+    std::scoped_lock lock(pathsMutex);
+    std::erase_if(peer->pathLatency, [&addresses](const auto& item) {
+      return !std::binary_search(addresses.begin(), addresses.end(), item.first);
+    });
+  }
+
   std::string msg = "";
 
+  // The hello doesn't depend on the address, so it's signed once for all of
+  // them
+  PeerToPeerMessage response = {
+      .kind = PeerToPeerMessageKind::HELLO,
+      .yourId = peer->id.data,
+      .helloCookie = peer->helloCookie,
+  };
+  std::string serialized = serializePeerToPeerMessage(response);
+
   for(InetAddress address : addresses) {
     if(address.ip.isFC94())
       continue;
 
     msg += address.str().c_str();
     msg += ", ";
-    PeerToPeerMessage response = {
-        .kind = PeerToPeerMessageKind::HELLO,
-        .yourId = peer->id.data,
-        .helloCookie = peer->helloCookie,
-    };
-    sendToPeer(address, response);
+    udpSend(address, serialized);
 
     if(address == peer->targetAddress)
       // send the heartbeat twice to the active address
-      sendToPeer(address, response);
+      udpSend(address, serialized);
   }
   HLOG_DEBUG("attempt reestablish // {peer} {addresses}", peer->getIpAddressString(), msg);
 }
@@ -242,6 +720,12 @@ void NgSocket::peerMessageReceived(InetAddress source, const PeerToPeerMessage&
     case +PeerToPeerMessageKind::HELLO_REPLY:
       helloReplyReceived(source, msg);
       break;
+    case +PeerToPeerMessageKind::MULTIPATH_DATA:
+      multipathDataReceived(source, msg);
+      break;
+    case +PeerToPeerMessageKind::INDEXED_DATA:
+      indexedDataPacketReceived(source, msg);
+      break;
     default:
       HLOG_ERROR("unknown message received from peer // {peer}", source.str());
   }
@@ -285,14 +769,41 @@ void NgSocket::helloReplyReceived(InetAddress source, const PeerToPeerMessage& m
   if(peer == nullptr) {
     return;
   }
-  if(!peer->reestablishing) {
+  if(pathReplyReceived(peer, msg)) {
     return;
   }
+  // Replies to the last round keep coming after the first one, they still
+  // measure their addresses
   if(peer->helloCookie != msg.helloCookie) {
     return;
   }
 
-  int latency = Port::getCurrentTime() - peer->lastReestablish;
+  Time now = Port::getCurrentTime();
+  int latency = now - peer->lastReestablish;
+  {
+    std::scoped_lock lock(pathsMutex);
+    auto& stats = peer->pathLatency[source];
+    if(stats.lastRound == peer->lastReestablish) {
+      return;
+    }
+    stats.lastRound = peer->lastReestablish;
+    stats.addSample(latency, now);
+
+    if(!peer->reestablishing) {
+      auto current = peer->pathLatency.find(peer->targetAddress);
+      if(!peer->connected || source == peer->targetAddress || current == peer->pathLatency.end() ||
+         !isBetterPath(stats, current->second, now, 2 * KEEPALIVE_MAX_INTERVAL)) {
+        return;
+      }
+
+      HLOG_INFO(
+          "switching to a faster path // {peer} {old_address} {address} {old_rtt_ms} {rtt_ms}",
+          peer->getIpAddressString(), peer->targetAddress.str(), source.str(), current->second.srtt, stats.srtt);
+      peer->targetAddress = source;
+      return;
+    }
+  }
+
   HLOG_DEBUG("using this address as target // {latency_ms}", latency);
   peer->targetAddress = source;
   peer->connected = true;
@@ -304,13 +815,60 @@ void NgSocket::peerDataPacketReceived(InetAddress source, string_view data)
 {
   Peer* peer = findPeerBySourceAddress(source);
 
-  if(peer != nullptr)
+  if(peer != nullptr) {
+    uint64_t validPackets = peer->validPackets;
     sendToUpperLayer(peer->id, data);
-  else {
+    if(peer->validPackets != validPackets && source == peer->targetAddress)
+      peer->lastTargetData = Port::getCurrentTime();
+  } else {
     HLOG_ERROR("unknown UDP data packet // {source}", source.str());
   }
 }
 
+void NgSocket::indexedDataPacketReceived(InetAddress source, const PeerToPeerMessage& msg)
+{
+  EpochGuard guard;
+  Peer* peer = peerContainer->getPeerBySessionIndex(msg.sessionIndex);
+  if(peer == nullptr) {
+    // Index from before we restarted (or evicted the peer), the source
+    // address may still tell who it is
+    peerDataPacketReceived(source, msg.data);
+    return;
+  }
+
+  uint64_t validPackets = peer->validPackets;
+  sendToUpperLayer(peer->id, msg.data);
+
+  // Only a packet that authenticated under the session may move the peer
+  if(peer->validPackets != validPackets) {
+    if(source != peer->targetAddress)
+      migratePeer(peer, source);
+    if(source == peer->targetAddress)
+      peer->lastTargetData = Port::getCurrentTime();
+  }
+}
+
+// The peer's NAT mapping or address changed. There is no replay protection
+// on the data packets, so the one that got us here may have been replayed from
+// anywhere - our traffic keeps going to the old target until the hello round
+// that includes the new address picks it.
+void NgSocket::migratePeer(Peer* peer, InetAddress source)
+{
+  addSourceAddress(peer, source);
+  if(!peer->connected || peer->reestablishing || source.ip.isLinkLocal()) {
+    return;
+  }
+
+  if(Port::getCurrentTime() - peer->lastReestablish <= MIGRATION_REESTABLISH_INTERVAL) {
+    return;
+  }
+
+  HLOG_INFO(
+      "peer showed up at a new address, confirming it // {peer} {old_address} {address}", peer->getIpAddressString(),
+      peer->targetAddress.str(), source.str());
+  attemptReestablish(peer);
+}
+
 void NgSocket::baseMessageReceivedUdp(const BaseToPeerMessage& msg)
 {
   switch(msg.kind) {
@@ -478,7 +1036,20 @@ void NgSocket::init()
 
   this->workerQueueSize = this->configManager->getWorkerQueueSize();
 
-  auto cb = [this](InetAddress address, string_view packet) { udpPacketReceived(address, packet); };
+  udpCallback = [this](InetAddress address, string_view packet) { udpPacketReceived(address, packet); };
+  connectedSockets = this->configManager->getEnableConnectedSockets();
+
+  // Receiving is always supported, sending only when enabled
+  multipathMode = parseMultipathMode(this->configManager->getMultipath());
+  myFlags->setFlag(PeerFlag::multipath);
+
+  auto storedRelayConfig = Port::readStorage(StorageKey::relayConfig);
+  if(!storedRelayConfig.empty()) {
+    std::string error;
+    if(!relayQueue.setConfig(json::parse(storedRelayConfig, nullptr, false), error)) {
+      HLOG_ERROR("stored relay config is invalid, ignoring it // {error}", error);
+    }
+  }
 
   sourcePort = 5582;  // TODO make this a macro definition
 
@@ -487,11 +1058,19 @@ void NgSocket::init()
       HLOG_CRITICAL("failed to bind UDP port");
       abort();
     }
-    if(udpListenUnicast(sourcePort, cb)) {
+    if(udpListenUnicast(sourcePort, udpCallback)) {
       break;
     }
   }
 
+#ifdef PORT_LINUX
+  // The socket stays bound, it's the fallback and the send path
+  auto xdpInterface = this->configManager->getXdpInterface();
+  if(!xdpInterface.empty()) {
+    xdpSocket = XdpSocket::open(xdpInterface, sourcePort, udpCallback);
+  }
+#endif
+
   auto callback = [this](InetAddress address, const std::string& packet) { multicastPacketReceived(address, packet); };
   udpListenMulticast(InetAddress{MULTICAST_ADDR_4, MULTICAST_PORT}, callback);
   udpListenMulticast(InetAddress{MULTICAST_ADDR_6, MULTICAST_PORT}, callback);
@@ -506,10 +1085,10 @@ void NgSocket::init()
 
 void NgSocket::resendInfoRequests()
 {
-  for(Peer* peer : iteratePeers()) {
+  peerContainer->forEachPeer([this](Peer* peer) {
     if(peer->isActive())
       sendInfoRequestToBase(peer->id);
-  }
+  });
 }
 
 void NgSocket::sendInfoRequestToBase(HusarnetAddress id)
@@ -530,9 +1109,6 @@ std::string NgSocket::sign(const std::string& data, const std::string& kind)
 
 // data structure manipulation
 
-Peer* cachedPeer = nullptr;
-HusarnetAddress cachedPeerId;
-
 bool NgSocket::reloadLocalAddresses()
 {
   std::vector<InetAddress> newAddresses;
@@ -555,6 +1131,7 @@ bool NgSocket::reloadLocalAddresses()
   }
 }
 
+// Caller has to hold peerSourceAddressesMutex
 void NgSocket::removeSourceAddress(Peer* peer, InetAddress address)
 {
   peer->sourceAddresses.erase(address);
@@ -564,6 +1141,7 @@ void NgSocket::removeSourceAddress(Peer* peer, InetAddress address)
 void NgSocket::addSourceAddress(Peer* peer, InetAddress source)
 {
   assert(peer != nullptr);
+  std::scoped_lock lock(peerSourceAddressesMutex);
   if(peer->sourceAddresses.find(source) == peer->sourceAddresses.end()) {
     if(peer->sourceAddresses.size() >= MAX_SOURCE_ADDRESSES) {
       // remove random old address
@@ -582,6 +1160,7 @@ void NgSocket::addSourceAddress(Peer* peer, InetAddress source)
 
 Peer* NgSocket::findPeerBySourceAddress(InetAddress address)
 {
+  std::scoped_lock lock(peerSourceAddressesMutex);
   auto it = peerSourceAddresses.find(address);
   if(it == peerSourceAddresses.end())
     return nullptr;
@@ -589,14 +1168,6 @@ Peer* NgSocket::findPeerBySourceAddress(InetAddress address)
     return it->second;
 }
 
-std::vector<Peer*> NgSocket::iteratePeers()
-{
-  std::vector<Peer*> peersVec;
-  for(auto& p : peerContainer->getPeers())
-    peersVec.push_back(p.second);
-  return peersVec;
-}
-
 BaseToPeerMessage NgSocket::parseBaseToPeerMessage(string_view data)
 {
   BaseToPeerMessage msg{
@@ -695,6 +1266,24 @@ PeerToPeerMessage NgSocket::parsePeerToPeerMessage(string_view data)
     return msg;
   }
 
+  if(data[0] == (char)PeerToPeerMessageKind::MULTIPATH_DATA) {
+    if(data.size() <= 5)
+      return msg;
+    msg.kind = PeerToPeerMessageKind::MULTIPATH_DATA;
+    msg.seq = unpack<uint32_t>(data.substr(1, 4));
+    msg.data = data.substr(5);
+    return msg;
+  }
+
+  if(data[0] == (char)PeerToPeerMessageKind::INDEXED_DATA) {
+    if(data.size() <= 5)
+      return msg;
+    msg.kind = PeerToPeerMessageKind::INDEXED_DATA;
+    msg.sessionIndex = unpack<uint32_t>(data.substr(1, 4));
+    msg.data = data.substr(5);
+    return msg;
+  }
+
   return msg;
 }
 
@@ -715,6 +1304,12 @@ std::string NgSocket::serializePeerToPeerMessage(const PeerToPeerMessage& msg)
     case +PeerToPeerMessageKind::DATA:
       data = pack((uint8_t)msg.kind._value) + msg.data.str();
       break;
+    case +PeerToPeerMessageKind::MULTIPATH_DATA:
+      data = pack((uint8_t)msg.kind._value) + pack(msg.seq) + msg.data.str();
+      break;
+    case +PeerToPeerMessageKind::INDEXED_DATA:
+      data = pack((uint8_t)msg.kind._value) + pack(msg.sessionIndex) + msg.data.str();
+      break;
     default:
       abort();
   }
@@ -854,8 +1449,36 @@ void NgSocket::sendToBaseTcp(const PeerToBaseMessage& msg)
   TcpConnection::write(baseConnection, serialized);
 }
 
-void NgSocket::sendToPeer(InetAddress dest, const PeerToPeerMessage& msg)
+// Called by the relay queue once it's the peer's turn
+void NgSocket::sendRelayed(HusarnetAddress peerAddress, string_view data)
+{
+  PeerToBaseMessage msg = {
+      .kind = PeerToBaseMessageKind::DATA,
+      .target = peerAddress.data,
+      .data = data,
+  };
+
+  if(isBaseUdp()) {
+    sendToBaseUdp(msg);
+  } else {
+    sendToBaseTcp(msg);
+  }
+}
+
+// Whether the stream to the base can take more without building a queue of
+// its own
+bool NgSocket::canRelay()
+{
+  if(isBaseUdp()) {
+    return OsSocket::getUdpSendQueueDepth() == 0;
+  }
+
+  auto conn = baseConnection;
+  return !conn || conn->getQueuedBytes() < RELAY_TCP_BACKLOG;
+}
+
+void NgSocket::sendToPeer(InetAddress dest, const PeerToPeerMessage& msg, bool dontFragment, int fd)
 {
   std::string serialized = serializePeerToPeerMessage(msg);
-  udpSend(dest, std::move(serialized));
+  udpSend(dest, std::move(serialized), fd, dontFragment);
 }
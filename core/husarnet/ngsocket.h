@@ -5,7 +5,9 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -19,14 +21,27 @@
 #include "husarnet/identity.h"
 #include "husarnet/ipaddress.h"
 #include "husarnet/layer_interfaces.h"
+#include "husarnet/multipath.h"
 #include "husarnet/ngsocket_messages.h"
 #include "husarnet/peer_container.h"
+#include "husarnet/peer_flags.h"
 #include "husarnet/queue.h"
+#include "husarnet/relay_queue.h"
 #include "husarnet/string_view.h"
 
 #include "enum.h"
 
 const int REFRESH_TIMEOUT = 25 * 1000;
+// Peers are kept alive on their own schedules (REFRESH_TIMEOUT +- the jitter),
+// checked that often
+const int KEEPALIVE_TICK = 1000;
+const int KEEPALIVE_JITTER = REFRESH_TIMEOUT / 5;
+// Data from the target address stands in for that many hello rounds in a row,
+// the rounds in between still look for better paths
+const int KEEPALIVE_MAX_SKIPPED = 4;
+const int KEEPALIVE_MAX_INTERVAL = (KEEPALIVE_MAX_SKIPPED + 1) * (REFRESH_TIMEOUT + KEEPALIVE_JITTER);
+// Sockets are polled with select, so they have to stay well below FD_SETSIZE
+const int MAX_PEER_SOCKETS = 256;
 const int NAT_INIT_TIMEOUT = 3 * 1000;
 const int TCP_PONG_TIMEOUT = 35 * 1000;
 const int UDP_BASE_TIMEOUT = 35 * 1000;
@@ -36,6 +51,16 @@ const int MAX_FAILED_ESTABLISHMENTS = 5;
 const int MAX_ADDRESSES = 10;
 const int MAX_SOURCE_ADDRESSES = 5;
 const int DEVICEID_LENGTH = 16;
+// Peer showing up from a new address triggers a hello round to confirm it at
+// most that often
+const int MIGRATION_REESTABLISH_INTERVAL = 1000;
+// Relayed packets stay in the relay queue (where the peers get fair shares)
+// rather than in the base TCP write queue once it holds this much
+const size_t RELAY_TCP_BACKLOG = OsSocket::TCP_WRITE_QUEUE_BUDGET / 4;
+
+#ifdef PORT_LINUX
+class XdpSocket;
+#endif
 
 enum class BaseConnectionType
 {
@@ -48,13 +73,23 @@ class NgSocket : public LowerLayer {
  private:
   Identity* myIdentity;
   PeerContainer* peerContainer;
+  PeerFlags* myFlags;
 
   ConfigManager* configManager;
 
+  RelayQueue relayQueue;
+
+#ifdef PORT_LINUX
+  XdpSocket* xdpSocket = nullptr;
+#endif
+
+  std::mutex peerSourceAddressesMutex;
   std::unordered_map<InetAddress, Peer*, iphash> peerSourceAddresses;
   std::vector<InetAddress> localAddresses;  // sorted
   Time lastRefresh = 0;
+  Time lastKeepalive = 0;
   Time lastPeriodic = 0;
+  uint64_t skippedKeepalives = 0;
   uint64_t natInitCounter = 0;
   std::string cookie;
 
@@ -80,6 +115,21 @@ class NgSocket : public LowerLayer {
   bool natInitConfirmed = true;
 
   int sourcePort = 0;
+  OsSocket::PacketCallback udpCallback;
+
+  // connect()ed sockets of the direct peer paths, fd -> peer
+  bool connectedSockets = false;
+  std::unordered_map<int, HusarnetAddress> peerSockets;
+
+  // Multipath paths are probed from the event loop and validated on the worker
+  // thread, this guards Peer::paths (and Peer::pathLatency) of all the peers
+  MultipathMode multipathMode = MultipathMode::off;
+  std::mutex pathsMutex;
+  Time lastPathUpdate = 0;
+  std::vector<int> pathPicks;
+  // Sockets of the dropped paths, closed by the event loop (as it's the one
+  // walking the socket list) - guarded by pathsMutex as well
+  std::vector<int> closingPathSockets;
 
   InetAddress baseUdpAddress;
   std::vector<InetAddress> allBaseUdpAddresses;
@@ -88,16 +138,33 @@ class NgSocket : public LowerLayer {
   Queue<std::function<void()>> workerQueue;
 
   void requestRefresh();
+  void requestKeepalive();
   void workerLoop();
   void refresh();
+  void keepalive();
   void periodicPeer(Peer* peer);
+  void evictPeer(Peer* peer);
   bool isBaseUdp();
   void sendDataToPeer(Peer* peer, string_view data);
+  int getPeerSocket(Peer* peer);
+  void closeStalePeerSockets();
+  bool supportsMultipath(Peer* peer);
+  void updatePaths(Peer* peer);
+  void closePaths(Peer* peer);
+  void closeDroppedPathSockets();
+  bool sendMultipath(Peer* peer, string_view data);
+  bool pathReplyReceived(Peer* peer, const PeerToPeerMessage& msg);
+  void multipathDataReceived(InetAddress source, const PeerToPeerMessage& msg);
+  bool deliverReordered(Peer* peer, string_view packet);
+  void expireReorderBuffers();
   void attemptReestablish(Peer* peer);
   void peerMessageReceived(InetAddress source, const PeerToPeerMessage& msg);
   void helloReceived(InetAddress source, const PeerToPeerMessage& msg);
   void helloReplyReceived(InetAddress source, const PeerToPeerMessage& msg);
   void peerDataPacketReceived(InetAddress source, string_view data);
+  void indexedDataPacketReceived(InetAddress source, const PeerToPeerMessage& msg);
+  void migratePeer(Peer* peer, InetAddress source);
+  PeerToPeerMessage makeDataMessage(Peer* peer, string_view data);
   void baseMessageReceivedUdp(const BaseToPeerMessage& msg);
   void baseMessageReceivedTcp(const BaseToPeerMessage& msg);
   void changePeerTargetAddresses(Peer* peer, std::vector<InetAddress> addresses);
@@ -113,7 +180,6 @@ class NgSocket : public LowerLayer {
   void removeSourceAddress(Peer* peer, InetAddress address);
   void addSourceAddress(Peer* peer, InetAddress source);
   Peer* findPeerBySourceAddress(InetAddress address);
-  std::vector<Peer*> iteratePeers();
   BaseToPeerMessage parseBaseToPeerMessage(string_view data);
   PeerToPeerMessage parsePeerToPeerMessage(string_view data);
   std::string serializePeerToPeerMessage(const PeerToPeerMessage& msg);
@@ -123,14 +189,30 @@ class NgSocket : public LowerLayer {
   void connectToBase();
   void sendToBaseUdp(const PeerToBaseMessage& msg);
   void sendToBaseTcp(const PeerToBaseMessage& msg);
-  void sendToPeer(InetAddress dest, const PeerToPeerMessage& msg);
+  void sendToPeer(InetAddress dest, const PeerToPeerMessage& msg, bool dontFragment = false, int fd = -1);
+  void sendRelayed(HusarnetAddress peerAddress, string_view data);
+  bool canRelay();
 
  public:
-  NgSocket(Identity* myIdentity, PeerContainer* peerContainer, ConfigManager* configManager);
+  NgSocket(Identity* myIdentity, PeerContainer* peerContainer, ConfigManager* configManager, PeerFlags* myFlags);
 
   virtual void onUpperLayerData(HusarnetAddress peerAddress, string_view data);
   void periodic();
 
   BaseConnectionType getCurrentBaseConnectionType();
   InetAddress getCurrentBaseAddress();
+  // Write queue of the current base TCP connection
+  size_t getBaseTcpQueuedBytes();
+  uint64_t getBaseTcpDroppedWrites();
+  // Datagrams received through AF_XDP instead of the socket
+  uint64_t getXdpReceivedPackets();
+  // Hello rounds that weren't needed thanks to the data traffic
+  uint64_t getSkippedKeepalives();
+
+  // Thread safe
+  nlohmann::json getRelayConfig();
+  bool setRelayConfig(const nlohmann::json& json, std::string& error);
+  nlohmann::json getRelayStats();
+  nlohmann::json getPeerPaths(Peer* peer);
+  nlohmann::json getPeerCandidatePaths(Peer* peer);
 };
@@ -70,7 +70,8 @@ struct PeerToBaseMessage {
   std::string userAgent;
 };
 
-BETTER_ENUM(PeerToPeerMessageKind, uint8_t, HELLO, HELLO_REPLY, DATA, INVALID)
+// New kinds go after INVALID, the values are hardcoded in the protocol
+BETTER_ENUM(PeerToPeerMessageKind, uint8_t, HELLO, HELLO_REPLY, DATA, INVALID, MULTIPATH_DATA, INDEXED_DATA)
 
 struct PeerToPeerMessage {
   PeerToPeerMessageKind kind;
@@ -82,4 +83,10 @@ struct PeerToPeerMessage {
 
   // data message
   string_view data;
+
+  // multipath data message
+  uint32_t seq = 0;
+
+  // indexed data message - the receiver's session index
+  uint32_t sessionIndex = 0;
 };
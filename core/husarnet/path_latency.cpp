@@ -0,0 +1,34 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/path_latency.h"
+
+#include <cmath>
+
+void PathLatency::addSample(double rtt, Time now)
+{
+  if(this->samples == 0) {
+    this->srtt = rtt;
+    this->jitter = rtt / 2;
+  } else {
+    this->jitter += (std::abs(this->srtt - rtt) - this->jitter) / 4;
+    this->srtt += (rtt - this->srtt) / 8;
+  }
+
+  this->samples++;
+  this->lastSample = now;
+}
+
+bool isBetterPath(const PathLatency& candidate, const PathLatency& current, Time now, Time maxAge)
+{
+  if(candidate.samples < PATH_SWITCH_MIN_SAMPLES || now - candidate.lastSample > maxAge) {
+    return false;
+  }
+
+  // The current target went quiet, leave it to the reestablishment
+  if(current.samples == 0 || now - current.lastSample > maxAge) {
+    return false;
+  }
+
+  return candidate.srtt < current.srtt * PATH_SWITCH_RATIO && current.srtt - candidate.srtt > PATH_SWITCH_MARGIN;
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include "husarnet/ports/port_interface.h"
+
+// Candidate has to be that much faster than the current target address (both
+// relatively and in ms) and measured that many times before it takes over, so
+// the target doesn't flap between two similar paths
+const double PATH_SWITCH_RATIO = 0.8;
+const double PATH_SWITCH_MARGIN = 5;
+const int PATH_SWITCH_MIN_SAMPLES = 3;
+
+// Round trip of a single candidate address of a peer, measured with the hello
+// exchange (in ms, smoothed as in the TCP RTT estimator)
+struct PathLatency {
+  double srtt = 0;
+  double jitter = 0;
+  int samples = 0;
+  Time lastSample = 0;
+  // Reestablish round the last sample comes from, the active address gets
+  // the hello twice
+  Time lastRound = -1;
+
+  void addSample(double rtt, Time now);
+};
+
+// Whether the traffic should move from the current target address to the
+// candidate. Measurements older than maxAge don't count.
+bool isBetterPath(const PathLatency& candidate, const PathLatency& current, Time now, Time maxAge);
@@ -3,11 +3,30 @@
 // License: specified in project_root/LICENSE.txt
 #include "husarnet/peer.h"
 
+#include <algorithm>
+
+#include <sodium.h>
+
+Peer::~Peer()
+{
+  sodium_memzero(kxPrivkey.data(), kxPrivkey.size());
+  sodium_memzero(txKey.data(), txKey.size());
+  sodium_memzero(rxKey.data(), rxKey.size());
+  sodium_memzero(groupRxKey.data(), groupRxKey.size());
+  sodium_memzero(previousGroupRxKey.data(), previousGroupRxKey.size());
+}
+
 bool Peer::isActive()
 {
   return Port::getCurrentTime() - lastPacket < TEARDOWN_TIMEOUT;
 }
 
+// Nothing was sent to nor received from the peer for long enough to forget it
+bool Peer::isIdle()
+{
+  return Port::getCurrentTime() - std::max({created, lastPacket, lastValidPacket}) > PEER_EVICTION_TIMEOUT;
+}
+
 bool Peer::isTunelled()
 {
   if(!targetAddress) {
@@ -50,3 +69,12 @@ InetAddress Peer::getLinkLocalAddress()
 {
   return linkLocalAddress;
 }
+
+int Peer::getPathMtu()
+{
+  // Discovered for the current direct path only
+  if(!connected || targetAddress != pmtuTargetAddress)
+    return 0;
+
+  return pathMtu;
+}
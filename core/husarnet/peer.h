@@ -3,16 +3,37 @@
 // License: specified in project_root/LICENSE.txt
 #pragma once
 #include <list>
+#include <map>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
 #include "husarnet/ports/port_interface.h"
 
+#include "husarnet/fec.h"
+#include "husarnet/header_compression.h"
 #include "husarnet/ipaddress.h"
+#include "husarnet/multipath.h"
+#include "husarnet/path_latency.h"
 #include "husarnet/peer_flags.h"
 
+// Optional fields appended to the hello packet after the flags (as type, length,
+// value). Older versions ignore everything between the flags and the
+// signature. Those values are hardcoded in the protocol.
+enum class HelloExtension : uint8_t
+{
+  compressionDictionary = 1,
+  sessionIndex = 2,
+};
+
+// Path MTU probes are sealed like the control packets, but with their own
+// packet type, so the transport knows not to let them be fragmented
+const char PATH_MTU_PROBE_PACKET_TYPE = 9;
+// Same for the liveness probes, which only make sense on the direct path
+const char LIVENESS_PROBE_PACKET_TYPE = 13;
+
 const int TEARDOWN_TIMEOUT = 120 * 1000;
+const int PEER_EVICTION_TIMEOUT = 10 * 60 * 1000;
 
 class Peer {
  private:
@@ -20,8 +41,16 @@ class Peer {
   friend class NgSocket;
   friend class SecurityLayer;
   friend class CompressionLayer;
+  friend class MulticastLayer;
+  friend class FecLayer;
 
   HusarnetAddress id;
+  // Ours is assigned by PeerContainer, the peer's comes with its hello. Data
+  // packets carry the receiver's one, so they're matched without looking at
+  // the source address.
+  uint32_t sessionIndex = 0;
+  uint32_t remoteSessionIndex = 0;
+  Time created = 0;
   Time lastPacket = 0;
   Time lastReestablish = 0;
 
@@ -35,6 +64,9 @@ class Peer {
   std::vector<InetAddress> targetAddresses;
   InetAddress linkLocalAddress;
   std::unordered_set<InetAddress, iphash> sourceAddresses;
+  // Round trips of the addresses hellos are sent to, guarded by
+  // NgSocket::pathsMutex
+  std::map<InetAddress, PathLatency> pathLatency;
 
   std::vector<std::string> packetQueue;
 
@@ -46,15 +78,83 @@ class Peer {
   fstring<32> txKey;
   fstring<32> rxKey;
 
+  // Multicast keys. groupKeyAcked is the id of our key confirmed by the peer,
+  // groupRxKey(s) are the ones the peer seals its own multicast with.
+  uint32_t groupKeyAcked = 0;
+  Time groupKeySent = 0;
+  uint32_t groupRxKeyId = 0;
+  fstring<32> groupRxKey;
+  uint32_t previousGroupRxKeyId = 0;
+  fstring<32> previousGroupRxKey;
+  // Group packets get a tag under these on top of the group key seal - the
+  // group key is known to all the receivers, so it alone can't tell them
+  // apart from the sender
+  fstring<32> groupAuthTxKey;
+  fstring<32> groupAuthRxKey;
+  Time lastGroupKeyRequest = 0;
+
   Time lastLatencyReceived = 0;
   Time lastLatencySent = 0;
+
+  // Liveness probing of the direct path, while we send to the peer and hear
+  // nothing back. livenessProbingSince is 0 when there is no probing going on.
+  Time lastDataSent = 0;
+  Time livenessProbingSince = 0;
+  Time livenessProbeSent = 0;
+  double livenessRtt = 0;
   Time lastValidPacket = 0;
+  uint64_t validPackets = 0;  // authenticated under the session
+  // Authenticated data that came straight from targetAddress (or over one of
+  // the multipath paths)
+  Time lastTargetData = 0;
+  Time nextKeepalive = 0;
+  int skippedKeepalives = 0;
   fstring<8> heartbeatIdent;
 
   PeerFlags flags;
+  std::map<HelloExtension, std::string> helloExtensions;
+
+  // Path MTU discovery, in terms of the largest tun packet that makes it to
+  // the peer in a single datagram. pathMtu is 0 until it's known, pmtuHigh
+  // is 0 when there is no search in progress.
+  int pathMtu = 0;
+  int pmtuLow = 0;
+  int pmtuHigh = 0;
+  int pmtuProbeSize = 0;
+  int pmtuProbeAttempts = 0;
+  Time pmtuProbeSent = 0;
+  Time pmtuSearchFinished = 0;
+  InetAddress pmtuTargetAddress;
+
+  // connect()ed UDP socket for the direct path, owned by NgSocket. -1 if
+  // there is none for connectedSocketTarget (or it couldn't be opened).
+  int connectedSocket = -1;
+  InetAddress connectedSocketTarget;
+
+  // Adaptive compression - after packets that didn't compress well the next
+  // few are sent as is
+  int compressionBackoff = 0;
+  int compressionSkip = 0;
+
+  // Transport header compression, each direction has its own contexts
+  HeaderCompressor headerCompressor;
+  HeaderDecompressor headerDecompressor;
+
+  // Forward error correction, restarted with every session
+  FecEncoder fecEncoder;
+  FecDecoder fecDecoder;
+
+  // Multipath. Paths are guarded by NgSocket::pathsMutex, the rest is used by
+  // the main loop only.
+  std::vector<MultipathPath> paths;
+  uint32_t multipathSeq = 0;
+  ReorderBuffer reorderBuffer;
 
  public:
+  ~Peer();
+
   bool isActive();
+  bool isIdle();
   bool isReestablishing();
   bool isTunelled();
   bool isSecure();
@@ -72,4 +172,5 @@ class Peer {
   }
   InetAddress getUsedTargetAddress();
   InetAddress getLinkLocalAddress();
+  int getPathMtu();
 };
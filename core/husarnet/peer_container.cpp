@@ -9,8 +9,64 @@
 #include "husarnet/util.h"
 
 PeerContainer::PeerContainer(ConfigManager* configManager, Identity* identity)
-    : configManager(configManager), identity(identity)
+    : configManager(configManager), identity(identity), sessionSlots(PEER_SESSION_SLOTS)
 {
+  for(auto& shard : shards) {
+    shard.peers.store(new PeerMap, std::memory_order_release);
+  }
+
+  for(uint32_t slot = PEER_SESSION_SLOTS; slot > 0; slot--) {
+    freeSessionSlots.push_back(slot - 1);
+  }
+}
+
+// 0 if the slots ran out, the peer is then matched by its address only
+uint32_t PeerContainer::assignSessionIndex(Peer* peer)
+{
+  std::scoped_lock lock(sessionSlotsMutex);
+  if(freeSessionSlots.empty()) {
+    return 0;
+  }
+
+  uint32_t slot = freeSessionSlots.back();
+  freeSessionSlots.pop_back();
+
+  uint32_t generation = 1 + randombytes_uniform(0xFFFF);
+  peer->sessionIndex = (generation << 16) | slot;
+  sessionSlots[slot].store(peer, std::memory_order_release);
+  return peer->sessionIndex;
+}
+
+void PeerContainer::releaseSessionIndex(Peer* peer)
+{
+  if(peer->sessionIndex == 0) {
+    return;
+  }
+
+  std::scoped_lock lock(sessionSlotsMutex);
+  uint32_t slot = peer->sessionIndex & 0xFFFF;
+  sessionSlots[slot].store(nullptr, std::memory_order_release);
+  freeSessionSlots.push_back(slot);
+}
+
+Peer* PeerContainer::getPeerBySessionIndex(uint32_t index)
+{
+  uint32_t slot = index & 0xFFFF;
+  if(index == 0 || slot >= sessionSlots.size()) {
+    return nullptr;
+  }
+
+  Peer* peer = sessionSlots[slot].load(std::memory_order_acquire);
+  if(peer == nullptr || peer->sessionIndex != index) {
+    return nullptr;
+  }
+
+  return peer;
+}
+
+PeerContainer::Shard& PeerContainer::shardFor(const HusarnetAddress& id)
+{
+  return shards[iphash{}(id) % PEER_CONTAINER_SHARDS];
 }
 
 Peer* PeerContainer::createPeer(HusarnetAddress id)
@@ -19,21 +75,38 @@ Peer* PeerContainer::createPeer(HusarnetAddress id)
     HLOG_INFO("peer is not allowed // {peer}", id.toString());
     return nullptr;
   }
+
+  Shard& shard = shardFor(id);
+  std::scoped_lock lock(shard.writeMutex);
+
+  PeerMap* current = shard.peers.load(std::memory_order_acquire);
+
+  // Someone else might have been faster
+  auto it = current->find(id);
+  if(it != current->end()) {
+    return it->second;
+  }
+
   Peer* peer = new Peer;
   // TODO honestly move this to Peer class (either constructor or some static
   // method)
   peer->heartbeatIdent = generateRandomString(8);
   peer->id = id;
+  peer->created = Port::getCurrentTime();
   crypto_kx_keypair(peer->kxPubkey.data(), peer->kxPrivkey.data());
-  peers[id] = peer;
+  assignSessionIndex(peer);
+
+  PeerMap* updated = new PeerMap(*current);
+  (*updated)[id] = peer;
+  shard.peers.store(updated, std::memory_order_release);
+  Epoch::retire(current);
+
+  peersCreated++;
   return peer;
 }
 
 Peer* PeerContainer::getPeer(HusarnetAddress id)
 {
-  if(cachedPeerId == id)
-    return cachedPeer;
-
   // Prevent self-connection (i.e. in case of multicast issue)
   if(id == identity->getDeviceId())
     return nullptr;
@@ -43,12 +116,11 @@ Peer* PeerContainer::getPeer(HusarnetAddress id)
     return nullptr;
   }
 
-  auto it = peers.find(id);
-  if(it == peers.end())
+  const PeerMap* peers = shardFor(id).peers.load(std::memory_order_acquire);
+  auto it = peers->find(id);
+  if(it == peers->end())
     return nullptr;
 
-  cachedPeerId = id;
-  cachedPeer = it->second;
   return it->second;
 }
 
@@ -61,7 +133,46 @@ Peer* PeerContainer::getOrCreatePeer(HusarnetAddress id)
   return peer;
 }
 
-std::unordered_map<HusarnetAddress, Peer*, iphash> PeerContainer::getPeers()
+bool PeerContainer::evictPeer(HusarnetAddress id)
+{
+  Shard& shard = shardFor(id);
+  std::scoped_lock lock(shard.writeMutex);
+
+  PeerMap* current = shard.peers.load(std::memory_order_acquire);
+  auto it = current->find(id);
+  if(it == current->end()) {
+    return false;
+  }
+
+  Peer* peer = it->second;
+  releaseSessionIndex(peer);
+
+  PeerMap* updated = new PeerMap(*current);
+  updated->erase(id);
+  shard.peers.store(updated, std::memory_order_release);
+  Epoch::retire(current);
+  Epoch::retire(peer);
+
+  peersEvicted++;
+  HLOG_INFO("peer evicted // {peer}", id.toString());
+  return true;
+}
+
+size_t PeerContainer::size()
+{
+  size_t count = 0;
+  for(auto& shard : shards) {
+    count += shard.peers.load(std::memory_order_acquire)->size();
+  }
+  return count;
+}
+
+uint64_t PeerContainer::getPeersCreated()
+{
+  return peersCreated;
+}
+
+uint64_t PeerContainer::getPeersEvicted()
 {
-  return peers;
+  return peersEvicted;
 }
@@ -2,23 +2,64 @@
 // Authors: listed in project_root/README.md
 // License: specified in project_root/LICENSE.txt
 #pragma once
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "husarnet/config_manager.h"
+#include "husarnet/epoch.h"
 #include "husarnet/identity.h"
 #include "husarnet/ipaddress.h"
 #include "husarnet/peer.h"
 
+#ifndef PEER_CONTAINER_SHARDS
+#ifdef ESP_PLATFORM
+#define PEER_CONTAINER_SHARDS 4
+#else
+#define PEER_CONTAINER_SHARDS 16
+#endif
+#endif
+
+// Session index is <generation:16> <slot:16>, the random generation keeps a
+// stale index from matching the next peer that gets the slot
+#ifdef ESP_PLATFORM
+const uint32_t PEER_SESSION_SLOTS = 64;
+#else
+const uint32_t PEER_SESSION_SLOTS = 4096;
+#endif
+
+// Peers are split into shards by their address. Every shard publishes an
+// immutable map through an atomic pointer - readers never lock, writers
+// serialize on the shard mutex, copy the map, swap the pointer and retire the
+// previous version through Epoch. Pointers returned from the lookups (and the
+// peers themselves) are only valid inside an EpochGuard.
 class PeerContainer {
  private:
+  using PeerMap = std::unordered_map<HusarnetAddress, Peer*, iphash>;
+
+  struct alignas(64) Shard {
+    std::mutex writeMutex;
+    std::atomic<PeerMap*> peers{nullptr};
+  };
+
   ConfigManager* configManager;
   Identity* identity;
 
-  std::unordered_map<HusarnetAddress, Peer*, iphash> peers;
+  Shard shards[PEER_CONTAINER_SHARDS];
 
-  // TODO figure out whether this caching is still beneficial
-  Peer* cachedPeer = nullptr;
-  HusarnetAddress cachedPeerId;
+  // Lookups are lock free like the ones of the shards, slots are handed out
+  // and returned under the mutex
+  std::vector<std::atomic<Peer*>> sessionSlots;
+  std::mutex sessionSlotsMutex;
+  std::vector<uint32_t> freeSessionSlots;
+
+  std::atomic<uint64_t> peersCreated{0};
+  std::atomic<uint64_t> peersEvicted{0};
+
+  Shard& shardFor(const HusarnetAddress& id);
+  uint32_t assignSessionIndex(Peer* peer);
+  void releaseSessionIndex(Peer* peer);
 
  public:
   PeerContainer(ConfigManager* configManager, Identity* identity);
@@ -26,7 +67,28 @@ class PeerContainer {
   Peer* createPeer(HusarnetAddress id);
   Peer* getPeer(HusarnetAddress id);
   Peer* getOrCreatePeer(HusarnetAddress id);
+  // nullptr if the index is unknown or stale
+  Peer* getPeerBySessionIndex(uint32_t index);
+
+  // Unlinks the peer from the table. The object itself (together with its
+  // keys) is destroyed once no reader can reference it anymore.
+  bool evictPeer(HusarnetAddress id);
+
+  // Visits every peer without copying the table. Peers inserted or removed
+  // concurrently may or may not be visited.
+  template <typename F>
+  void forEachPeer(F&& callback)
+  {
+    EpochGuard guard;
+    for(auto& shard : shards) {
+      const PeerMap* peers = shard.peers.load(std::memory_order_acquire);
+      for(auto& [id, peer] : *peers) {
+        callback(peer);
+      }
+    }
+  }
 
-  std::unordered_map<HusarnetAddress, Peer*, iphash> getPeers();  // TODO change to ETL container // TODO see how it's
-                                                                  // used and optimize the shape
+  size_t size();
+  uint64_t getPeersCreated();
+  uint64_t getPeersEvicted();
 };
@@ -28,7 +28,7 @@ void PeerFlags::setFlag(PeerFlag flag)
 
 bool PeerFlags::checkFlag(PeerFlag flag)
 {
-  return flags && flag._value;
+  return (flags & flag._value) != 0;
 }
 
 uint64_t PeerFlags::asBin()
@@ -10,7 +10,7 @@
 // Those values are actually hardcoded in the protocol. Do *not* change the
 // existing ones! Also - those are meant to be binary flags, so use values like
 // 1, 2, 4, 8,…
-BETTER_ENUM(PeerFlag, int, supportsFlags = 1, compression = 2)
+BETTER_ENUM(PeerFlag, int, supportsFlags = 1, compression = 2, groupKeys = 4, headerCompression = 8, coalescing = 16, pathMtuDiscovery = 32, fec = 64, multipath = 128, livenessProbes = 256, compressionFraming = 512)
 
 class PeerFlags {
  private:
@@ -58,6 +58,8 @@ static const etl::map<StorageKey, std::string, STORAGE_KEY_OPTIONS> storageMap =
     etl::pair{StorageKey::config, std::string("config.json")},
     etl::pair{StorageKey::daemonApiToken, std::string("daemon_api_token")},
     etl::pair{StorageKey::cache, std::string("cache.json")},
+    etl::pair{StorageKey::schedulerConfig, std::string("scheduler.json")},
+    etl::pair{StorageKey::relayConfig, std::string("relay.json")},
 };
 
 std::unique_ptr<nvs::NVSHandle> nvsHandle;
@@ -315,8 +317,9 @@ namespace Port {
   }
 
   // On the ESP32 platform network interface name is always "hn0"
-  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName)
+  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName, int mtu)
   {
+    (void)mtu;  // lwIP netif MTU is fixed in Tun
     ip6_addr_t ip;
     memcpy(ip.addr, myAddress.data.data(), 16);
 
@@ -299,6 +299,8 @@ void Tun::processQueuedPackets()
 
     pbuf_free(p);
   }
+
+  flushLowerLayer();
 }
 
 ip6_addr_t Tun::getIp6Addr()
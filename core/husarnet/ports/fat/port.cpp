@@ -212,6 +212,16 @@ namespace Port {
       etl::pair{std::string("HUSARNET_DAEMON_API_HOST"), EnvKey::daemonApiHost},
       etl::pair{std::string("HUSARNET_DAEMON_API_PORT"), EnvKey::daemonApiPort},
       etl::pair{std::string("HUSARNET_DAEMON_WORKER_QUEUE_SIZE"), EnvKey::daemonWorkerQueueSize},
+      etl::pair{std::string("HUSARNET_MULTICAST_RATE_LIMITS"), EnvKey::multicastRateLimits},
+      etl::pair{std::string("HUSARNET_ENABLE_COMPRESSION"), EnvKey::enableCompression},
+      etl::pair{std::string("HUSARNET_COMPRESSION_LEVEL"), EnvKey::compressionLevel},
+      etl::pair{std::string("HUSARNET_TUN_MTU"), EnvKey::tunMtu},
+      etl::pair{std::string("HUSARNET_UDP_BUFFER_SIZE"), EnvKey::udpBufferSize},
+      etl::pair{std::string("HUSARNET_ENABLE_CONNECTED_SOCKETS"), EnvKey::enableConnectedSockets},
+      etl::pair{std::string("HUSARNET_XDP_INTERFACE"), EnvKey::xdpInterface},
+      etl::pair{std::string("HUSARNET_ENABLE_FEC"), EnvKey::enableFec},
+      etl::pair{std::string("HUSARNET_MULTIPATH"), EnvKey::multipath},
+      etl::pair{std::string("HUSARNET_LIVENESS_INTERVAL"), EnvKey::livenessInterval},
   };
 
   static const etl::map<StorageKey, std::string, STORAGE_KEY_OPTIONS> storageMap = {
@@ -220,6 +230,9 @@ namespace Port {
       etl::pair{StorageKey::daemonApiToken, std::string("daemon_api_token")},
       etl::pair{StorageKey::cache, std::string("cache.json")},
       etl::pair{StorageKey::defaults, std::string("defaults.ini")},
+      etl::pair{StorageKey::compressionDictionary, std::string("compression.dict")},
+      etl::pair{StorageKey::schedulerConfig, std::string("scheduler.json")},
+      etl::pair{StorageKey::relayConfig, std::string("relay.json")},
   };
 
   __attribute__((weak)) etl::map<EnvKey, std::string, ENV_KEY_OPTIONS> getEnvironmentDefaultsFromIniFile()
@@ -302,7 +302,7 @@ namespace Port {
     return ret;
   }
 
-  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName)
+  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName, int mtu)
   {
     struct nl_sock* ns;
     struct rtnl_link* link;
@@ -378,7 +378,7 @@ namespace Port {
     struct rtnl_link* change = rtnl_link_alloc();
 
     // Set MTU
-    rtnl_link_set_mtu(change, 1350);
+    rtnl_link_set_mtu(change, mtu);
 
     // Set interface state to up
     rtnl_link_set_flags(change, IFF_UP);
@@ -58,19 +58,23 @@ bool Tun::isRunning()
 
 void Tun::onTunData()
 {
-  long size = read(fd, &tunBuffer[0], tunBuffer.size());
-
-  if(size <= 0) {
-    if(errno == EAGAIN) {
-      return;
-    } else {
-      fd = -1;
-      return;
+  // Drain whatever is queued (up to a limit, to not starve the other sockets)
+  // so the lower layers can batch it
+  for(int i = 0; i < TUN_READ_BATCH; i++) {
+    long size = read(fd, &tunBuffer[0], tunBuffer.size());
+
+    if(size <= 0) {
+      if(errno != EAGAIN && errno != EWOULDBLOCK) {
+        fd = -1;
+      }
+      break;
     }
+
+    string_view packet = string_view(tunBuffer).substr(0, size);
+    sendToLowerLayer(IpAddress{}, packet);
   }
 
-  string_view packet = string_view(tunBuffer).substr(0, size);
-  sendToLowerLayer(IpAddress{}, packet);
+  flushLowerLayer();
 }
 
 Tun::Tun(std::string name, bool isTap)
@@ -78,6 +82,7 @@ Tun::Tun(std::string name, bool isTap)
   tunBuffer.resize(4096);
 
   fd = openTun(name, isTap);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
   OsSocket::bindCustomFd(fd, std::bind(&Tun::onTunData, this));
 }
 
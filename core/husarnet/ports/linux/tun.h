@@ -9,6 +9,8 @@
 #include "husarnet/ngsocket.h"
 #include "husarnet/string_view.h"
 
+const int TUN_READ_BATCH = 32;
+
 class Tun : public UpperLayer {
  private:
   int fd;
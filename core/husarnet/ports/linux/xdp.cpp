@@ -0,0 +1,511 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/ports/linux/xdp.h"
+
+#include <vector>
+
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "husarnet/ipaddress.h"
+#include "husarnet/logging.h"
+
+const int ETHERNET_HEADER_SIZE = 14;
+const int IPV4_HEADER_SIZE = 20;
+const int IPV6_HEADER_SIZE = 40;
+const int UDP_HEADER_SIZE = 8;
+
+static int bpf(int cmd, union bpf_attr* attr)
+{
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static uint16_t read16(const char* data)
+{
+  return ((uint8_t)data[0] << 8) | (uint8_t)data[1];
+}
+
+// Minimal assembler for the redirect program, so there is no dependency on
+// libbpf or a BPF compiler
+class BpfProgram {
+ public:
+  enum Label
+  {
+    ipv6,
+    redirect,
+    pass,
+    labelCount
+  };
+
+ private:
+  std::vector<bpf_insn> instructions;
+  std::vector<std::pair<size_t, Label>> jumps;
+  int labels[labelCount] = {};
+
+  void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+  {
+    bpf_insn insn = {};
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    instructions.push_back(insn);
+  }
+
+ public:
+  void label(Label label)
+  {
+    labels[label] = instructions.size();
+  }
+
+  void movReg(uint8_t dst, uint8_t src)
+  {
+    emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0);
+  }
+
+  void movImm(uint8_t dst, int32_t imm)
+  {
+    emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm);
+  }
+
+  void addImm(uint8_t dst, int32_t imm)
+  {
+    emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm);
+  }
+
+  void andImm(uint8_t dst, int32_t imm)
+  {
+    emit(BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm);
+  }
+
+  // Converts a 16 bit field loaded from the packet to host order
+  void be16(uint8_t dst)
+  {
+    emit(BPF_ALU | BPF_END | BPF_TO_BE, dst, 0, 0, 16);
+  }
+
+  void load(uint8_t size, uint8_t dst, uint8_t src, int16_t off)
+  {
+    emit(BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+  }
+
+  void loadMapFd(uint8_t dst, int fd)
+  {
+    emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+    emit(0, 0, 0, 0, 0);
+  }
+
+  void jumpIfGreater(uint8_t dst, uint8_t src, Label target)
+  {
+    jumps.emplace_back(instructions.size(), target);
+    emit(BPF_JMP | BPF_JGT | BPF_X, dst, src, 0, 0);
+  }
+
+  void jumpIfNotEqual(uint8_t dst, int32_t imm, Label target)
+  {
+    jumps.emplace_back(instructions.size(), target);
+    emit(BPF_JMP | BPF_JNE | BPF_K, dst, 0, 0, imm);
+  }
+
+  void jump(Label target)
+  {
+    jumps.emplace_back(instructions.size(), target);
+    emit(BPF_JMP | BPF_JA, 0, 0, 0, 0);
+  }
+
+  void call(int32_t helper)
+  {
+    emit(BPF_JMP | BPF_CALL, 0, 0, 0, helper);
+  }
+
+  void exit()
+  {
+    emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+  }
+
+  const std::vector<bpf_insn>& finish()
+  {
+    for(auto [index, target] : jumps) {
+      instructions[index].off = labels[target] - index - 1;
+    }
+    jumps.clear();
+    return instructions;
+  }
+};
+
+XdpSocket::XdpSocket(int ifindex, int port, OsSocket::PacketCallback callback)
+    : ifindex(ifindex), port(port), callback(callback)
+{
+}
+
+XdpSocket::~XdpSocket()
+{
+  close();
+
+  for(int fd : {linkFd, programFd, mapFd}) {
+    if(fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+XdpSocket* XdpSocket::open(const std::string& interfaceName, int port, OsSocket::PacketCallback callback)
+{
+  int ifindex = if_nametoindex(interfaceName.c_str());
+  if(ifindex == 0) {
+    HLOG_ERROR("XDP interface not found // {interface}", interfaceName);
+    return nullptr;
+  }
+
+  auto xdp = new XdpSocket(ifindex, port, callback);
+  if(!xdp->createMap() || !xdp->loadProgram()) {
+    delete xdp;
+    return nullptr;
+  }
+
+  // Generic mode works on any interface (veth included), but native one is
+  // the point on the real NICs
+  bool native = xdp->attachProgram(XDP_FLAGS_DRV_MODE);
+  if(!native && !xdp->attachProgram(XDP_FLAGS_SKB_MODE)) {
+    delete xdp;
+    return nullptr;
+  }
+
+  if(!(native && xdp->createSocket(true)) && !xdp->createSocket(false)) {
+    delete xdp;
+    return nullptr;
+  }
+
+  HLOG_INFO("XDP receive path enabled // {interface} {port} {native}", interfaceName, port, native);
+  return xdp;
+}
+
+bool XdpSocket::createMap()
+{
+  union bpf_attr attr = {};
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = XDP_MAX_QUEUES;
+  strncpy(attr.map_name, "husarnet_xsks", sizeof(attr.map_name) - 1);
+
+  mapFd = bpf(BPF_MAP_CREATE, &attr);
+  if(mapFd < 0) {
+    HLOG_ERROR("unable to create the XSK map // {error}", strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+// Redirects UDP datagrams addressed to the port into the XSK bound to the
+// receive queue. Fragments, IPv4 options and IPv6 extension headers are left
+// to the kernel, so are the queues without a socket (the XDP_PASS fallback of
+// bpf_redirect_map).
+bool XdpSocket::loadProgram()
+{
+  const uint8_t context = BPF_REG_6;
+  const uint8_t data = BPF_REG_2;
+  const uint8_t dataEnd = BPF_REG_3;
+  const uint8_t end = BPF_REG_4;
+  const uint8_t value = BPF_REG_5;
+
+  const int ipOffset = ETHERNET_HEADER_SIZE;
+  const int ipv4UdpOffset = ipOffset + IPV4_HEADER_SIZE;
+  const int ipv6UdpOffset = ipOffset + IPV6_HEADER_SIZE;
+
+  BpfProgram program;
+  program.movReg(context, BPF_REG_1);
+  program.load(BPF_W, data, BPF_REG_1, offsetof(xdp_md, data));
+  program.load(BPF_W, dataEnd, BPF_REG_1, offsetof(xdp_md, data_end));
+  program.movReg(end, data);
+  program.addImm(end, ETHERNET_HEADER_SIZE);
+  program.jumpIfGreater(end, dataEnd, BpfProgram::pass);
+  program.load(BPF_H, value, data, 12);  // ethertype
+  program.be16(value);
+  program.jumpIfNotEqual(value, 0x0800, BpfProgram::ipv6);
+
+  program.movReg(end, data);
+  program.addImm(end, ipv4UdpOffset + UDP_HEADER_SIZE);
+  program.jumpIfGreater(end, dataEnd, BpfProgram::pass);
+  program.load(BPF_B, value, data, ipOffset);  // version and IHL
+  program.jumpIfNotEqual(value, 0x45, BpfProgram::pass);
+  program.load(BPF_B, value, data, ipOffset + 9);  // protocol
+  program.jumpIfNotEqual(value, IPPROTO_UDP, BpfProgram::pass);
+  program.load(BPF_H, value, data, ipOffset + 6);  // flags and fragment offset
+  program.be16(value);
+  program.andImm(value, 0x3FFF);  // more fragments or non-zero offset
+  program.jumpIfNotEqual(value, 0, BpfProgram::pass);
+  program.load(BPF_H, value, data, ipv4UdpOffset + 2);  // destination port
+  program.be16(value);
+  program.jumpIfNotEqual(value, port, BpfProgram::pass);
+  program.jump(BpfProgram::redirect);
+
+  program.label(BpfProgram::ipv6);
+  program.jumpIfNotEqual(value, 0x86DD, BpfProgram::pass);
+  program.movReg(end, data);
+  program.addImm(end, ipv6UdpOffset + UDP_HEADER_SIZE);
+  program.jumpIfGreater(end, dataEnd, BpfProgram::pass);
+  program.load(BPF_B, value, data, ipOffset + 6);  // next header
+  program.jumpIfNotEqual(value, IPPROTO_UDP, BpfProgram::pass);
+  program.load(BPF_H, value, data, ipv6UdpOffset + 2);  // destination port
+  program.be16(value);
+  program.jumpIfNotEqual(value, port, BpfProgram::pass);
+
+  program.label(BpfProgram::redirect);
+  program.load(BPF_W, BPF_REG_2, context, offsetof(xdp_md, rx_queue_index));
+  program.loadMapFd(BPF_REG_1, mapFd);
+  program.movImm(BPF_REG_3, XDP_PASS);
+  program.call(BPF_FUNC_redirect_map);
+  program.exit();
+
+  program.label(BpfProgram::pass);
+  program.movImm(BPF_REG_0, XDP_PASS);
+  program.exit();
+
+  const auto& instructions = program.finish();
+  const char* license = "GPL";
+
+  union bpf_attr attr = {};
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uint64_t)(uintptr_t)instructions.data();
+  attr.insn_cnt = instructions.size();
+  attr.license = (uint64_t)(uintptr_t)license;
+  strncpy(attr.prog_name, "husarnet_xdp", sizeof(attr.prog_name) - 1);
+
+  programFd = bpf(BPF_PROG_LOAD, &attr);
+  if(programFd < 0) {
+    HLOG_ERROR("unable to load the XDP program // {error}", strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+// The program is attached through a BPF link, so it's detached by the kernel
+// as soon as the process exits (even if it crashes)
+bool XdpSocket::attachProgram(uint32_t mode)
+{
+  union bpf_attr attr = {};
+  attr.link_create.prog_fd = programFd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = mode;
+
+  linkFd = bpf(BPF_LINK_CREATE, &attr);
+  if(linkFd < 0) {
+    HLOG_DEBUG("unable to attach the XDP program // {mode} {error}", mode, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+bool XdpSocket::mapRing(
+    Ring& ring,
+    uint32_t producer,
+    uint32_t consumer,
+    uint32_t descriptors,
+    size_t descriptorSize,
+    off_t pgoff)
+{
+  ring.mapSize = descriptors + XDP_RING_SIZE * descriptorSize;
+  ring.map = mmap(nullptr, ring.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xskFd, pgoff);
+  if(ring.map == MAP_FAILED) {
+    ring.map = nullptr;
+    return false;
+  }
+
+  char* base = (char*)ring.map;
+  ring.producer = (uint32_t*)(base + producer);
+  ring.consumer = (uint32_t*)(base + consumer);
+  ring.descriptors = base + descriptors;
+  return true;
+}
+
+bool XdpSocket::createSocket(bool zeroCopy)
+{
+  close();  // leftovers of the zero-copy attempt, keeps the program
+
+  // Zero-copy is only an attempt, copy mode is tried right after it
+  auto fail = [this, zeroCopy](const char* step) {
+    if(zeroCopy) {
+      HLOG_DEBUG("zero-copy XSK socket not available // {step} {error}", step, strerror(errno));
+    } else {
+      HLOG_ERROR("unable to set up the XSK socket // {step} {error}", step, strerror(errno));
+    }
+    close();
+    return false;
+  };
+
+  xskFd = socket(AF_XDP, SOCK_RAW, 0);
+  if(xskFd < 0) {
+    return fail("socket");
+  }
+
+  size_t umemSize = (size_t)XDP_FRAME_SIZE * XDP_FRAME_COUNT;
+  void* umemMap = mmap(nullptr, umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(umemMap == MAP_FAILED) {
+    return fail("umem");
+  }
+  umem = (char*)umemMap;
+
+  xdp_umem_reg umemReg = {};
+  umemReg.addr = (uint64_t)(uintptr_t)umem;
+  umemReg.len = umemSize;
+  umemReg.chunk_size = XDP_FRAME_SIZE;
+  if(setsockopt(xskFd, SOL_XDP, XDP_UMEM_REG, &umemReg, sizeof(umemReg)) < 0) {
+    return fail("umem register");
+  }
+
+  // Completion ring is never used, but the kernel won't bind without one
+  int ringSize = XDP_RING_SIZE;
+  if(setsockopt(xskFd, SOL_XDP, XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize)) < 0 ||
+     setsockopt(xskFd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ringSize, sizeof(ringSize)) < 0 ||
+     setsockopt(xskFd, SOL_XDP, XDP_RX_RING, &ringSize, sizeof(ringSize)) < 0) {
+    return fail("rings");
+  }
+
+  xdp_mmap_offsets offsets = {};
+  socklen_t offsetsSize = sizeof(offsets);
+  if(getsockopt(xskFd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsetsSize) < 0) {
+    return fail("ring offsets");
+  }
+
+  if(!mapRing(
+         fillRing, offsets.fr.producer, offsets.fr.consumer, offsets.fr.desc, sizeof(uint64_t),
+         XDP_UMEM_PGOFF_FILL_RING) ||
+     !mapRing(
+         rxRing, offsets.rx.producer, offsets.rx.consumer, offsets.rx.desc, sizeof(xdp_desc), XDP_PGOFF_RX_RING)) {
+    return fail("ring mmap");
+  }
+
+  // All the frames are handed to the kernel upfront
+  auto fillDescriptors = (uint64_t*)fillRing.descriptors;
+  for(uint32_t i = 0; i < XDP_FRAME_COUNT; i++) {
+    fillDescriptors[i] = (uint64_t)i * XDP_FRAME_SIZE;
+  }
+  __atomic_store_n(fillRing.producer, XDP_FRAME_COUNT, __ATOMIC_RELEASE);
+
+  sockaddr_xdp address = {};
+  address.sxdp_family = AF_XDP;
+  address.sxdp_ifindex = ifindex;
+  address.sxdp_queue_id = 0;
+  address.sxdp_flags = zeroCopy ? XDP_ZEROCOPY : XDP_COPY;
+  if(bind(xskFd, (sockaddr*)&address, sizeof(address)) < 0) {
+    return fail("bind");
+  }
+
+  uint32_t queue = 0;
+  union bpf_attr attr = {};
+  attr.map_fd = mapFd;
+  attr.key = (uint64_t)(uintptr_t)&queue;
+  attr.value = (uint64_t)(uintptr_t)&xskFd;
+  if(bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+    return fail("map update");
+  }
+
+  OsSocket::bindCustomFd(xskFd, [this]() { processRx(); });
+  return true;
+}
+
+// Releases the socket and its rings, the program and the map go with the
+// destructor
+void XdpSocket::close()
+{
+  for(Ring* ring : {&fillRing, &rxRing}) {
+    if(ring->map != nullptr) {
+      munmap(ring->map, ring->mapSize);
+    }
+    *ring = Ring{};
+  }
+
+  if(xskFd >= 0) {
+    ::close(xskFd);
+    xskFd = -1;
+  }
+
+  if(umem != nullptr) {
+    munmap(umem, (size_t)XDP_FRAME_SIZE * XDP_FRAME_COUNT);
+    umem = nullptr;
+  }
+}
+
+// Headers were already matched by the program (which may skip queues
+// without a socket, but never lets anything else in), only the lengths are
+// checked again. Checksums are not verified: the payload is authenticated
+// anyway, and frames coming from a local veth peer carry partial ones.
+void XdpSocket::handleFrame(const char* frame, uint32_t size)
+{
+  if(size < ETHERNET_HEADER_SIZE) {
+    return;
+  }
+
+  uint16_t ethertype = read16(frame + 12);
+  const char* ip = frame + ETHERNET_HEADER_SIZE;
+  size -= ETHERNET_HEADER_SIZE;
+
+  IpAddress source;
+  const char* udp;
+  if(ethertype == 0x0800 && size >= IPV4_HEADER_SIZE + UDP_HEADER_SIZE) {
+    source = IpAddress::fromBinary4(ip + 12);
+    udp = ip + IPV4_HEADER_SIZE;
+    size -= IPV4_HEADER_SIZE;
+  } else if(ethertype == 0x86DD && size >= IPV6_HEADER_SIZE + UDP_HEADER_SIZE) {
+    source = IpAddress::fromBinary(ip + 8);
+    udp = ip + IPV6_HEADER_SIZE;
+    size -= IPV6_HEADER_SIZE;
+  } else {
+    return;
+  }
+
+  // Frames may be padded, the UDP length is the authoritative one
+  uint16_t udpLength = read16(udp + 4);
+  if(udpLength < UDP_HEADER_SIZE || udpLength > size) {
+    return;
+  }
+
+  receivedPackets++;
+  callback(
+      InetAddress{source, read16(udp)},
+      string_view(udp + UDP_HEADER_SIZE, udpLength - UDP_HEADER_SIZE));
+}
+
+void XdpSocket::processRx()
+{
+  uint32_t consumer = *rxRing.consumer;
+  uint32_t producer = __atomic_load_n(rxRing.producer, __ATOMIC_ACQUIRE);
+  uint32_t fillProducer = *fillRing.producer;
+
+  auto rxDescriptors = (xdp_desc*)rxRing.descriptors;
+  auto fillDescriptors = (uint64_t*)fillRing.descriptors;
+  const uint32_t mask = XDP_RING_SIZE - 1;
+
+  // Every frame is returned to the fill ring as soon as the callback is done
+  // with it, so the fill ring can't overflow
+  for(; consumer != producer; consumer++) {
+    const auto& descriptor = rxDescriptors[consumer & mask];
+    handleFrame(umem + descriptor.addr, descriptor.len);
+    fillDescriptors[fillProducer & mask] = descriptor.addr - descriptor.addr % XDP_FRAME_SIZE;
+    fillProducer++;
+  }
+
+  __atomic_store_n(rxRing.consumer, consumer, __ATOMIC_RELEASE);
+  __atomic_store_n(fillRing.producer, fillProducer, __ATOMIC_RELEASE);
+}
+
+uint64_t XdpSocket::getReceivedPackets() const
+{
+  return this->receivedPackets;
+}
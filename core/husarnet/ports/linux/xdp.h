@@ -0,0 +1,76 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <atomic>
+#include <string>
+
+#include <linux/if_xdp.h>
+#include <stdint.h>
+
+#include "husarnet/ports/sockets.h"
+
+// UMEM is split into frames of this size, the whole of it stays in the fill
+// ring or in flight (nothing is transmitted through it)
+const uint32_t XDP_FRAME_SIZE = 4096;
+const uint32_t XDP_FRAME_COUNT = 2048;
+const uint32_t XDP_RING_SIZE = XDP_FRAME_COUNT;
+// XSKMAP is indexed by the receive queue, only queue 0 has a socket bound
+const uint32_t XDP_MAX_QUEUES = 64;
+
+// AF_XDP receive path of a single UDP port. An XDP program attached to the
+// interface redirects IPv4/IPv6 UDP datagrams addressed to the port (on
+// queue 0) into an XSK socket, everything else continues through the kernel
+// stack. Datagrams are handed to the callback as views into the UMEM, so
+// they have to be consumed before it returns - like with the regular
+// sockets.
+// Only receiving is offloaded, replies are sent through the regular socket
+// bound to the same port.
+class XdpSocket {
+ private:
+  struct Ring {
+    uint32_t* producer = nullptr;
+    uint32_t* consumer = nullptr;
+    void* descriptors = nullptr;
+    void* map = nullptr;
+    size_t mapSize = 0;
+  };
+
+  int ifindex;
+  int port;
+  OsSocket::PacketCallback callback;
+
+  int mapFd = -1;
+  int programFd = -1;
+  int linkFd = -1;
+  int xskFd = -1;
+
+  char* umem = nullptr;
+  Ring fillRing;
+  Ring rxRing;
+
+  std::atomic<uint64_t> receivedPackets{0};
+
+  XdpSocket(int ifindex, int port, OsSocket::PacketCallback callback);
+
+  bool createMap();
+  bool loadProgram();
+  bool attachProgram(uint32_t mode);
+  bool createSocket(bool zeroCopy);
+  bool mapRing(Ring& ring, uint32_t producer, uint32_t consumer, uint32_t descriptors, size_t descriptorSize, off_t pgoff);
+  void close();
+
+  void handleFrame(const char* frame, uint32_t size);
+
+ public:
+  ~XdpSocket();
+
+  // Returns nullptr (after logging why) if AF_XDP can't be used on the
+  // interface, the port keeps being served by the regular socket then
+  static XdpSocket* open(const std::string& interfaceName, int port, OsSocket::PacketCallback callback);
+
+  // Drains the RX ring, called when the XSK fd is readable
+  void processRx();
+
+  uint64_t getReceivedPackets() const;
+};
@@ -129,7 +129,7 @@ namespace Port {
     return ret;
   }
 
-  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName)
+  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName, int mtu)
   {
     (void)interfaceName;  // ignore Linux-centric hnet0, setup utunX
 
@@ -143,6 +143,7 @@ namespace Port {
     }
 
     system(("ifconfig " + utunName + " inet6 " + myAddress.toString()).c_str());
+    system(("ifconfig " + utunName + " mtu " + std::to_string(mtu)).c_str());
     system(("route -nv add -inet6 fc94::/16 -interface " + utunName).c_str());
     // TODO multicast, right?
 
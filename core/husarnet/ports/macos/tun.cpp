@@ -96,6 +96,7 @@ void Tun::onTunData()
 
   string_view packet = string_view(tunBuffer).substr(0, size);
   sendToLowerLayer(IpAddress(), packet.substr(4));
+  flushLowerLayer();
 }
 
 Tun::Tun()
@@ -30,10 +30,24 @@ enum class EnvKey
   daemonApiInterface,
   daemonApiHost,
   daemonApiPort,
-  daemonWorkerQueueSize
+  daemonWorkerQueueSize,
+  multicastRateLimits,
+  enableCompression,
+  compressionLevel,
+  tunMtu,
+  udpBufferSize,
+  enableConnectedSockets,
+  xdpInterface,
+  enableFec,
+  multipath,
+  livenessInterval
 };
 
-#define ENV_KEY_OPTIONS 11
+#define ENV_KEY_OPTIONS 21
+
+const int TUN_MTU_DEFAULT = 1350;
+const int TUN_MTU_MIN = 1280;  // required by IPv6
+const int TUN_MTU_MAX = 1900;  // packet buffers along the stack are 2000 bytes
 
 enum class StorageKey
 {
@@ -42,9 +56,12 @@ enum class StorageKey
   cache,
   daemonApiToken,
   defaults,
+  compressionDictionary,
+  schedulerConfig,
+  relayConfig,
 };
 
-#define STORAGE_KEY_OPTIONS 5
+#define STORAGE_KEY_OPTIONS 8
 
 enum class HookType
 {
@@ -81,7 +98,7 @@ namespace Port {
   IpAddress getIpAddressFromInterfaceName(const std::string& interfaceName);
   std::vector<IpAddress> getLocalAddresses();
 
-  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName);
+  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName, int mtu);
 
   void processSocketEvents(void* tuntap);
 
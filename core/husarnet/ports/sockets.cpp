@@ -3,8 +3,18 @@
 // License: specified in project_root/LICENSE.txt
 #include "husarnet/ports/sockets.h"
 
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #include "husarnet/ports/port.h"
 
+#ifdef PORT_LINUX
+#include <ifaddrs.h>
+#endif
+
 #include "husarnet/logging.h"
 #include "husarnet/util.h"
 
@@ -67,8 +77,23 @@ namespace OsSocket {
     }
   }
 
-  std::vector<UdpSocket> udpSockets;
+  // A list, as sockets are opened from within callbacks invoked while it's
+  // iterated. Closed ones (fd -1) are removed by runOnce.
+  std::list<UdpSocket> udpSockets;
+  // Open ones by fd, so udpSend doesn't have to walk the list every time
+  std::unordered_map<int, UdpSocket*> udpSocketsByFd;
+  // udpSend is also called from the ngsocket worker thread
+  etl::mutex udpSocketsMutex;
+  std::atomic<size_t> udpSendQueueDepth{0};
+  std::atomic<uint64_t> udpSendDrops{0};
+  int udpBufferSize = 0;
+  bool udpReusePort = false;
+  std::atomic<uint64_t> udpReceiveDrops{0};
   std::vector<CustomSocket> customSockets;
+  int nextTimeoutLimit = -1;
+  // Set on the thread running runOnce - writes made from anywhere else are
+  // not batched, as nothing would wake select up to send them
+  static thread_local bool onEventLoop = false;
   std::vector<std::shared_ptr<TcpConnection>> tcpConnections;
   etl::mutex tcpConnectionsMutex;
   int unicastUdpFd = -1;
@@ -103,6 +128,110 @@ namespace OsSocket {
   // UDP
   // -----
 
+  static int getSocketBuffer(int fd, int option)
+  {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    SOCKFUNC(getsockopt)(fd, SOL_SOCKET, option, (char*)&size, &len);
+    return size;
+  }
+
+  // Privileged processes can go above the system wide limit (net.core.rmem_max)
+  // with the *FORCE variants, everyone else gets the size capped
+  static int setSocketBuffer(int fd, int option, int forceOption, int size)
+  {
+#ifdef SO_RCVBUFFORCE
+    bool forced = SOCKFUNC(setsockopt)(fd, SOL_SOCKET, forceOption, (const char*)&size, sizeof(size)) == 0;
+#else
+    (void)forceOption;
+    bool forced = false;
+#endif
+    if(!forced) {
+      SOCKFUNC(setsockopt)(fd, SOL_SOCKET, option, (const char*)&size, sizeof(size));
+    }
+
+    return getSocketBuffer(fd, option);
+  }
+
+  static int setReceiveBuffer(int fd, int size)
+  {
+#ifdef SO_RCVBUFFORCE
+    return setSocketBuffer(fd, SO_RCVBUF, SO_RCVBUFFORCE, size);
+#else
+    return setSocketBuffer(fd, SO_RCVBUF, 0, size);
+#endif
+  }
+
+  static int setSendBuffer(int fd, int size)
+  {
+#ifdef SO_SNDBUFFORCE
+    return setSocketBuffer(fd, SO_SNDBUF, SO_SNDBUFFORCE, size);
+#else
+    return setSocketBuffer(fd, SO_SNDBUF, 0, size);
+#endif
+  }
+
+  static void configureUdpBuffers(int fd)
+  {
+#ifndef ESP_PLATFORM  // lwIP buffers are sized at build time
+    int size = udpBufferSize > 0 ? udpBufferSize : UDP_BUFFER_AUTO_INITIAL;
+    setReceiveBuffer(fd, size);
+    setSendBuffer(fd, size);
+#endif
+
+#ifdef SO_RXQ_OVFL
+    int one = 1;
+    SOCKFUNC(setsockopt)(fd, SOL_SOCKET, SO_RXQ_OVFL, (const char*)&one, sizeof(one));
+#endif
+  }
+
+  // Reads the drop counter attached to a received datagram and grows the
+  // receive buffer if automatic sizing is on
+  static void accountReceiveOverflows(UdpSocket& socket, uint32_t overflows)
+  {
+    uint32_t dropped = overflows - socket.receiveOverflows;
+    socket.receiveOverflows = overflows;
+    if(dropped == 0) {
+      return;
+    }
+
+    udpReceiveDrops += dropped;
+
+    if(udpBufferSize > 0 || socket.receiveBufferSize >= UDP_BUFFER_AUTO_MAX) {
+      return;
+    }
+
+    int size = std::min(std::max(socket.receiveBufferSize, UDP_BUFFER_AUTO_INITIAL) * 2, UDP_BUFFER_AUTO_MAX);
+    socket.receiveBufferSize = size;
+    int effective = setReceiveBuffer(socket.fd, size);
+    HLOG_INFO("UDP receive queue overflowed, growing the buffer // {dropped} {buffer_size}", dropped, effective);
+  }
+
+  void setUdpBufferSize(int size)
+  {
+    udpBufferSize = size;
+  }
+
+  void setUdpReusePort(bool reusePort)
+  {
+    udpReusePort = reusePort;
+  }
+
+  int getUdpReceiveBufferSize()
+  {
+    return unicastUdpFd == -1 ? 0 : getSocketBuffer(unicastUdpFd, SO_RCVBUF);
+  }
+
+  int getUdpSendBufferSize()
+  {
+    return unicastUdpFd == -1 ? 0 : getSocketBuffer(unicastUdpFd, SO_SNDBUF);
+  }
+
+  uint64_t getUdpReceiveDrops()
+  {
+    return udpReceiveDrops;
+  }
+
   int bindUdpSocket(InetAddress addr, bool reuse, bool v6)
   {
     int fd = SOCKFUNC(socket)(useV6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
@@ -116,7 +245,15 @@ namespace OsSocket {
       (fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
     }
 
+#if defined(SO_REUSEPORT) && !defined(ESP_PLATFORM)
+    if(udpReusePort) {
+      int one = 1;
+      SOCKFUNC(setsockopt)(fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof(one));
+    }
+#endif
+
     set_nonblocking(fd);
+    configureUdpBuffers(fd);
 
     int off = 0;
     setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&off, sizeof(off));
@@ -135,6 +272,14 @@ namespace OsSocket {
     return bindUdpSocket(addr, reuse, useV6);
   }
 
+  // Has to be called with udpSocketsMutex held
+  static UdpSocket& addUdpSocket(int fd, PacketCallback callback)
+  {
+    udpSockets.push_back(UdpSocket{fd, callback});
+    udpSocketsByFd[fd] = &udpSockets.back();
+    return udpSockets.back();
+  }
+
   bool udpListenUnicast(int port, PacketCallback callback, bool setAsDefault)
   {
     int fd = bindUdpSocket(InetAddress{IpAddress::wildcard(), (uint16_t)port}, false);
@@ -144,21 +289,215 @@ namespace OsSocket {
     if(setAsDefault)
       unicastUdpFd = fd;
 
-    udpSockets.push_back(UdpSocket{fd, callback});
+    std::lock_guard lg(udpSocketsMutex);
+    addUdpSocket(fd, callback);
+
+    return true;
+  }
+
+  // Has to be called with udpSocketsMutex held
+  static UdpSocket* findUdpSocket(int fd)
+  {
+    auto it = udpSocketsByFd.find(fd);
+    if(it == udpSocketsByFd.end())
+      return nullptr;
+
+    return it->second;
+  }
+
+  // Socket buffer is full (or the interface queue is), the datagram can be
+  // retried once the socket is writable
+  static bool isUdpSendBlocked()
+  {
+#ifdef PORT_WINDOWS
+    int error = WSAGetLastError();
+    return error == WSAEWOULDBLOCK || error == WSAENOBUFS;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS;
+#endif
+  }
+
+  // Returns false if the datagram should be retried later
+  static bool udpSendNow(int fd, bool connected, InetAddress address, string_view data)
+  {
+    long r;
+    if(connected) {
+      // No route lookup for every datagram
+      r = SOCKFUNC(send)(fd, data.data(), data.size(), 0);
+    } else {
+      auto sa = makeSockaddr(address);
+      socklen_t socklen = sizeof(sa);
+      r = SOCKFUNC(sendto)(fd, data.data(), data.size(), 0, (sockaddr*)&sa, socklen);
+    }
 
+    if(r >= 0) {
+      return true;
+    }
+
+    if(isUdpSendBlocked()) {
+      return false;
+    }
+
+    // Unreachable destinations and the like, nothing to retry
+    udpSendDrops++;
     return true;
   }
 
-  void udpSend(InetAddress address, string_view data, int fd)
+  static void udpEnqueue(UdpSocket* socket, InetAddress address, string_view data)
+  {
+    if(socket == nullptr || socket->sendQueue.size() >= UDP_SEND_QUEUE_SIZE) {
+      udpSendDrops++;
+      return;
+    }
+
+    socket->sendQueue.push_back(QueuedDatagram{address, data.str()});
+    udpSendQueueDepth++;
+  }
+
+  static void udpFlushQueue(UdpSocket& socket)
+  {
+    while(!socket.sendQueue.empty()) {
+      auto& datagram = socket.sendQueue.front();
+      if(!udpSendNow(socket.fd, socket.connected, datagram.address, datagram.data)) {
+        return;
+      }
+
+      socket.sendQueue.pop_front();
+      udpSendQueueDepth--;
+    }
+  }
+
+  size_t getUdpSendQueueDepth()
+  {
+    return udpSendQueueDepth;
+  }
+
+  uint64_t getUdpSendDrops()
+  {
+    return udpSendDrops;
+  }
+
+#ifdef PORT_LINUX
+  // Routing would otherwise pick the interface by the destination only
+  static void bindToInterfaceOf(int fd, IpAddress address)
+  {
+    struct ifaddrs* interfaces = nullptr;
+    if(getifaddrs(&interfaces) < 0)
+      return;
+
+    for(auto it = interfaces; it != nullptr; it = it->ifa_next) {
+      if(it->ifa_addr == nullptr || (it->ifa_addr->sa_family != AF_INET && it->ifa_addr->sa_family != AF_INET6))
+        continue;
+
+      struct sockaddr_storage st {};
+      memcpy(&st, it->ifa_addr, it->ifa_addr->sa_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+      if(ipFromSockaddr(st).ip != address)
+        continue;
+
+      if(setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, it->ifa_name, strlen(it->ifa_name) + 1) < 0) {
+        HLOG_WARNING("binding UDP socket to interface failed // {interface} {error}", it->ifa_name, strerror(errno));
+      }
+      break;
+    }
+
+    freeifaddrs(interfaces);
+  }
+#endif
+
+  int udpConnect(int localPort, InetAddress remote, PacketCallback callback, IpAddress localAddress)
+  {
+#if defined(SO_REUSEPORT) && !defined(ESP_PLATFORM)
+    if(!udpReusePort) {
+      return -1;
+    }
+
+    IpAddress localIp = localAddress.isValid() ? localAddress : IpAddress::wildcard();
+    int fd = bindUdpSocket(InetAddress{localIp, (uint16_t)localPort}, false);
+    if(fd == -1)
+      return -1;
+
+#ifdef PORT_LINUX
+    if(localAddress.isValid())
+      bindToInterfaceOf(fd, localAddress);
+#endif
+
+    // Datagrams from that address are delivered to this socket from now on,
+    // the shared one gets all the others
+    auto sa = makeSockaddr(remote);
+    if(SOCKFUNC(connect)(fd, (sockaddr*)&sa, sizeof(sa)) < 0) {
+      HLOG_WARNING("UDP connect failed // {address} {error}", remote.str(), strerror(errno));
+      SOCKFUNC_close(fd);
+      return -1;
+    }
+
+    std::lock_guard lg(udpSocketsMutex);
+    addUdpSocket(fd, callback).connected = true;
+    return fd;
+#else
+    (void)localPort;
+    (void)remote;
+    (void)callback;
+    (void)localAddress;
+    return -1;
+#endif
+  }
+
+  void udpClose(int fd)
+  {
+    std::lock_guard lg(udpSocketsMutex);
+    auto socket = findUdpSocket(fd);
+    if(socket == nullptr)
+      return;
+
+    udpSendQueueDepth -= socket->sendQueue.size();
+    socket->sendQueue.clear();
+    udpSocketsByFd.erase(fd);
+    SOCKFUNC_close(socket->fd);
+    socket->fd = -1;
+  }
+
+  void udpSend(InetAddress address, string_view data, int fd, bool dontFragment)
   {
     if(fd == -1) {
       if(unicastUdpFd == -1)
         return;
       fd = unicastUdpFd;
     }
-    auto sa = makeSockaddr(address);
-    socklen_t socklen = sizeof(sa);
-    SOCKFUNC(sendto)(fd, data.data(), data.size(), 0, (sockaddr*)&sa, socklen);
+
+#ifdef IP_PMTUDISC_PROBE
+    // Probing sets DF but ignores the cached path MTU, so the datagram either
+    // gets through as a whole or not at all. Regular traffic keeps the socket
+    // defaults.
+    if(dontFragment) {
+      auto sa = makeSockaddr(address);
+      socklen_t socklen = sizeof(sa);
+      int level = address.ip.isMappedV4() ? IPPROTO_IP : IPPROTO_IPV6;
+      int option = address.ip.isMappedV4() ? IP_MTU_DISCOVER : IPV6_MTU_DISCOVER;
+      int previous = 0;
+      socklen_t previousSize = sizeof(previous);
+      int probe = address.ip.isMappedV4() ? IP_PMTUDISC_PROBE : IPV6_PMTUDISC_PROBE;
+      if(getsockopt(fd, level, option, &previous, &previousSize) == 0 &&
+         setsockopt(fd, level, option, &probe, sizeof(probe)) == 0) {
+        SOCKFUNC(sendto)(fd, data.data(), data.size(), 0, (sockaddr*)&sa, socklen);
+        setsockopt(fd, level, option, &previous, sizeof(previous));
+        return;
+      }
+    }
+#else
+    (void)dontFragment;
+#endif
+
+    // Keep the order - nothing jumps the queue
+    std::lock_guard lg(udpSocketsMutex);
+    auto socket = findUdpSocket(fd);
+    if(socket != nullptr && !socket->sendQueue.empty()) {
+      udpEnqueue(socket, address, data);
+      return;
+    }
+
+    if(!udpSendNow(fd, socket != nullptr && socket->connected, address, data)) {
+      udpEnqueue(socket, address, data);
+    }
   }
 
   bool udpListenMulticast(InetAddress address, PacketCallback callback)
@@ -175,7 +514,8 @@ namespace OsSocket {
       memcpy(&mreq.imr_multiaddr, address.ip.data.data() + 12, 4);
 
       if(SOCKFUNC(setsockopt)(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) == 0) {
-        udpSockets.push_back(UdpSocket{fd, callback});
+        std::lock_guard lg(udpSocketsMutex);
+        addUdpSocket(fd, callback);
         return true;
       } else {
         return false;
@@ -191,7 +531,8 @@ namespace OsSocket {
       memcpy(&mreq.ipv6mr_multiaddr, address.ip.data.data(), 16);
       mreq.ipv6mr_interface = 0;
       if(SOCKFUNC(setsockopt)(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, (const char*)&mreq, sizeof(mreq)) == 0) {
-        udpSockets.push_back(UdpSocket{fd, callback});
+        std::lock_guard lg(udpSocketsMutex);
+        addUdpSocket(fd, callback);
         return true;
       } else {
         return false;
@@ -229,6 +570,13 @@ namespace OsSocket {
     customSockets.push_back(CustomSocket{fd, readyCallback});
   }
 
+  void limitNextTimeout(int timeout)
+  {
+    if(nextTimeoutLimit < 0 || timeout < nextTimeoutLimit) {
+      nextTimeoutLimit = std::max(timeout, 0);
+    }
+  }
+
   // -----
   // TCP
   // -----
@@ -304,61 +652,115 @@ namespace OsSocket {
       return false;
     assert(packet.size() > 0);
 
-    if(conn->getEncapsulationType() == Encapsulation::FRAMED_TLS_MASKED) {
-      // Masquerade our stream as SSL.
-      std::string header = "\x17\x03\x03" + pack((uint16_t)packet.size());
-      packet.insert(0, header);
+    return _enqueue(conn, std::move(packet));
+  }
+
+  bool TcpConnection::write(std::shared_ptr<TcpConnection> conn, etl::ivector<char>& packet)
+  {
+    if(!conn || conn->fd == -1)
+      return false;
+    assert(packet.size() > 0);
+
+    return _enqueue(conn, std::string(packet.begin(), packet.end()));
+  }
+
+  bool TcpConnection::_enqueue(std::shared_ptr<TcpConnection> conn, std::string&& packet)
+  {
+    bool framed = conn->getEncapsulationType() == Encapsulation::FRAMED_TLS_MASKED;
+    if(framed && packet.size() > UINT16_MAX) {
+      HLOG_ERROR("TCP message too large // {packet_size}", packet.size());
+      return false;
     }
 
-    ssize_t bytes_written = 0;
+    std::lock_guard lg(conn->writeMutex);
 
-    do {
-      ssize_t remaining = packet.size() - bytes_written;
-      ssize_t n = SOCKFUNC(send)(conn->fd, packet.data() + bytes_written, remaining, 0);
+    // Whole frames are dropped, so the stream stays in sync
+    size_t frameSize = packet.size() + (framed ? 5 : 0);
+    if(conn->writeQueueBytes + frameSize > TCP_WRITE_QUEUE_BUDGET) {
+      conn->droppedWrites++;
+      HLOG_DEBUG("TCP write queue full // {queued_bytes}", conn->writeQueueBytes);
+      return false;
+    }
 
-      if(n <= 0) {
-        HLOG_ERROR("websocket send failed // {error}", strerror(errno));
-        return false;
-      }
+    if(framed) {
+      // Masquerade our stream as SSL.
+      conn->writeQueue.push_back("\x17\x03\x03" + pack((uint16_t)packet.size()));
+    }
+    conn->writeQueue.push_back(std::move(packet));
+    conn->writeQueueBytes += frameSize;
+
+    if(framed && onEventLoop) {
+      return true;
+    }
 
-      bytes_written += n;
-    } while(bytes_written != packet.size());
+    if(!conn->_flush()) {
+      TcpConnection::close(conn);
+      return false;
+    }
 
     return true;
   }
 
-  bool TcpConnection::write(std::shared_ptr<TcpConnection> conn, etl::ivector<char>& packet)
+  // Has to be called with writeMutex held
+  bool TcpConnection::_flush()
   {
-    if(conn->fd == -1)
-      return false;
-    assert(packet.size() > 0);
+    while(!this->writeQueue.empty()) {
+      int count = 0;
+#ifdef PORT_WINDOWS
+      WSABUF buffers[TCP_WRITE_MAX_BUFFERS];
+      for(auto it = this->writeQueue.begin(); it != this->writeQueue.end() && count < TCP_WRITE_MAX_BUFFERS; it++) {
+        size_t offset = (count == 0) ? this->writeOffset : 0;
+        buffers[count].buf = const_cast<char*>(it->data()) + offset;
+        buffers[count].len = (ULONG)(it->size() - offset);
+        count++;
+      }
 
-    if(conn->getEncapsulationType() == Encapsulation::FRAMED_TLS_MASKED) {
-      // Masquerade our stream as SSL.
-      std::string header = "\x17\x03\x03" + pack((uint16_t)packet.size());
+      DWORD sent = 0;
+      if(WSASend(this->fd, buffers, count, &sent, 0, NULL, NULL) != 0) {
+        if(WSAGetLastError() == WSAEWOULDBLOCK) {
+          return true;
+        }
 
-      if(packet.size() + header.size() > packet.capacity()) {
-        HLOG_ERROR("TCP message too large // {packet_size} {packet_max_size}", packet.size(), packet.capacity());
+        HLOG_ERROR("TCP send failed // {errno}", WSAGetLastError());
         return false;
       }
 
-      packet.insert(packet.begin(), header.begin(), header.end());
-    }
-
-    ssize_t bytes_written = 0;
+      size_t written = sent;
+#else
+      struct iovec buffers[TCP_WRITE_MAX_BUFFERS];
+      for(auto it = this->writeQueue.begin(); it != this->writeQueue.end() && count < TCP_WRITE_MAX_BUFFERS; it++) {
+        size_t offset = (count == 0) ? this->writeOffset : 0;
+        buffers[count].iov_base = const_cast<char*>(it->data()) + offset;
+        buffers[count].iov_len = it->size() - offset;
+        count++;
+      }
 
-    // Send data supporting partial writes
-    do {
-      ssize_t remaining = packet.size() - bytes_written;
-      ssize_t n = SOCKFUNC(send)(conn->fd, packet.data() + bytes_written, remaining, 0);
+      ssize_t n = SOCKFUNC(writev)(this->fd, buffers, count);
+      if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+      }
 
       if(n <= 0) {
         HLOG_ERROR("TCP send failed // {error}", strerror(errno));
         return false;
       }
 
-      bytes_written += n;
-    } while(bytes_written != packet.size());
+      size_t written = n;
+#endif
+
+      this->writeQueueBytes -= written;
+      while(written > 0) {
+        size_t remaining = this->writeQueue.front().size() - this->writeOffset;
+        if(written < remaining) {
+          this->writeOffset += written;
+          break;
+        }
+
+        written -= remaining;
+        this->writeOffset = 0;
+        this->writeQueue.pop_front();
+      }
+    }
 
     return true;
   }
@@ -366,19 +768,11 @@ namespace OsSocket {
   void TcpConnection::_handleRead(std::shared_ptr<TcpConnection> conn)
   {
     while(true) {
-      ssize_t read = 0;
-
-      size_t available = conn->readBuffer.available();
-      if(available > 0) {
-        // Read data into buffer memory
-        // Buffer must be shrunk from the maximum size to the actual read size
-        // to prevent reinitialization of the buffer underlying data type
-        size_t size = conn->readBuffer.size();
-        conn->readBuffer.uninitialized_resize(conn->readBuffer.capacity());
-        read = SOCKFUNC(recv)(conn->fd, conn->readBuffer.begin() + size, available, 0);
-
-        size_t newSize = (read > 0) ? size + read : size;
-        conn->readBuffer.resize(newSize);
+      // Reads go straight into the free space of the ring buffer, as much of
+      // it as is contiguous - the rest is filled by the next iteration
+      size_t writable = conn->readBuffer.writableSize();
+      if(writable > 0) {
+        ssize_t read = SOCKFUNC(recv)(conn->fd, conn->readBuffer.writePointer(), writable, 0);
 
 #ifdef PORT_WINDOWS
         if(read < 0 && (WSAGetLastError() == WSAEWOULDBLOCK)) {
@@ -401,53 +795,55 @@ namespace OsSocket {
           return;
         }
 #endif
+
+        conn->readBuffer.commit(read);
       }
 
       // Pass data directly to the callback if no encapsulation is used
       if(this->getEncapsulationType() == Encapsulation::NONE) {
-        auto view = etl::string_view(conn->readBuffer);
+        auto data = conn->readBuffer.peek(0, conn->readBuffer.size()).linearize(conn->frameBuffer);
+        auto view = etl::string_view(data.data(), data.size());
         conn->dataCallback(view);
-        conn->readBuffer.clear();
+        conn->readBuffer.consume(conn->readBuffer.size());
       } else {
         while(true) {
-          // TODO: refactor: packet pool
-
-          // Check if we have a full packet
+          // Check if we have a full header
           if(conn->readBuffer.size() <= 5)
-            return;
+            break;
 
-          auto iter = conn->readBuffer.begin();
+          auto header = conn->readBuffer.peek(0, 5);
 
           // Is packet masquerading as SSL?
-          if(etl::string_view(iter, 3) != conn->TLS_HEADER) {
+          if(header[0] != conn->TLS_HEADER[0] || header[1] != conn->TLS_HEADER[1] ||
+             header[2] != conn->TLS_HEADER[2]) {
             HLOG_ERROR("TCP socket format error (1)");
             TcpConnection::close(conn);
             return;
           }
 
-          iter += conn->TLS_HEADER.size();
-
           // Extract packet size
-          uint16_t expectedSize = unpack<uint16_t>(etl::string_view(iter, 2));
-          iter += 2;
+          uint16_t expectedSize = ((uint8_t)header[3] << 8) | (uint8_t)header[4];
 
-          size_t packetLen = etl::distance(conn->readBuffer.begin(), iter) + expectedSize;
-          if(packetLen >= conn->readBuffer.capacity()) {
-            HLOG_INFO("TCP message too large // {expected_size} {actual_size}", expectedSize, conn->readBuffer.size());
+          size_t packetLen = 5 + expectedSize;
+          if(packetLen > conn->readBuffer.capacity()) {
+            HLOG_INFO(
+                "TCP message too large // {expected_size} {buffer_size}", expectedSize, conn->readBuffer.capacity());
             TcpConnection::close(conn);
             return;
           }
 
-          if(conn->readBuffer.size() >= packetLen) {
-            etl::string_view packet(conn->readBuffer.begin() + 5, expectedSize);
-            conn->dataCallback(packet);
-
-            // Remove the packet from the buffer
-            conn->readBuffer.erase(0, packetLen);
-          } else {
+          if(conn->readBuffer.size() < packetLen) {
             // We don't have the full packet yet
             break;
           }
+
+          // Frames are passed in place, unless they wrap around
+          auto frame = conn->readBuffer.peek(5, expectedSize).linearize(conn->frameBuffer);
+          etl::string_view packet(frame.data(), frame.size());
+          conn->dataCallback(packet);
+
+          // Remove the packet from the buffer
+          conn->readBuffer.consume(packetLen);
         }
       }
 
@@ -471,9 +867,10 @@ namespace OsSocket {
       const InetAddress& address,
       TcpDataCallback dataCallback,
       TcpErrorCallback errorCallback,
-      TcpConnection::Encapsulation transportType)
+      TcpConnection::Encapsulation transportType,
+      size_t readBufferSize)
   {
-    auto conn = std::make_shared<TcpConnection>(transportType);
+    auto conn = std::make_shared<TcpConnection>(transportType, readBufferSize);
     conn->dataCallback = dataCallback;
     conn->errorCallback = errorCallback;
     conn->fd = SOCKFUNC(socket)(AF_INETx, SOCK_STREAM, 0);
@@ -555,21 +952,52 @@ namespace OsSocket {
 
   void runOnce(int timeout)
   {
+    onEventLoop = true;
+
     std::lock_guard lg(tcpConnectionsMutex);
+    {
+      std::lock_guard udpLock(udpSocketsMutex);
+      udpSockets.remove_if([](const UdpSocket& socket) { return socket.fd == -1; });
+    }
+
     fd_set readset;
+    fd_set writeset;
     FD_ZERO(&readset);
+    FD_ZERO(&writeset);
     int maxfd = 0;
 
     for(auto conn : tcpConnections) {
       if(!conn || conn->fd <= 0)
         continue;
+
+      // Frames queued since the last iteration go out together
+      {
+        std::lock_guard writeLock(conn->writeMutex);
+        if(!conn->_flush()) {
+          TcpConnection::close(conn);
+          continue;
+        }
+
+        if(!conn->writeQueue.empty()) {
+          FD_SET(conn->fd, &writeset);
+        }
+      }
+
       FD_SET(conn->fd, &readset);
       maxfd = std::max(conn->fd, maxfd);
     }
 
-    for(auto conn : udpSockets) {
-      FD_SET(conn.fd, &readset);
-      maxfd = std::max(conn.fd, maxfd);
+    {
+      std::lock_guard udpLock(udpSocketsMutex);
+      for(auto& conn : udpSockets) {
+        if(conn.fd == -1)
+          continue;
+        FD_SET(conn.fd, &readset);
+        if(!conn.sendQueue.empty()) {
+          FD_SET(conn.fd, &writeset);
+        }
+        maxfd = std::max(conn.fd, maxfd);
+      }
     }
 
     for(auto conn : customSockets) {
@@ -577,13 +1005,18 @@ namespace OsSocket {
       maxfd = std::max(conn.fd, maxfd);
     }
 
+    if(nextTimeoutLimit >= 0) {
+      timeout = std::min(timeout, nextTimeoutLimit);
+      nextTimeoutLimit = -1;
+    }
+
     struct timeval timeoutval;
     timeoutval.tv_sec = timeout / 1000;
     timeoutval.tv_usec = (timeout % 1000) * 1000;
 
     errno = 0;
 
-    int res = SOCKFUNC(select)(maxfd + 1, &readset, NULL, NULL, &timeoutval);
+    int res = SOCKFUNC(select)(maxfd + 1, &readset, &writeset, NULL, &timeoutval);
 
     if(res < 0 && errno != EINTR) {
       HLOG_ERROR("select failed // {errno}", strerror(errno));
@@ -594,15 +1027,44 @@ namespace OsSocket {
       if(conn.fd == -1)
         continue;
 
+      if(FD_ISSET(conn.fd, &writeset)) {
+        std::lock_guard udpLock(udpSocketsMutex);
+        udpFlushQueue(conn);
+      }
+
       if(FD_ISSET(conn.fd, &readset)) {
         struct sockaddr_storage s;
         socklen_t len = sizeof(s);
         udpBuffer.resize(UDP_BUFFER_SIZE);
 
         while(true) {
+#ifdef SO_RXQ_OVFL
+          struct iovec iov = {&udpBuffer[0], udpBuffer.size()};
+          char control[CMSG_SPACE(sizeof(uint32_t))];
+          struct msghdr msg {};
+          msg.msg_name = &s;
+          msg.msg_namelen = len;
+          msg.msg_iov = &iov;
+          msg.msg_iovlen = 1;
+          msg.msg_control = control;
+          msg.msg_controllen = sizeof(control);
+
+          long r = SOCKFUNC(recvmsg)(conn.fd, &msg, 0);
+          if(r <= 0)
+            break;
+
+          for(auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+              uint32_t overflows;
+              memcpy(&overflows, CMSG_DATA(cmsg), sizeof(overflows));
+              accountReceiveOverflows(conn, overflows);
+            }
+          }
+#else
           long r = SOCKFUNC(recvfrom)(conn.fd, &udpBuffer[0], udpBuffer.size(), 0, (sockaddr*)&s, &len);
           if(r <= 0)
             break;
+#endif
           conn.callback(ipFromSockaddr(s), string_view(udpBuffer).substr(0, r));
         }
       }
@@ -621,6 +1083,14 @@ namespace OsSocket {
       if(!conn || conn->fd == -1)
         continue;
 
+      if(FD_ISSET(conn->fd, &writeset)) {
+        std::lock_guard writeLock(conn->writeMutex);
+        if(!conn->_flush()) {
+          TcpConnection::close(conn);
+          continue;
+        }
+      }
+
       if(FD_ISSET(conn->fd, &readset)) {
         conn->_handleRead(conn);
       }
@@ -5,7 +5,10 @@
 // Wrapper around OS sockets
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <list>
 #include <memory>
 #include <vector>
 
@@ -20,23 +23,63 @@
 #include <ws2tcpip.h>
 #endif
 
+#include <etl/mutex.h>
 #include <etl/string.h>
 #include <etl/string_view.h>
 #include <etl/vector.h>
 
 #include "husarnet/ipaddress.h"
+#include "husarnet/ring_buffer.h"
 #include "husarnet/string_view.h"
 
 namespace OsSocket {
   constexpr int UDP_BUFFER_SIZE = 2000;
   constexpr int QUEUE_SIZE_LIMIT = 3000;
-  constexpr int TCP_READ_BUFFER = 2000;
+  // Default size of the TCP reassembly buffer - frames larger than that
+  // close the connection
+#ifdef ESP_PLATFORM
+  constexpr size_t TCP_READ_BUFFER = 4 * 1024;
+#else
+  constexpr size_t TCP_READ_BUFFER = 128 * 1024;
+#endif
+  // Frames queued above this many bytes are dropped (and counted) instead
+#ifdef ESP_PLATFORM
+  constexpr size_t TCP_WRITE_QUEUE_BUDGET = 16 * 1024;
+#else
+  constexpr size_t TCP_WRITE_QUEUE_BUDGET = 256 * 1024;
+#endif
+  // Buffers handed to a single writev
+  constexpr int TCP_WRITE_MAX_BUFFERS = 64;
+
+  // Datagrams waiting for the socket to become writable again, above that
+  // they are dropped (and counted)
+#ifdef ESP_PLATFORM
+  constexpr size_t UDP_SEND_QUEUE_SIZE = 8;
+#else
+  constexpr size_t UDP_SEND_QUEUE_SIZE = 64;
+#endif
+
+  // Automatic UDP buffer sizing starts here and doubles the receive buffer
+  // every time the kernel reports drops
+  constexpr int UDP_BUFFER_AUTO_INITIAL = 1024 * 1024;
+  constexpr int UDP_BUFFER_AUTO_MAX = 8 * 1024 * 1024;
 
   using PacketCallback = std::function<void(InetAddress, string_view)>;
 
+  struct QueuedDatagram {
+    InetAddress address;
+    std::string data;
+  };
+
   struct UdpSocket {
     int fd;
     PacketCallback callback;
+    std::deque<QueuedDatagram> sendQueue;
+    // connect()ed to a single remote address, sent to with send()
+    bool connected = false;
+    // Cumulative kernel drop count (SO_RXQ_OVFL) seen last
+    uint32_t receiveOverflows = 0;
+    int receiveBufferSize = 0;
   };
 
   struct CustomSocket {
@@ -58,19 +101,26 @@ namespace OsSocket {
       FRAMED_TLS_MASKED,  // SSL magic + length + data
     };
 
-    TcpConnection(Encapsulation transportType = Encapsulation::FRAMED_TLS_MASKED) : _encapsulation(transportType){};
+    TcpConnection(
+        Encapsulation transportType = Encapsulation::FRAMED_TLS_MASKED,
+        size_t readBufferSize = TCP_READ_BUFFER)
+        : readBuffer(readBufferSize), _encapsulation(transportType){};
 
     // Create a new TCP connection
     static std::shared_ptr<TcpConnection> connect(
         const InetAddress& address,
         TcpDataCallback dataCallback,
         TcpErrorCallback errorCallback,
-        Encapsulation transportType = TcpConnection::Encapsulation::FRAMED_TLS_MASKED);
+        Encapsulation transportType = TcpConnection::Encapsulation::FRAMED_TLS_MASKED,
+        size_t readBufferSize = TCP_READ_BUFFER);
 
     // TODO: remove c style static functions, use Packet shared ptr to pass data
 
-    // Write a data packet.
-    // Returns true if the packet was sent.
+    // Queue a data packet (the string one is moved from). Frames written from
+    // within the event loop are flushed by runOnce, so all the ones from
+    // a single loop iteration go out in one writev, the rest is flushed right
+    // away.
+    // Returns false if the packet was dropped.
     static bool write(std::shared_ptr<TcpConnection> conn, std::string& data);
     static bool write(std::shared_ptr<TcpConnection> conn, etl::ivector<char>& data);
 
@@ -88,13 +138,33 @@ namespace OsSocket {
       return fd;
     }
 
+    size_t getQueuedBytes() const
+    {
+      return writeQueueBytes;
+    }
+
+    uint64_t getDroppedWrites() const
+    {
+      return droppedWrites;
+    }
+
    private:
     int fd = -1;
-    etl::string<TCP_READ_BUFFER> readBuffer;
+    RingBuffer readBuffer;
+    // Only used for the frames that wrap around the end of readBuffer
+    std::string frameBuffer;
 
     static const inline etl::string<3> TLS_HEADER = "\x17\x03\x03";
     Encapsulation _encapsulation;
 
+    // Frame headers are queued as separate buffers, so payloads are never
+    // moved to make room for them
+    etl::mutex writeMutex;
+    std::deque<std::string> writeQueue;
+    std::atomic<size_t> writeQueueBytes{0};
+    size_t writeOffset = 0;  // into the front buffer
+    std::atomic<uint64_t> droppedWrites{0};
+
     // Used for derefered error callback execution
     bool _hasErrored = false;
 
@@ -104,6 +174,10 @@ namespace OsSocket {
     void _handleRead(std::shared_ptr<TcpConnection> conn);
     void _handleTLSRead(std::shared_ptr<TcpConnection> conn);
 
+    static bool _enqueue(std::shared_ptr<TcpConnection> conn, std::string&& data);
+    // Returns false if the connection has failed
+    bool _flush();
+
     friend void runOnce(int);
   };
 
@@ -112,12 +186,41 @@ namespace OsSocket {
   int connectUnmanagedTcpSocket(InetAddress addr);
 
   bool udpListenUnicast(int port, PacketCallback callback, bool setAsDefault = true);
-  void udpSend(InetAddress address, string_view data, int fd = -1);
+  // Opens a UDP socket bound to the given local port and connect()ed to the
+  // remote address, received datagrams go to the callback as usual. Returns
+  // -1 if that's not supported on this platform (or failed). Safe to call
+  // from within the callbacks. With a local address the socket is bound to it
+  // (and on Linux to its interface as well), so it's the interface the
+  // datagrams leave through.
+  int udpConnect(int localPort, InetAddress remote, PacketCallback callback, IpAddress localAddress = IpAddress());
+  void udpClose(int fd);
+  // dontFragment is honoured only where the OS lets us probe the path
+  // (Linux), elsewhere the datagram may get fragmented as usual
+  void udpSend(InetAddress address, string_view data, int fd = -1, bool dontFragment = false);
   bool udpListenMulticast(InetAddress address, PacketCallback callback);
   void udpSendMulticast(InetAddress address, const std::string& data);
+  // Datagrams queued because the socket buffer was full, across all sockets
+  size_t getUdpSendQueueDepth();
+  // Datagrams not sent because the queue was full or sending failed
+  uint64_t getUdpSendDrops();
+
+  // Has to be called before any UDP socket is bound, 0 means automatic
+  void setUdpBufferSize(int size);
+  // Has to be called before any UDP socket is bound - sockets share their
+  // ports through SO_REUSEPORT, so udpConnect can be used
+  void setUdpReusePort(bool reusePort);
+  // Effective sizes of the default unicast socket as reported by the OS
+  int getUdpReceiveBufferSize();
+  int getUdpSendBufferSize();
+  // Datagrams dropped by the kernel because the receive queue was full
+  // (Linux only)
+  uint64_t getUdpReceiveDrops();
   int bindUdpSocket(InetAddress addr, bool reuse);
 
   void bindCustomFd(int fd, std::function<void()> readyCallback);
+  // Makes the next runOnce return after at most that many ms (for the work
+  // the main loop has scheduled, i.e. shaped packets). Main loop only.
+  void limitNextTimeout(int timeout);
 
   InetAddress ipFromSockaddr(struct sockaddr_storage st);
 
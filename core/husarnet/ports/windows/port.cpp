@@ -127,8 +127,9 @@ namespace Port {
     return result;
   }
 
-  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName)
+  UpperLayer* startTun(const HusarnetAddress& myAddress, const std::string& interfaceName, int mtu)
   {
+    (void)mtu;  // wintun adapter uses the system default, peers are limited with Packet Too Big
     auto tun = new Tun(myAddress);
     auto started = tun->start();
 
@@ -12,6 +12,7 @@
 #include <ws2ipdef.h>
 #include <ws2tcpip.h>
 
+#include "husarnet/epoch.h"
 #include "husarnet/logging.h"
 
 #include "dummy_task_priorities.h"
@@ -134,16 +135,29 @@ void Tun::startReaderThread()
   Port::threadStart(
       [this]() {
         HANDLE WaitHandles[] = {WintunGetReadWaitEvent(this->wintunSession)};
+        int batched = 0;
         while(true) {
           DWORD packetSize;
           BYTE* Packet = WintunReceivePacket(this->wintunSession, &packetSize);
           if(Packet) {
+            EpochGuard guard;
             this->sendToLowerLayer(IpAddress(), string_view(reinterpret_cast<const char*>(Packet), packetSize));
             WintunReleaseReceivePacket(this->wintunSession, Packet);
+
+            if(++batched == WINTUN_READ_BATCH) {
+              this->flushLowerLayer();
+              batched = 0;
+            }
           } else {
             DWORD LastError = GetLastError();
             switch(LastError) {
               case ERROR_NO_MORE_ITEMS:
+                // ring is drained, send out whatever was batched
+                if(batched > 0) {
+                  EpochGuard guard;
+                  this->flushLowerLayer();
+                  batched = 0;
+                }
                 if(WaitForMultipleObjects(_countof(WaitHandles), WaitHandles, FALSE, INFINITE) == WAIT_OBJECT_0)
                   continue;  // TODO wait for single object actually
               default:
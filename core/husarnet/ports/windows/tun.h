@@ -20,6 +20,9 @@ constexpr char networkAdapterNameStr[] = NETWORK_ADAPTER_NAME;
 // Rings capacity. As per Wintun docs: must be between WINTUN_MIN_RING_CAPACITY and WINTUN_MAX_RING_CAPACITY (incl.)
 // Must be a power of two.
 constexpr int ringCapacity = 0x400000;
+// Packets handed down before the lower layers are told to send out what they
+// have batched
+constexpr int WINTUN_READ_BATCH = 32;
 
 class Tun : public UpperLayer {
  public:
@@ -0,0 +1,262 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/relay_queue.h"
+
+#include <algorithm>
+
+using namespace nlohmann;  // json
+
+bool RelayConfig::fromJson(const json& value, RelayConfig& config, std::string& error)
+{
+  config = RelayConfig{};
+
+  if(!value.is_object()) {
+    error = "config has to be an object";
+    return false;
+  }
+
+  if(value.contains("rate_limit")) {
+    if(!value["rate_limit"].is_number_unsigned()) {
+      error = "rate_limit has to be a non-negative integer";
+      return false;
+    }
+    config.rateLimit = value["rate_limit"].get<uint64_t>();
+  }
+
+  if(value.contains("peers")) {
+    if(!value["peers"].is_object()) {
+      error = "peers has to be an object mapping addresses to rate limits";
+      return false;
+    }
+
+    for(const auto& [key, limit] : value["peers"].items()) {
+      auto address = IpAddress::parse(key);
+      if(!address.isFC94()) {
+        error = "invalid peer address " + key;
+        return false;
+      }
+
+      if(!limit.is_number_unsigned()) {
+        error = "rate limit of " + key + " has to be a non-negative integer";
+        return false;
+      }
+      config.peerRateLimits[address] = limit.get<uint64_t>();
+    }
+  }
+
+  return true;
+}
+
+json RelayConfig::toJson() const
+{
+  json peersJson = json::object();
+  for(const auto& [address, limit] : this->peerRateLimits) {
+    peersJson[address.toString()] = limit;
+  }
+
+  return json::object({
+      {"rate_limit", this->rateLimit},
+      {"peers", peersJson},
+  });
+}
+
+uint64_t RelayConfig::getRateLimit(HusarnetAddress peer) const
+{
+  auto it = this->peerRateLimits.find(peer);
+  return it != this->peerRateLimits.end() ? it->second : this->rateLimit;
+}
+
+static int64_t getBurst(uint64_t rateLimit)
+{
+  return std::max<int64_t>(rateLimit * RELAY_BURST_MS / 1000, 2 * RELAY_QUANTUM);
+}
+
+RelayQueue::RelayQueue(SendCallback sendCallback, ReadyCallback readyCallback)
+    : sendCallback(sendCallback), readyCallback(readyCallback)
+{
+}
+
+RelayQueue::PeerQueue& RelayQueue::getPeer(HusarnetAddress address, Time now)
+{
+  auto [it, created] = this->peers.try_emplace(address);
+  if(created) {
+    it->second.tokens = getBurst(this->config.getRateLimit(address));
+    it->second.lastRefill = now;
+  }
+
+  it->second.lastActive = now;
+  return it->second;
+}
+
+void RelayQueue::refill(HusarnetAddress address, PeerQueue& peer, Time now)
+{
+  uint64_t rateLimit = this->config.getRateLimit(address);
+  Time elapsed = now - peer.lastRefill;
+  if(rateLimit == 0 || elapsed <= 0) {
+    return;
+  }
+
+  peer.tokens = std::min<int64_t>(peer.tokens + rateLimit * elapsed / 1000, getBurst(rateLimit));
+  peer.lastRefill = now;
+}
+
+bool RelayQueue::isRateLimited(HusarnetAddress address, const PeerQueue& peer) const
+{
+  return this->config.getRateLimit(address) > 0 && peer.tokens <= 0;
+}
+
+Time RelayQueue::getWait(HusarnetAddress address, const PeerQueue& peer) const
+{
+  return 1 + (-peer.tokens * 1000) / (int64_t)this->config.getRateLimit(address);
+}
+
+void RelayQueue::sendNow(HusarnetAddress address, PeerQueue& peer, string_view data)
+{
+  peer.tokens -= data.size();
+  peer.sentPackets++;
+  peer.sentBytes += data.size();
+  this->sendCallback(address, data);
+}
+
+Time RelayQueue::send(HusarnetAddress address, string_view data, Time now)
+{
+  std::lock_guard lg(this->mutex);
+
+  auto& peer = getPeer(address, now);
+  refill(address, peer, now);
+
+  if(peer.packets.empty() && this->activePeers.empty() && !isRateLimited(address, peer) && this->readyCallback()) {
+    sendNow(address, peer, data);
+    return -1;
+  }
+
+  if(peer.packets.size() >= RELAY_QUEUE_LIMIT) {
+    peer.drops++;
+    this->drops++;
+  } else {
+    peer.packets.push_back(data.str());
+    if(!peer.active) {
+      peer.active = true;
+      this->activePeers.push_back(address);
+    }
+  }
+
+  return drainLocked(now);
+}
+
+Time RelayQueue::drain(Time now)
+{
+  std::lock_guard lg(this->mutex);
+  return drainLocked(now);
+}
+
+Time RelayQueue::drainLocked(Time now)
+{
+  Time wait = -1;
+
+  // Every round either sends something or grows the deficit of a peer that
+  // is not rate limited, so it ends once all of them are either empty or
+  // waiting for their tokens
+  bool progress = true;
+  while(progress && !this->activePeers.empty()) {
+    progress = false;
+
+    size_t count = this->activePeers.size();
+    for(size_t i = 0; i < count; i++) {
+      if(!this->readyCallback()) {
+        return -1;  // the stream wakes the loop up by itself
+      }
+
+      auto address = this->activePeers.front();
+      this->activePeers.pop_front();
+      auto& peer = this->peers[address];
+
+      refill(address, peer, now);
+      if(!isRateLimited(address, peer)) {
+        peer.deficit += RELAY_QUANTUM;
+        progress = true;
+      }
+
+      while(!peer.packets.empty() && peer.deficit >= (int)peer.packets.front().size() &&
+            !isRateLimited(address, peer) && this->readyCallback()) {
+        auto packet = std::move(peer.packets.front());
+        peer.packets.pop_front();
+        peer.deficit -= packet.size();
+        sendNow(address, peer, packet);
+      }
+
+      if(peer.packets.empty()) {
+        peer.deficit = 0;
+        peer.active = false;
+        continue;
+      }
+
+      if(isRateLimited(address, peer)) {
+        Time peerWait = getWait(address, peer);
+        wait = wait < 0 ? peerWait : std::min(wait, peerWait);
+      }
+      this->activePeers.push_back(address);
+    }
+  }
+
+  return wait;
+}
+
+void RelayQueue::cleanup(Time now)
+{
+  std::lock_guard lg(this->mutex);
+
+  for(auto it = this->peers.begin(); it != this->peers.end();) {
+    if(!it->second.active && now - it->second.lastActive > RELAY_IDLE_TIMEOUT) {
+      it = this->peers.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+json RelayQueue::getConfig()
+{
+  std::lock_guard lg(this->mutex);
+  return this->config.toJson();
+}
+
+bool RelayQueue::setConfig(const json& value, std::string& error)
+{
+  RelayConfig newConfig;
+  if(!RelayConfig::fromJson(value, newConfig, error)) {
+    return false;
+  }
+
+  std::lock_guard lg(this->mutex);
+  this->config = newConfig;
+
+  // Buckets shrink right away, so a lowered limit applies to the next packet
+  for(auto& [address, peer] : this->peers) {
+    peer.tokens = std::min(peer.tokens, getBurst(this->config.getRateLimit(address)));
+  }
+
+  return true;
+}
+
+json RelayQueue::getStats()
+{
+  std::lock_guard lg(this->mutex);
+
+  json peersJson = json::object();
+  for(const auto& [address, peer] : this->peers) {
+    peersJson[address.toString()] = json::object({
+        {"queued", peer.packets.size()},
+        {"sent_packets", peer.sentPackets},
+        {"sent_bytes", peer.sentBytes},
+        {"drops", peer.drops},
+        {"rate_limit", this->config.getRateLimit(address)},
+    });
+  }
+
+  return json::object({
+      {"drops", this->drops},
+      {"peers", peersJson},
+  });
+}
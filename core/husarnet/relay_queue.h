@@ -0,0 +1,100 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+#include "husarnet/ports/port_interface.h"
+
+#include "husarnet/ipaddress.h"
+#include "husarnet/string_view.h"
+
+#include "nlohmann/json.hpp"
+
+// Bytes every backlogged peer may send in a single deficit round robin turn
+const int RELAY_QUANTUM = 2000;
+// Rate limited peers may send this much above the rate in a burst (at least
+// two quanta)
+const int RELAY_BURST_MS = 50;
+// Packets queued per peer, the rest is tail dropped
+#ifdef ESP_PLATFORM
+const size_t RELAY_QUEUE_LIMIT = 16;
+#else
+const size_t RELAY_QUEUE_LIMIT = 256;
+#endif
+// Counters of peers that haven't been relayed to for that long are forgotten
+const Time RELAY_IDLE_TIMEOUT = 5 * 60 * 1000;
+
+struct RelayConfig {
+  // Per peer caps in bytes per second, 0 means unlimited
+  uint64_t rateLimit = 0;
+  std::unordered_map<HusarnetAddress, uint64_t, iphash> peerRateLimits;
+
+  static bool fromJson(const nlohmann::json& json, RelayConfig& config, std::string& error);
+  nlohmann::json toJson() const;
+
+  uint64_t getRateLimit(HusarnetAddress peer) const;
+};
+
+// Fair queueing of the DATA relayed through the base server. All the relayed
+// peers share a single stream, so whenever the stream can't take more (see
+// the ready callback) packets are queued per peer and sent out by deficit
+// round robin, every peer getting the same share. Peers may also be capped
+// with a token bucket. Packets go straight through while nothing is queued.
+class RelayQueue {
+ public:
+  using SendCallback = std::function<void(HusarnetAddress peer, string_view data)>;
+  using ReadyCallback = std::function<bool()>;
+
+ private:
+  struct PeerQueue {
+    std::deque<std::string> packets;
+    int deficit = 0;
+    int64_t tokens = 0;
+    Time lastRefill = 0;
+    Time lastActive = 0;
+    bool active = false;  // is in the round robin
+
+    uint64_t sentPackets = 0;
+    uint64_t sentBytes = 0;
+    uint64_t drops = 0;
+  };
+
+  std::mutex mutex;
+  RelayConfig config;
+  SendCallback sendCallback;
+  ReadyCallback readyCallback;
+
+  std::unordered_map<HusarnetAddress, PeerQueue, iphash> peers;
+  std::deque<HusarnetAddress> activePeers;
+  uint64_t drops = 0;
+
+  PeerQueue& getPeer(HusarnetAddress address, Time now);
+  void refill(HusarnetAddress address, PeerQueue& peer, Time now);
+  bool isRateLimited(HusarnetAddress address, const PeerQueue& peer) const;
+  Time getWait(HusarnetAddress address, const PeerQueue& peer) const;
+  void sendNow(HusarnetAddress address, PeerQueue& peer, string_view data);
+  Time drainLocked(Time now);
+
+ public:
+  RelayQueue(SendCallback sendCallback, ReadyCallback readyCallback);
+
+  // Sends or queues the packet. Returns in how many ms drain() should be
+  // called to send the rate limited packets (-1 if it's not needed).
+  Time send(HusarnetAddress peer, string_view data, Time now);
+  // Sends whatever the stream and the rate limits let through, returns the
+  // same as send()
+  Time drain(Time now);
+  // Forgets the idle peers
+  void cleanup(Time now);
+
+  nlohmann::json getConfig();
+  bool setConfig(const nlohmann::json& json, std::string& error);
+  nlohmann::json getStats();
+};
@@ -0,0 +1,108 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/ring_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+
+size_t RingBufferView::size() const
+{
+  return first.size() + second.size();
+}
+
+bool RingBufferView::isContiguous() const
+{
+  return second.size() == 0;
+}
+
+char RingBufferView::operator[](size_t index) const
+{
+  if(index < first.size()) {
+    return first[index];
+  }
+
+  return second[index - first.size()];
+}
+
+string_view RingBufferView::linearize(std::string& scratch) const
+{
+  if(isContiguous()) {
+    return first;
+  }
+
+  scratch.assign(first.data(), first.size());
+  scratch.append(second.data(), second.size());
+  return scratch;
+}
+
+RingBuffer::RingBuffer(size_t capacity) : storage(capacity)
+{
+}
+
+size_t RingBuffer::capacity() const
+{
+  return storage.size();
+}
+
+size_t RingBuffer::size() const
+{
+  return used;
+}
+
+size_t RingBuffer::available() const
+{
+  return storage.size() - used;
+}
+
+char* RingBuffer::writePointer()
+{
+  return storage.data() + (head + used) % storage.size();
+}
+
+size_t RingBuffer::writableSize() const
+{
+  size_t tail = (head + used) % storage.size();
+  if(used == storage.size()) {
+    return 0;
+  }
+
+  if(tail >= head) {
+    return storage.size() - tail;
+  }
+
+  return head - tail;
+}
+
+void RingBuffer::commit(size_t size)
+{
+  assert(size <= writableSize());
+  used += size;
+}
+
+RingBufferView RingBuffer::peek(size_t offset, size_t size) const
+{
+  assert(offset + size <= used);
+
+  size_t start = (head + offset) % storage.size();
+  size_t firstSize = std::min(size, storage.size() - start);
+
+  RingBufferView view;
+  view.first = string_view(storage.data() + start, firstSize);
+  view.second = string_view(storage.data(), size - firstSize);
+  return view;
+}
+
+void RingBuffer::consume(size_t size)
+{
+  assert(size <= used);
+  used -= size;
+
+  // Starting over from the beginning keeps the following reads (and frames)
+  // contiguous for as long as possible
+  if(used == 0) {
+    head = 0;
+  } else {
+    head = (head + size) % storage.size();
+  }
+}
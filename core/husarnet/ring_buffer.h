@@ -0,0 +1,48 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#pragma once
+#include <string>
+#include <vector>
+
+#include "husarnet/string_view.h"
+
+// Bytes stored in a RingBuffer, without copying them out. The second part is
+// non-empty only if they wrap around the end of the storage.
+struct RingBufferView {
+  string_view first;
+  string_view second;
+
+  size_t size() const;
+  bool isContiguous() const;
+  char operator[](size_t index) const;
+
+  // Returns the bytes as a single view, copying them to scratch only if they
+  // wrap around
+  string_view linearize(std::string& scratch) const;
+};
+
+// Fixed size byte FIFO for stream reassembly - consumed bytes are never moved,
+// reads go straight into the free space after the stored ones.
+class RingBuffer {
+ private:
+  std::vector<char> storage;
+  size_t head = 0;  // first stored byte
+  size_t used = 0;
+
+ public:
+  explicit RingBuffer(size_t capacity);
+
+  size_t capacity() const;
+  size_t size() const;
+  size_t available() const;
+
+  // Contiguous free space right after the stored bytes (may be shorter than
+  // available() if the free space wraps around) and marking it as written
+  char* writePointer();
+  size_t writableSize() const;
+  void commit(size_t size);
+
+  RingBufferView peek(size_t offset, size_t size) const;
+  void consume(size_t size);
+};
@@ -3,11 +3,15 @@
 // License: specified in project_root/LICENSE.txt
 #include "husarnet/security_layer.h"
 
+#include <algorithm>
+
 #include <sodium.h>
 
 #include "husarnet/ports/port.h"
 #include "husarnet/ports/port_interface.h"
+#include "husarnet/ports/sockets.h"
 
+#include "husarnet/fec.h"
 #include "husarnet/husarnet_config.h"
 #include "husarnet/logging.h"
 #include "husarnet/ngsocket_crypto.h"
@@ -21,14 +25,40 @@ static fstring<32> mixFlags(fstring<32> key, uint64_t flags1, uint64_t flags2)
   return res;
 }
 
-SecurityLayer::SecurityLayer(Identity* myIdentity, PeerFlags* myFlags, PeerContainer* peerContainer)
-    : myIdentity(myIdentity), myFlags(myFlags), peerContainer(peerContainer)
+// Separate key for the group packet tags, so the session key is never used
+// with more than one primitive
+static fstring<32> deriveGroupAuthKey(const fstring<32>& key)
+{
+  static const char context[] = "husarnet group auth";
+  fstring<32> res;
+  crypto_generichash(&res[0], res.size(), (const unsigned char*)context, sizeof(context) - 1, key.data(), key.size());
+  return res;
+}
+
+SecurityLayer::SecurityLayer(
+    Identity* myIdentity,
+    PeerFlags* myFlags,
+    PeerContainer* peerContainer,
+    int tunMtu,
+    int livenessInterval)
+    : myIdentity(myIdentity),
+      myFlags(myFlags),
+      peerContainer(peerContainer),
+      tunMtu(tunMtu),
+      livenessInterval(livenessInterval)
 {
   randombytes_buf(&this->helloseq, 8);
   this->helloseq = this->helloseq & BOOT_ID_MASK;
   this->decryptedBuffer.resize(2000);
   this->ciphertextBuffer.resize(2100);
   this->cleartextBuffer.resize(2010);
+
+  this->myFlags->setFlag(PeerFlag::groupKeys);
+  this->myFlags->setFlag(PeerFlag::coalescing);
+  this->myFlags->setFlag(PeerFlag::pathMtuDiscovery);
+  this->myFlags->setFlag(PeerFlag::livenessProbes);
+  randombytes_buf(&this->groupKey.id, sizeof(this->groupKey.id));
+  this->rotateGroupKey();
 }
 
 int SecurityLayer::getLatency(HusarnetAddress peerAddress)
@@ -75,7 +105,7 @@ void SecurityLayer::onLowerLayerData(HusarnetAddress peerAddress, string_view da
     return;  // sanity check
 
   // TODO Make a proper serializer/deserializer for this part of the protocol
-  if(data[0] == 0) {  // data packet
+  if(data[0] == 0 || data[0] == 8) {  // data packet or a coalesced frame
     if(data.size() <= 25)
       return;
     handleDataPacket(peerAddress, data);
@@ -95,6 +125,11 @@ void SecurityLayer::onLowerLayerData(HusarnetAddress peerAddress, string_view da
     } else {
       handleHeartbeatReply(peerAddress, ident);
     }
+  } else if(data[0] == 6 || data[0] == PATH_MTU_PROBE_PACKET_TYPE ||
+            data[0] == LIVENESS_PROBE_PACKET_TYPE) {  // sealed control packet
+    handleControlPacket(peerAddress, data);
+  } else if(data[0] == 7) {  // multicast sealed with the group key
+    handleGroupDataPacket(peerAddress, data);
   }
 }
 
@@ -132,12 +167,34 @@ void SecurityLayer::handleDataPacket(HusarnetAddress peerId, string_view data)
 
   if(r == 0) {
     peer->lastValidPacket = Port::getCurrentTime();
-    sendToUpperLayer(peerId, decryptedData);
+    peer->validPackets++;
+    if(data[0] == 8) {
+      handleCoalescedFrame(peerId, decryptedData);
+    } else {
+      sendToUpperLayer(peerId, decryptedData);
+    }
   } else {
     HLOG_INFO("received forged message from peer // {peer}", peerId.toString());
   }
 }
 
+void SecurityLayer::handleCoalescedFrame(HusarnetAddress source, string_view frame)
+{
+  size_t offset = 0;
+  while(offset + 2 <= frame.size()) {
+    size_t size = ((uint8_t)frame[offset] << 8) | (uint8_t)frame[offset + 1];
+    offset += 2;
+
+    if(offset + size > frame.size()) {
+      HLOG_WARNING("truncated coalesced frame // {peer}", source.toString());
+      return;
+    }
+
+    sendToUpperLayer(source, frame.substr(offset, size));
+    offset += size;
+  }
+}
+
 void SecurityLayer::sendHelloPacket(Peer* peer, int num, uint64_t helloseq)
 {
   assert(num == 1 || num == 2 || num == 3);
@@ -149,6 +206,16 @@ void SecurityLayer::sendHelloPacket(Peer* peer, int num, uint64_t helloseq)
   packet += pack(this->helloseq);
   packet += pack(helloseq);
   packet += pack(this->myFlags->asBin());
+  for(auto& [type, value] : this->helloExtensions) {
+    packet.push_back((char)type);
+    packet.push_back((char)value.size());
+    packet += value;
+  }
+  if(peer->sessionIndex != 0) {
+    packet.push_back((char)HelloExtension::sessionIndex);
+    packet.push_back((char)sizeof(uint32_t));
+    packet += pack(peer->sessionIndex);
+  }
   packet += NgSocketCrypto::sign(packet, "ng-kx-pubkey", this->myIdentity);
   sendToLowerLayer(peer->id, packet);
 }
@@ -205,6 +272,27 @@ void SecurityLayer::handleHelloPacket(HusarnetAddress target, string_view data,
 
   peer->flags = PeerFlags(flags_bin);
 
+  peer->helloExtensions.clear();
+  constexpr int extensionsOffset = 65 + 40;
+  if(data.size() > extensionsOffset + 64) {
+    auto extensions = data.substr(extensionsOffset, data.size() - extensionsOffset - 64);
+    for(size_t i = 0; i + 2 <= extensions.size();) {
+      size_t length = (uint8_t)extensions[i + 1];
+      if(i + 2 + length > extensions.size())
+        break;
+
+      peer->helloExtensions[HelloExtension(extensions[i])] = extensions.substr(i + 2, length).str();
+      i += 2 + length;
+    }
+  }
+
+  auto sessionIndex = peer->helloExtensions.find(HelloExtension::sessionIndex);
+  if(sessionIndex != peer->helloExtensions.end() && sessionIndex->second.size() == sizeof(uint32_t)) {
+    peer->remoteSessionIndex = unpack<uint32_t>(sessionIndex->second);
+  } else {
+    peer->remoteSessionIndex = 0;
+  }
+
   int r;
   // key exchange is asymmetric, pretend that device with smaller ID is a
   // client
@@ -240,6 +328,19 @@ void SecurityLayer::finishNegotiation(Peer* peer)
 {
   HLOG_INFO("established secure connection // {peer}", peer->getIpAddressString());
   peer->negotiated = true;
+  peer->groupAuthTxKey = deriveGroupAuthKey(peer->txKey);
+  peer->groupAuthRxKey = deriveGroupAuthKey(peer->rxKey);
+
+  // The other side may start its sequence numbers over as well
+  peer->fecEncoder = FecEncoder();
+  peer->fecDecoder = FecDecoder();
+  peer->reorderBuffer = ReorderBuffer();
+
+  peer->groupKeyAcked = 0;
+  if(supportsGroupKeys(peer)) {
+    sendGroupKey(peer);
+  }
+
   for(auto& packet : peer->packetQueue) {
     queuedPackets--;
     doSendDataPacket(peer, packet);
@@ -252,8 +353,16 @@ void SecurityLayer::onUpperLayerData(HusarnetAddress target, string_view data)
   Peer* peer = peerContainer->getOrCreatePeer(target);
   if(peer == nullptr)
     return;
+  peer->lastDataSent = Port::getCurrentTime();
   if(peer->negotiated) {
-    doSendDataPacket(peer, data);
+    std::lock_guard lg(this->coalescingMutex);
+    if(supportsCoalescing(peer) && data.size() <= COALESCING_MAX_PACKET_SIZE) {
+      coalescePacket(peer, data);
+    } else {
+      // keep the order - whatever is waiting goes first
+      flushCoalescedFrame(peer);
+      doSendDataPacket(peer, data);
+    }
   } else {
     if(queuedPackets < MAX_QUEUED_PACKETS) {
       queuedPackets++;
@@ -263,7 +372,73 @@ void SecurityLayer::onUpperLayerData(HusarnetAddress target, string_view data)
   }
 }
 
-void SecurityLayer::doSendDataPacket(Peer* peer, string_view data)
+void SecurityLayer::onUpperLayerFlush()
+{
+  {
+    std::lock_guard lg(this->coalescingMutex);
+    for(auto& [id, frame] : this->coalescedFrames) {
+      Peer* peer = peerContainer->getPeer(id);
+      if(peer != nullptr) {
+        sendCoalescedFrame(peer, frame);
+      }
+    }
+    this->coalescedFrames.clear();
+  }
+
+  flushLowerLayer();
+}
+
+bool SecurityLayer::supportsCoalescing(Peer* peer)
+{
+  return this->myFlags->checkFlag(PeerFlag::coalescing) && peer->flags.checkFlag(PeerFlag::coalescing);
+}
+
+void SecurityLayer::coalescePacket(Peer* peer, string_view data)
+{
+  auto now = std::chrono::steady_clock::now();
+  auto& frame = this->coalescedFrames[peer->id];
+
+  // The frame (length prefixes included) is never larger than a full size
+  // packet would be - the path MTU once it's known, the tun MTU otherwise
+  size_t maxFrameSize = peer->pathMtu > 0 ? peer->pathMtu : this->tunMtu;
+
+  if(frame.count > 0 && (frame.records.size() + 2 + data.size() > maxFrameSize ||
+                         now - frame.started > COALESCING_LATENCY_BUDGET)) {
+    sendCoalescedFrame(peer, frame);
+  }
+
+  if(frame.count == 0) {
+    frame.started = now;
+  }
+
+  frame.records += (char)(data.size() >> 8);
+  frame.records += (char)(data.size() & 0xFF);
+  frame.records += data;
+  frame.count++;
+}
+
+void SecurityLayer::sendCoalescedFrame(Peer* peer, CoalescedFrame& frame)
+{
+  if(frame.count == 1) {
+    // no point in the framing overhead
+    doSendDataPacket(peer, string_view(frame.records).substr(2));
+  } else if(frame.count > 1) {
+    doSendDataPacket(peer, frame.records, 8);
+  }
+
+  frame.records.clear();
+  frame.count = 0;
+}
+
+void SecurityLayer::flushCoalescedFrame(Peer* peer)
+{
+  auto it = this->coalescedFrames.find(peer->id);
+  if(it != this->coalescedFrames.end()) {
+    sendCoalescedFrame(peer, it->second);
+  }
+}
+
+void SecurityLayer::doSendDataPacket(Peer* peer, string_view data, char packetType)
 {
   uint64_t seqnum = 0;
   assert(data.size() < 10240);
@@ -278,7 +453,7 @@ void SecurityLayer::doSendDataPacket(Peer* peer, string_view data)
   memcpy(&cleartextBuffer[8], data.data(), data.size());
 
   int ciphertextSize = 1 + 24 + 16 + cleartextSize;
-  ciphertextBuffer[0] = 0;
+  ciphertextBuffer[0] = packetType;
 
   if(ciphertextSize >= ciphertextBuffer.size())
     return;
@@ -292,3 +467,503 @@ void SecurityLayer::doSendDataPacket(Peer* peer, string_view data)
 
   sendToLowerLayer(peer->id, string_view(ciphertextBuffer).substr(0, ciphertextSize));
 }
+
+void SecurityLayer::setHelloExtension(HelloExtension type, const std::string& value)
+{
+  assert(value.size() < 256);
+  this->helloExtensions[type] = value;
+}
+
+bool SecurityLayer::supportsGroupKeys(Peer* peer)
+{
+  return this->myFlags->checkFlag(PeerFlag::groupKeys) && peer->flags.checkFlag(PeerFlag::groupKeys);
+}
+
+void SecurityLayer::rotateGroupKey()
+{
+  this->previousGroupKey = this->groupKey;
+
+  this->groupKey.id++;
+  if(this->groupKey.id == 0) {
+    this->groupKey.id++;  // 0 means "no key"
+  }
+  crypto_secretbox_keygen(this->groupKey.key.data());
+  this->groupKey.created = Port::getCurrentTime();
+
+  // Peers get the new key along with the next multicast packet sent to them
+  HLOG_DEBUG("group key rotated // {key_id}", this->groupKey.id);
+}
+
+void SecurityLayer::sendGroupKey(Peer* peer)
+{
+  std::string body = pack(this->groupKey.id) + this->groupKey.key;
+  sendControlPacket(peer, SecurityControlKind::GROUP_KEY, body);
+  sodium_memzero(&body[0], body.size());
+
+  peer->groupKeySent = Port::getCurrentTime();
+}
+
+void SecurityLayer::onUpperLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data)
+{
+  // Only multicast may be sealed with a shared key - otherwise any member of
+  // the group could forge unicast traffic in the name of the others
+  if(data.size() < 2 || data[0] != (char)0xff || data[1] != 0x01) {
+    FromUpperConsumer::onUpperLayerFanout(peerAddresses, data);
+    return;
+  }
+
+  Time now = Port::getCurrentTime();
+  if(now - this->groupKey.created > GROUP_KEY_ROTATION_INTERVAL) {
+    rotateGroupKey();
+  }
+
+  std::vector<HusarnetAddress> currentKeyPeers;
+  std::vector<HusarnetAddress> previousKeyPeers;
+
+  for(auto& peerAddress : peerAddresses) {
+    Peer* peer = peerContainer->getOrCreatePeer(peerAddress);
+    if(peer == nullptr) {
+      continue;
+    }
+
+    if(!peer->negotiated || !supportsGroupKeys(peer)) {
+      onUpperLayerData(peerAddress, data);
+      continue;
+    }
+
+    // Full size packets would no longer fit the path
+    int maxSize = peer->pathMtu > 0 ? peer->pathMtu : this->tunMtu;
+    if((int)data.size() + GROUP_PACKET_EXTRA_SIZE > maxSize) {
+      doSendDataPacket(peer, data);
+      continue;
+    }
+
+    if(peer->groupKeyAcked == this->groupKey.id) {
+      currentKeyPeers.push_back(peerAddress);
+      continue;
+    }
+
+    if(now - peer->groupKeySent > GROUP_KEY_RESEND_INTERVAL) {
+      sendGroupKey(peer);
+    }
+
+    if(this->previousGroupKey.id != 0 && peer->groupKeyAcked == this->previousGroupKey.id) {
+      previousKeyPeers.push_back(peerAddress);
+    } else {
+      doSendDataPacket(peer, data);
+    }
+  }
+
+  sendGroupDataPacket(this->groupKey, currentKeyPeers, data);
+  sendGroupDataPacket(this->previousGroupKey, previousKeyPeers, data);
+}
+
+void SecurityLayer::sendGroupDataPacket(
+    const GroupKey& key,
+    const std::vector<HusarnetAddress>& peerIds,
+    string_view data)
+{
+  if(peerIds.empty()) {
+    return;
+  }
+
+  const int headerSize = 1 + 4 + 24;
+  int ciphertextSize = headerSize + crypto_secretbox_MACBYTES + (int)data.size();
+  if(ciphertextSize + crypto_auth_BYTES >= ciphertextBuffer.size())
+    return;
+
+  ciphertextBuffer[0] = 7;
+  packTo(key.id, &ciphertextBuffer[1]);
+
+  char* nonce = &ciphertextBuffer[5];
+  randombytes_buf(nonce, 24);
+
+  crypto_secretbox_easy(
+      (unsigned char*)&ciphertextBuffer[headerSize], (const unsigned char*)data.data(), data.size(),
+      (const unsigned char*)nonce, key.key.data());
+
+  // The seal is shared, the tag is pairwise - it's computed over the digest,
+  // so every extra receiver costs a hash of 32 bytes only
+  unsigned char digest[32];
+  crypto_generichash(
+      digest, sizeof(digest), (const unsigned char*)ciphertextBuffer.data(), ciphertextSize, nullptr, 0);
+
+  auto packet = string_view(ciphertextBuffer).substr(0, ciphertextSize + crypto_auth_BYTES);
+  for(auto& peerId : peerIds) {
+    Peer* peer = peerContainer->getPeer(peerId);
+    if(peer == nullptr) {
+      continue;
+    }
+
+    crypto_auth(
+        (unsigned char*)&ciphertextBuffer[ciphertextSize], digest, sizeof(digest), peer->groupAuthTxKey.data());
+    sendToLowerLayer(peerId, packet);
+  }
+}
+
+void SecurityLayer::handleGroupDataPacket(HusarnetAddress peerId, string_view data)
+{
+  const int headerSize = 1 + 4 + 24;
+  if(data.size() <= headerSize + crypto_secretbox_MACBYTES + crypto_auth_BYTES)
+    return;
+
+  Peer* peer = peerContainer->getOrCreatePeer(peerId);
+  if(peer == nullptr)
+    return;
+
+  if(!peer->negotiated) {
+    sendHelloPacket(peer);
+    HLOG_WARNING("received group packet before hello // {peer}", peerId.toString());
+    return;
+  }
+
+  uint32_t keyId = unpack<uint32_t>(substr<1, 4>(data));
+  const fstring<32>* key = nullptr;
+  if(keyId != 0 && keyId == peer->groupRxKeyId) {
+    key = &peer->groupRxKey;
+  } else if(keyId != 0 && keyId == peer->previousGroupRxKeyId) {
+    key = &peer->previousGroupRxKey;
+  }
+
+  if(key == nullptr) {
+    Time now = Port::getCurrentTime();
+    if(now - peer->lastGroupKeyRequest > GROUP_KEY_RESEND_INTERVAL) {
+      peer->lastGroupKeyRequest = now;
+      sendControlPacket(peer, SecurityControlKind::GROUP_KEY_REQUEST, pack(keyId));
+    }
+    return;
+  }
+
+  // Only the sender knows our pairwise key, other receivers of its group key
+  // can't pass as it
+  auto sealed = data.substr(0, data.size() - crypto_auth_BYTES);
+  unsigned char digest[32];
+  crypto_generichash(digest, sizeof(digest), (const unsigned char*)sealed.data(), sealed.size(), nullptr, 0);
+  if(crypto_auth_verify(
+         (const unsigned char*)&data[sealed.size()], digest, sizeof(digest), peer->groupAuthRxKey.data()) != 0) {
+    HLOG_INFO("received forged group message from peer // {peer}", peerId.toString());
+    return;
+  }
+
+  int decryptedSize = int(sealed.size()) - headerSize - crypto_secretbox_MACBYTES;
+  if(decryptedBuffer.size() < decryptedSize)
+    return;
+
+  int r = crypto_secretbox_open_easy(
+      (unsigned char*)&decryptedBuffer[0],
+      (unsigned char*)&sealed[headerSize],  // ciphertext
+      sealed.size() - headerSize,
+      (unsigned char*)&sealed[5],  // nonce
+      key->data());
+  if(r != 0) {
+    HLOG_INFO("received forged group message from peer // {peer}", peerId.toString());
+    return;
+  }
+
+  auto decryptedData = string_view(decryptedBuffer).substr(0, decryptedSize);
+  if(decryptedSize < 2 || decryptedData[0] != (char)0xff || decryptedData[1] != 0x01) {
+    HLOG_WARNING("non-multicast payload sealed with group key // {peer}", peerId.toString());
+    return;
+  }
+
+  peer->lastValidPacket = Port::getCurrentTime();
+  sendToUpperLayer(peerId, decryptedData);
+}
+
+void SecurityLayer::sendControlPacket(Peer* peer, SecurityControlKind kind, string_view body, char packetType)
+{
+  std::string cleartext;
+  cleartext.push_back((char)kind);
+  cleartext += body;
+
+  std::string packet(1 + 24 + crypto_secretbox_MACBYTES + cleartext.size(), 0);
+  packet[0] = packetType;
+
+  char* nonce = &packet[1];
+  randombytes_buf(nonce, 24);
+
+  crypto_secretbox_easy(
+      (unsigned char*)&packet[25], (const unsigned char*)cleartext.data(), cleartext.size(),
+      (const unsigned char*)nonce, peer->txKey.data());
+  sodium_memzero(&cleartext[0], cleartext.size());
+
+  sendToLowerLayer(peer->id, packet);
+}
+
+void SecurityLayer::handleControlPacket(HusarnetAddress peerId, string_view data)
+{
+  const int headerSize = 1 + 24 + crypto_secretbox_MACBYTES;
+  if(data.size() <= headerSize)
+    return;
+
+  Peer* peer = peerContainer->getOrCreatePeer(peerId);
+  if(peer == nullptr)
+    return;
+
+  if(!peer->negotiated) {
+    sendHelloPacket(peer);
+    return;
+  }
+
+  std::string cleartext(data.size() - headerSize, 0);
+  int r = crypto_secretbox_open_easy(
+      (unsigned char*)&cleartext[0], (unsigned char*)&data[25], data.size() - 25, (unsigned char*)&data[1],
+      peer->rxKey.data());
+  if(r != 0) {
+    HLOG_INFO("received forged control message from peer // {peer}", peerId.toString());
+    return;
+  }
+
+  peer->lastValidPacket = Port::getCurrentTime();
+  peer->validPackets++;
+
+  auto kind = SecurityControlKind(cleartext[0]);
+  auto body = string_view(cleartext).substr(1);
+
+  switch(kind) {
+    case SecurityControlKind::GROUP_KEY: {
+      if(body.size() < 4 + 32)
+        break;
+
+      uint32_t keyId = unpack<uint32_t>(body.substr(0, 4));
+      if(keyId == 0)
+        break;
+
+      if(keyId != peer->groupRxKeyId) {
+        peer->previousGroupRxKeyId = peer->groupRxKeyId;
+        peer->previousGroupRxKey = peer->groupRxKey;
+        peer->groupRxKeyId = keyId;
+        peer->groupRxKey = fstring<32>(body.substr(4, 32).data());
+      }
+      sendControlPacket(peer, SecurityControlKind::GROUP_KEY_ACK, pack(keyId));
+      break;
+    }
+    case SecurityControlKind::GROUP_KEY_ACK: {
+      if(body.size() < 4)
+        break;
+
+      uint32_t keyId = unpack<uint32_t>(body.substr(0, 4));
+      if(keyId == this->groupKey.id) {
+        peer->groupKeyAcked = keyId;
+      } else if(keyId == this->previousGroupKey.id && keyId != 0 && peer->groupKeyAcked != this->groupKey.id) {
+        peer->groupKeyAcked = keyId;
+      }
+      break;
+    }
+    case SecurityControlKind::GROUP_KEY_REQUEST:
+      if(supportsGroupKeys(peer) && Port::getCurrentTime() - peer->groupKeySent > GROUP_KEY_RESEND_INTERVAL) {
+        peer->groupKeyAcked = 0;
+        sendGroupKey(peer);
+      }
+      break;
+    case SecurityControlKind::PATH_MTU_PROBE:
+      if(body.size() < 2)
+        break;
+
+      sendControlPacket(peer, SecurityControlKind::PATH_MTU_PROBE_ACK, body.substr(0, 2));
+      break;
+    case SecurityControlKind::PATH_MTU_PROBE_ACK: {
+      if(body.size() < 2)
+        break;
+
+      int size = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+      if(peer->pmtuHigh == 0 || size != peer->pmtuProbeSize)
+        break;
+
+      peer->pmtuLow = size;
+      peer->pmtuProbeSize = 0;
+      updatePathMtu(peer);
+      break;
+    }
+    case SecurityControlKind::LIVENESS_PROBE:
+      if(body.size() < 8)
+        break;
+
+      // Whichever way, the answer is what counts
+      sendControlPacket(peer, SecurityControlKind::LIVENESS_PROBE_ACK, body.substr(0, 8));
+      break;
+    case SecurityControlKind::LIVENESS_PROBE_ACK: {
+      if(body.size() < 8)
+        break;
+
+      // Our own timestamp, authenticated along with the rest
+      double rtt = Port::getCurrentTime() - (Time)unpack<uint64_t>(body.substr(0, 8));
+      if(rtt < 0)
+        break;
+
+      peer->livenessRtt = peer->livenessRtt == 0 ? rtt : peer->livenessRtt + (rtt - peer->livenessRtt) / 8;
+      stopLivenessProbing(peer);
+      break;
+    }
+    default:
+      // Newer peers may know more kinds
+      break;
+  }
+
+  sodium_memzero(&cleartext[0], cleartext.size());
+}
+
+void SecurityLayer::periodic()
+{
+  peerContainer->forEachPeer([this](Peer* peer) {
+    updatePathMtu(peer);
+    updateLiveness(peer);
+  });
+}
+
+int SecurityLayer::getLivenessInterval() const
+{
+  return this->livenessInterval;
+}
+
+uint64_t SecurityLayer::getPathFailovers() const
+{
+  return this->pathFailovers;
+}
+
+bool SecurityLayer::supportsLivenessProbes(Peer* peer)
+{
+  return this->livenessInterval > 0 && peer->flags.checkFlag(PeerFlag::livenessProbes);
+}
+
+// The time of the last probe is kept, so they don't go out more often than
+// every interval even if the answers keep coming the other way
+void SecurityLayer::stopLivenessProbing(Peer* peer)
+{
+  peer->livenessProbingSince = 0;
+}
+
+// A lost direct path otherwise takes REESTABLISH_TIMEOUT (or a lot more if the
+// peer just went quiet) to notice. Traffic from the peer over the direct path
+// is as good as an answer, so the probes only go out while it's one way.
+// Relayed traffic doesn't count, it says nothing about the direct path.
+void SecurityLayer::updateLiveness(Peer* peer)
+{
+  Time now = Port::getCurrentTime();
+  if(!peer->negotiated || !peer->connected || !supportsLivenessProbes(peer) ||
+     now - peer->lastDataSent > LIVENESS_ACTIVE_WINDOW) {
+    stopLivenessProbing(peer);
+    return;
+  }
+
+  if(now - peer->lastTargetData < this->livenessInterval) {
+    stopLivenessProbing(peer);
+    OsSocket::limitNextTimeout(peer->lastTargetData + this->livenessInterval - now);
+    return;
+  }
+
+  if(peer->livenessProbingSince == 0) {
+    peer->livenessProbingSince = now;
+  }
+
+  double rtt = peer->livenessRtt > 0 ? peer->livenessRtt : LIVENESS_INITIAL_RTT;
+  Time detectTime = std::max<Time>(LIVENESS_DETECT_MULTIPLIER * this->livenessInterval, (Time)(2 * rtt));
+  if(now - peer->livenessProbingSince >= detectTime) {
+    HLOG_WARNING(
+        "direct path stopped answering, failing over // {peer} {address}", peer->getIpAddressString(),
+        peer->targetAddress.str());
+    this->pathFailovers++;
+    stopLivenessProbing(peer);
+
+    // Traffic goes through the base server and the next packet starts looking
+    // for a direct path again
+    peer->connected = false;
+    peer->reestablishing = false;
+    return;
+  }
+
+  if(peer->livenessProbeSent == 0 || now - peer->livenessProbeSent >= this->livenessInterval) {
+    peer->livenessProbeSent = now;
+    sendControlPacket(peer, SecurityControlKind::LIVENESS_PROBE, pack((uint64_t)now), LIVENESS_PROBE_PACKET_TYPE);
+  }
+
+  OsSocket::limitNextTimeout(
+      std::min(peer->livenessProbeSent + this->livenessInterval, peer->livenessProbingSince + detectTime) - now);
+}
+
+bool SecurityLayer::supportsPathMtuDiscovery(Peer* peer)
+{
+  return this->myFlags->checkFlag(PeerFlag::pathMtuDiscovery) && peer->flags.checkFlag(PeerFlag::pathMtuDiscovery);
+}
+
+void SecurityLayer::startPathMtuSearch(Peer* peer)
+{
+  peer->pmtuTargetAddress = peer->targetAddress;
+  peer->pmtuLow = TUN_MTU_MIN;
+  peer->pmtuHigh = this->tunMtu;
+  peer->pmtuProbeSize = 0;
+  peer->pmtuProbeAttempts = 0;
+}
+
+// Binary search over the tun packet sizes between the IPv6 minimum and our tun
+// MTU, one probe in flight at a time. Only direct paths are probed, relayed
+// traffic is left as is.
+void SecurityLayer::updatePathMtu(Peer* peer)
+{
+  if(!peer->negotiated || !peer->connected || !supportsPathMtuDiscovery(peer)) {
+    return;
+  }
+
+  Time now = Port::getCurrentTime();
+
+  if(peer->targetAddress != peer->pmtuTargetAddress) {
+    peer->pathMtu = 0;
+    startPathMtuSearch(peer);
+  } else if(peer->pmtuHigh == 0) {
+    if(now - peer->pmtuSearchFinished < PATH_MTU_RESEARCH_INTERVAL) {
+      return;
+    }
+    startPathMtuSearch(peer);
+  }
+
+  if(peer->pmtuProbeSize != 0) {
+    if(now - peer->pmtuProbeSent < PATH_MTU_PROBE_TIMEOUT) {
+      return;
+    }
+
+    if(peer->pmtuProbeAttempts < PATH_MTU_PROBE_ATTEMPTS) {
+      sendPathMtuProbe(peer, peer->pmtuProbeSize);
+      return;
+    }
+
+    peer->pmtuHigh = peer->pmtuProbeSize - 1;
+    peer->pmtuProbeSize = 0;
+  }
+
+  if(peer->pmtuHigh - peer->pmtuLow < PATH_MTU_PRECISION) {
+    // Even if the minimum didn't get through there is nothing smaller to use
+    if(peer->pathMtu != peer->pmtuLow) {
+      HLOG_INFO("path MTU discovered // {peer} {mtu}", peer->getIpAddressString(), peer->pmtuLow);
+    }
+    peer->pathMtu = peer->pmtuLow;
+    peer->pmtuHigh = 0;
+    peer->pmtuSearchFinished = now;
+    return;
+  }
+
+  peer->pmtuProbeAttempts = 0;
+  sendPathMtuProbe(peer, (peer->pmtuLow + peer->pmtuHigh + 1) / 2);
+}
+
+// Padded so the datagram is exactly as big as the one carrying a tun packet
+// of the given size would be (header compression aside): that one loses the
+// 40 byte IPv6 header, gains the protocol byte, up to 2 bytes of compression
+// framing and the 8 byte sequence number, the probe carries its kind byte.
+// With FEC it's also padded to the size of a parity packet protecting it.
+void SecurityLayer::sendPathMtuProbe(Peer* peer, int size)
+{
+  std::string body(size - 30 + (supportsFec(peer) ? FEC_PARITY_HEADER_SIZE : 0), 0);
+  body[0] = (char)(size >> 8);
+  body[1] = (char)(size & 0xFF);
+
+  peer->pmtuProbeSize = size;
+  peer->pmtuProbeSent = Port::getCurrentTime();
+  peer->pmtuProbeAttempts++;
+
+  sendControlPacket(peer, SecurityControlKind::PATH_MTU_PROBE, body, PATH_MTU_PROBE_PACKET_TYPE);
+}
+
+bool SecurityLayer::supportsFec(Peer* peer)
+{
+  return this->myFlags->checkFlag(PeerFlag::fec) && peer->flags.checkFlag(PeerFlag::fec);
+}
@@ -2,6 +2,15 @@
 // Authors: listed in project_root/README.md
 // License: specified in project_root/LICENSE.txt
 #pragma once
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "husarnet/ports/port_interface.h"
+
 #include "husarnet/identity.h"
 #include "husarnet/ipaddress.h"
 #include "husarnet/layer_interfaces.h"
@@ -11,11 +20,69 @@
 
 const uint64_t BOOT_ID_MASK = 0xFFFFFFFF00000000ull;
 
+const int GROUP_KEY_ROTATION_INTERVAL = 10 * 60 * 1000;
+const int GROUP_KEY_RESEND_INTERVAL = 1000;
+// Group packet ([7][key id][nonce][secretbox][tag]) is that much larger than
+// the unicast one ([0][nonce][secretbox of seqnum + payload]) with the same
+// payload
+const int GROUP_PACKET_EXTRA_SIZE = (1 + 4 + 24 + 16 + 32) - (1 + 24 + 16 + 8);
+
+// Packets up to this size are coalesced into a single sealed frame with other
+// packets for the same peer from the same burst
+const int COALESCING_MAX_PACKET_SIZE = 256;
+// Longest a packet may wait for the others to join its frame
+const auto COALESCING_LATENCY_BUDGET = std::chrono::microseconds(200);
+
+const int PATH_MTU_PROBE_TIMEOUT = 1000;
+const int PATH_MTU_PROBE_ATTEMPTS = 2;
+// Search stops once the bounds are this close
+const int PATH_MTU_PRECISION = 8;
+const int PATH_MTU_RESEARCH_INTERVAL = 10 * 60 * 1000;
+
+// Direct path is declared down once the probes went unanswered for that many
+// intervals (or twice the probe round trip, whichever is longer)
+const int LIVENESS_DETECT_MULTIPLIER = 3;
+// Probe round trip assumed until one is measured, as LTE, satellite links or
+// a probe queued behind a bulk upload may easily take that long
+const int LIVENESS_INITIAL_RTT = 1000;
+// Probing only goes on while the peer was sent data that recently
+const int LIVENESS_ACTIVE_WINDOW = 1000;
+
+// Subtypes of the sealed control packets
+enum class SecurityControlKind : uint8_t
+{
+  GROUP_KEY = 1,
+  GROUP_KEY_ACK = 2,
+  GROUP_KEY_REQUEST = 3,
+  PATH_MTU_PROBE = 4,
+  PATH_MTU_PROBE_ACK = 5,
+  LIVENESS_PROBE = 6,
+  LIVENESS_PROBE_ACK = 7,
+};
+
+// Packets waiting for the end of the burst. Each one is prefixed with its
+// 16 bit length.
+struct CoalescedFrame {
+  std::string records;
+  int count = 0;
+  std::chrono::steady_clock::time_point started;
+};
+
+struct GroupKey {
+  uint32_t id = 0;
+  fstring<32> key;
+  Time created = 0;
+};
+
 class SecurityLayer : public BidirectionalLayer {
  private:
   Identity* myIdentity;
   PeerFlags* myFlags;
   PeerContainer* peerContainer;
+  int tunMtu;
+  int livenessInterval;
+
+  uint64_t pathFailovers = 0;
 
   std::string decryptedBuffer;
   std::string ciphertextBuffer;
@@ -25,23 +92,81 @@ class SecurityLayer : public BidirectionalLayer {
 
   int queuedPackets = 0;
 
+  // Multicast is sealed once with our own group key, which is handed to the
+  // peers over their pairwise sessions. The previous key stays in use for the
+  // peers that haven't confirmed the current one yet.
+  GroupKey groupKey;
+  GroupKey previousGroupKey;
+
+  std::map<HelloExtension, std::string> helloExtensions;
+
+  // Multicast reaches onUpperLayerData straight from the tun reader thread
+  // on some platforms, while the scheduler drains unicast from the main loop
+  std::mutex coalescingMutex;
+  std::unordered_map<HusarnetAddress, CoalescedFrame, iphash> coalescedFrames;
+
   void handleHeartbeat(HusarnetAddress source, fstring<8> ident);
   void handleHeartbeatReply(HusarnetAddress source, fstring<8> ident);
 
   void handleDataPacket(HusarnetAddress source, string_view data);
+  void handleCoalescedFrame(HusarnetAddress source, string_view frame);
 
   void sendHelloPacket(Peer* peer, int num = 1, uint64_t helloseq = 0);
 
   void handleHelloPacket(HusarnetAddress target, string_view data, int helloNum);
   void finishNegotiation(Peer* peer);
 
-  void doSendDataPacket(Peer* peer, string_view data);
+  void doSendDataPacket(Peer* peer, string_view data, char packetType = 0);
+
+  bool supportsCoalescing(Peer* peer);
+  // The ones below have to be called with coalescingMutex held
+  void coalescePacket(Peer* peer, string_view data);
+  void sendCoalescedFrame(Peer* peer, CoalescedFrame& frame);
+  void flushCoalescedFrame(Peer* peer);
+
+  bool supportsGroupKeys(Peer* peer);
+  void rotateGroupKey();
+  void sendGroupKey(Peer* peer);
+  void sendGroupDataPacket(const GroupKey& key, const std::vector<HusarnetAddress>& peerIds, string_view data);
+  void handleGroupDataPacket(HusarnetAddress source, string_view data);
+
+  void sendControlPacket(Peer* peer, SecurityControlKind kind, string_view body, char packetType = 6);
+  void handleControlPacket(HusarnetAddress source, string_view data);
+
+  bool supportsPathMtuDiscovery(Peer* peer);
+  void startPathMtuSearch(Peer* peer);
+  void updatePathMtu(Peer* peer);
+  void sendPathMtuProbe(Peer* peer, int size);
+
+  bool supportsFec(Peer* peer);
+
+  bool supportsLivenessProbes(Peer* peer);
+  void updateLiveness(Peer* peer);
+  void stopLivenessProbing(Peer* peer);
 
  public:
-  SecurityLayer(Identity* myIdentity, PeerFlags* myFlags, PeerContainer* peerContainer);
+  // livenessInterval is in ms, 0 disables the liveness probes (they are still
+  // answered)
+  SecurityLayer(
+      Identity* myIdentity,
+      PeerFlags* myFlags,
+      PeerContainer* peerContainer,
+      int tunMtu,
+      int livenessInterval);
+
+  // Drives path MTU discovery and the liveness probes
+  void periodic();
 
   void onUpperLayerData(HusarnetAddress peerAddress, string_view data) override;
+  void onUpperLayerFanout(const std::vector<HusarnetAddress>& peerAddresses, string_view data) override;
+  void onUpperLayerFlush() override;
   void onLowerLayerData(HusarnetAddress peerAddress, string_view data) override;
 
   int getLatency(HusarnetAddress peerAddress);
+  int getLivenessInterval() const;
+  // Direct paths declared down by the liveness probes
+  uint64_t getPathFailovers() const;
+
+  // Value has to be shorter than 256 bytes
+  void setHelloExtension(HelloExtension type, const std::string& value);
 };
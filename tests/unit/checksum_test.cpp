@@ -0,0 +1,48 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/checksum.h"
+
+#include <catch2/catch_all.hpp>
+
+TEST_CASE("checksum incremental update matches a full recalculation")
+{
+  std::string data("\x45\x00\x00\x73\x00\x00\x40\x00\x40\x11\x00\x00\xc0\xa8\x00\x01", 16);
+
+  uint16_t checksum = checksumFinish(checksumAdd(0, data));
+
+  for(uint16_t newValue : {0x0000, 0x05b4, 0x04c4, 0xffff}) {
+    std::string changed = data;
+    uint16_t oldValue = ((uint8_t)data[2] << 8) | (uint8_t)data[3];
+    changed[2] = (char)(newValue >> 8);
+    changed[3] = (char)(newValue & 0xFF);
+
+    REQUIRE(checksumAdjust(checksum, oldValue, newValue) == checksumFinish(checksumAdd(0, changed)));
+  }
+}
+
+TEST_CASE("checksum incremental update of an ipv6 payload")
+{
+  std::string src(16, 0);
+  std::string dst(16, 0);
+  src[0] = (char)0xfc;
+  src[1] = (char)0x94;
+  src[15] = 1;
+  dst[0] = (char)0xfc;
+  dst[1] = (char)0x94;
+  dst[15] = 2;
+
+  std::string segment(24, 0);
+  segment[12] = 6 << 4;
+  segment[13] = 0x02;  // SYN
+  segment[20] = 2;     // MSS option
+  segment[21] = 4;
+  segment[22] = (char)0x05;
+  segment[23] = (char)0xa0;  // 1440
+
+  uint16_t checksum = ipv6PayloadChecksum(src, dst, 6, segment);
+
+  segment[22] = (char)0x04;
+  segment[23] = (char)0xc4;  // 1220
+  REQUIRE(checksumAdjust(checksum, 1440, 1220) == ipv6PayloadChecksum(src, dst, 6, segment));
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/compression.h"
+
+#include <string>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+#ifdef WITH_ZSTD
+#include "zdict.h"
+#endif
+
+static std::string makeText(int i)
+{
+  std::string text;
+  for(int j = 0; j < 8; j++) {
+    text += "GET /api/v1/status?node=" + std::to_string(i * 8 + j) + " HTTP/1.1\r\nHost: husarnet.local\r\n";
+  }
+  return text;
+}
+
+static std::string roundTrip(CompressionCodec& receiver, string_view frame)
+{
+  // The frame may point into the sender's buffer
+  std::string copy = frame.str();
+  string_view packet;
+  REQUIRE(receiver.decode(copy, packet));
+  return packet.str();
+}
+
+TEST_CASE("compression framing passes raw packets through")
+{
+  CompressionCodec sender(1), receiver(1);
+
+  std::string packet = "\x45\x00 plain packet";
+  string_view frame;
+  REQUIRE(sender.encodeRaw(packet, frame));
+  REQUIRE(frame.str() == packet);
+  REQUIRE(roundTrip(receiver, frame) == packet);
+
+  std::string empty;
+  REQUIRE(sender.encodeRaw(empty, frame));
+  REQUIRE(roundTrip(receiver, frame) == empty);
+}
+
+TEST_CASE("compression framing escapes packets starting with the marker")
+{
+  CompressionCodec sender(1), receiver(1);
+
+  std::string packet = std::string("\xFE\x01", 2) + "not a zstd frame";
+  string_view frame;
+  REQUIRE(sender.encodeRaw(packet, frame));
+  REQUIRE((frame.size() == packet.size() + 2));
+  REQUIRE(roundTrip(receiver, frame) == packet);
+}
+
+TEST_CASE("compression framing rejects malformed frames")
+{
+  CompressionCodec receiver(1);
+  string_view packet;
+
+  std::string truncated("\xFE", 1);
+  REQUIRE(!receiver.decode(truncated, packet));
+
+  std::string unknown("\xFE\x7F garbage", 10);
+  REQUIRE(!receiver.decode(unknown, packet));
+
+  std::string broken("\xFE\x01 garbage", 10);
+  REQUIRE(!receiver.decode(broken, packet));
+}
+
+#ifdef WITH_ZSTD
+TEST_CASE("compression framing round trips zstd frames")
+{
+  CompressionCodec sender(1), receiver(1);
+
+  std::string packet = makeText(0);
+  string_view frame;
+  REQUIRE(sender.encodeCompressed(packet, false, frame));
+  REQUIRE((frame.size() < packet.size()));
+  REQUIRE(roundTrip(receiver, frame) == packet);
+
+  // Random-ish data doesn't save enough to be sent compressed
+  std::string noise;
+  uint32_t state = 1;
+  for(int i = 0; i < 1000; i++) {
+    state = state * 1103515245 + 12345;
+    noise.push_back((char)(state >> 24));
+  }
+  REQUIRE(!sender.encodeCompressed(noise, false, frame));
+}
+
+TEST_CASE("compression framing round trips frames using the dictionary")
+{
+  std::string samples;
+  std::vector<size_t> sampleSizes;
+  for(int i = 0; i < 200; i++) {
+    auto sample = makeText(i);
+    samples += sample;
+    sampleSizes.push_back(sample.size());
+  }
+
+  std::string dictionary(4096, 0);
+  size_t size = ZDICT_trainFromBuffer(
+      &dictionary[0], dictionary.size(), samples.data(), sampleSizes.data(), (unsigned)sampleSizes.size());
+  REQUIRE(!ZDICT_isError(size));
+  dictionary.resize(size);
+
+  CompressionCodec sender(1), receiver(1), stranger(1);
+  REQUIRE(sender.loadDictionary(dictionary));
+  REQUIRE(receiver.loadDictionary(dictionary));
+  REQUIRE((sender.getDictionaryId() != 0));
+  REQUIRE((sender.getDictionaryId() == receiver.getDictionaryId()));
+
+  std::string packet = makeText(1000);
+  string_view frame;
+  REQUIRE(sender.encodeCompressed(packet, true, frame));
+  std::string copy = frame.str();
+
+  string_view withoutDictionary;
+  REQUIRE(sender.encodeCompressed(packet, false, withoutDictionary));
+  REQUIRE((copy.size() <= withoutDictionary.size()));
+
+  REQUIRE(roundTrip(receiver, copy) == packet);
+
+  // Peer without the dictionary can't decode it
+  string_view decoded;
+  REQUIRE(!stranger.decode(copy, decoded));
+  REQUIRE(!stranger.encodeCompressed(packet, true, frame));
+
+  // Raw content dictionaries have no id
+  CompressionCodec raw(1);
+  REQUIRE(!raw.loadDictionary("just some text without the zstd dictionary header"));
+  REQUIRE((raw.getDictionaryId() == 0));
+}
+#endif
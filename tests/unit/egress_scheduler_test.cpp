@@ -0,0 +1,130 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/egress_scheduler.h"
+
+#include <catch2/catch_all.hpp>
+
+static std::string ipv6Packet(uint8_t dscp, uint8_t ecn, uint8_t protocol, uint16_t destinationPort)
+{
+  std::string packet(48, 0);
+  uint8_t trafficClass = (dscp << 2) | ecn;
+  packet[0] = (char)(0x60 | (trafficClass >> 4));
+  packet[1] = (char)((trafficClass & 0x0F) << 4);
+  packet[6] = (char)protocol;
+  packet[40] = (char)0xC3;  // source port 50000
+  packet[41] = (char)0x50;
+  packet[42] = (char)(destinationPort >> 8);
+  packet[43] = (char)(destinationPort & 0xFF);
+  return packet;
+}
+
+TEST_CASE("scheduler default classes")
+{
+  auto config = SchedulerConfig::defaults();
+  REQUIRE(config.classes[config.classify(ipv6Packet(46, 0, 17, 1000))].name == "control");
+  REQUIRE(config.classes[config.classify(ipv6Packet(8, 0, 6, 1000))].name == "bulk");
+  REQUIRE(config.classes[config.classify(ipv6Packet(0, 0, 6, 1000))].name == "default");
+}
+
+TEST_CASE("scheduler config from json")
+{
+  auto json = nlohmann::json::parse(R"({
+    "rate_limit": 1000000,
+    "classes": [
+      {"name": "bulk", "priority": 1, "weight": 1, "dscp": [8]},
+      {"name": "teleop", "priority": 0, "ports": [9090]},
+      {"name": "rest", "priority": 1, "weight": 3}
+    ]
+  })");
+
+  SchedulerConfig config;
+  std::string error;
+  REQUIRE(SchedulerConfig::fromJson(json, config, error));
+  REQUIRE(config.rateLimit == 1000000);
+
+  // sorted by priority, keeping the order within one
+  REQUIRE(config.classes[0].name == "teleop");
+  REQUIRE(config.classes[1].name == "bulk");
+  REQUIRE(config.classes[2].name == "rest");
+
+  REQUIRE(config.classify(ipv6Packet(8, 0, 6, 9090)) == 0);
+  REQUIRE(config.classify(ipv6Packet(8, 0, 6, 22)) == 1);
+  REQUIRE(config.classify(ipv6Packet(0, 0, 58, 9090)) == 2);  // no ports in ICMPv6
+
+  SchedulerConfig roundTrip;
+  REQUIRE(SchedulerConfig::fromJson(config.toJson(), roundTrip, error));
+  REQUIRE(roundTrip.toJson() == config.toJson());
+}
+
+TEST_CASE("scheduler config rejects invalid values")
+{
+  SchedulerConfig config;
+  std::string error;
+
+  REQUIRE(!SchedulerConfig::fromJson(nlohmann::json::parse(R"({"classes": []})"), config, error));
+  REQUIRE(!SchedulerConfig::fromJson(
+      nlohmann::json::parse(R"({"classes": [{"name": "a", "dscp": [64]}]})"), config, error));
+  REQUIRE(!SchedulerConfig::fromJson(
+      nlohmann::json::parse(R"({"classes": [{"name": "a", "weight": 0}]})"), config, error));
+  REQUIRE(!SchedulerConfig::fromJson(
+      nlohmann::json::parse(R"({"rate_limit": -1, "classes": [{"name": "a"}]})"), config, error));
+  REQUIRE(!error.empty());
+}
+
+TEST_CASE("codel passes a short queue")
+{
+  CoDelQueue queue;
+  for(int i = 0; i < 3; i++) {
+    queue.push(ipv6Packet(0, 0, 17, 1), 0);
+  }
+
+  std::string packet;
+  for(int i = 0; i < 3; i++) {
+    REQUIRE(queue.pop(1000, packet));
+  }
+  REQUIRE(!queue.pop(1000, packet));
+  REQUIRE(queue.getDrops() == 0);
+}
+
+// Every packet spends 50 ms in the queue, so after the interval CoDel starts
+// dropping (or marking the ECN capable ones) at an increasing rate
+static void standingQueue(CoDelQueue& queue, uint8_t ecn, int& delivered, int& congested)
+{
+  std::string packet;
+  delivered = 0;
+  congested = 0;
+  for(Time now = 0; now < 2000; now++) {
+    queue.push(ipv6Packet(0, ecn, 17, 1) + std::string(1000, 'x'), now);
+    if(now >= 50 && queue.pop(now, packet)) {
+      delivered++;
+      if((((uint8_t)packet[1] >> 4) & 0x03) == 3) {
+        congested++;
+      }
+    }
+  }
+}
+
+TEST_CASE("codel drops from a standing queue")
+{
+  CoDelQueue queue;
+  int delivered, congested;
+  standingQueue(queue, 0, delivered, congested);
+
+  REQUIRE(queue.getDrops() > 10);
+  REQUIRE(queue.getMarks() == 0);
+  REQUIRE(congested == 0);
+  REQUIRE(queue.size() < 20);
+}
+
+TEST_CASE("codel marks ECN capable packets")
+{
+  CoDelQueue queue;
+  int delivered, congested;
+  standingQueue(queue, 2, delivered, congested);
+
+  REQUIRE(queue.getDrops() == 0);
+  REQUIRE(queue.getMarks() > 10);
+  REQUIRE(congested == (int)queue.getMarks());
+  REQUIRE(delivered == 1950);
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/epoch.h"
+
+#include <atomic>
+#include <thread>
+
+#include <catch2/catch_all.hpp>
+
+// Whatever the previous tests left retired is freed, so the epoch only moves
+// because of what the test retires itself
+static void drain()
+{
+  bool done = false;
+  Epoch::retire([&done]() { done = true; });
+  while(!done) {
+    Epoch::reclaim();
+  }
+}
+
+// Reader thread that holds a guard (nested if asked to) until told to leave
+class Reader {
+ private:
+  std::atomic<int> state{0};
+  std::thread thread;
+
+  void waitFor(int value)
+  {
+    while(this->state.load() != value) {
+      std::this_thread::yield();
+    }
+  }
+
+ public:
+  explicit Reader(bool nested)
+  {
+    this->thread = std::thread([this, nested]() {
+      EpochGuard outer;
+      if(nested) {
+        {
+          EpochGuard inner;
+          this->state = 1;
+          waitFor(2);
+        }
+        // Leaving the inner guard must not end the critical section
+        this->state = 3;
+      } else {
+        this->state = 3;
+      }
+      waitFor(4);
+    });
+
+    if(nested) {
+      waitFor(1);
+    } else {
+      waitFor(3);
+    }
+  }
+
+  void leaveInner()
+  {
+    this->state = 2;
+    waitFor(3);
+  }
+
+  void leave()
+  {
+    this->state = 4;
+    this->thread.join();
+  }
+};
+
+TEST_CASE("epoch frees a retired object after two epochs")
+{
+  drain();
+
+  bool freed = false;
+  Epoch::retire([&freed]() { freed = true; });
+
+  Epoch::reclaim();
+  REQUIRE(!freed);
+  Epoch::reclaim();
+  REQUIRE(freed);
+}
+
+TEST_CASE("epoch keeps a retired object while a reader is inside")
+{
+  drain();
+
+  Reader reader(false);
+
+  bool freed = false;
+  Epoch::retire([&freed]() { freed = true; });
+  for(int i = 0; i < 10; i++) {
+    Epoch::reclaim();
+  }
+  REQUIRE(!freed);
+
+  reader.leave();
+  for(int i = 0; i < 2 && !freed; i++) {
+    Epoch::reclaim();
+  }
+  REQUIRE(freed);
+}
+
+TEST_CASE("epoch nested guards end with the outermost one")
+{
+  drain();
+
+  Reader reader(true);
+
+  bool freed = false;
+  Epoch::retire([&freed]() { freed = true; });
+  for(int i = 0; i < 10; i++) {
+    Epoch::reclaim();
+  }
+  REQUIRE(!freed);
+
+  reader.leaveInner();
+  for(int i = 0; i < 10; i++) {
+    Epoch::reclaim();
+  }
+  REQUIRE(!freed);
+
+  reader.leave();
+  for(int i = 0; i < 2 && !freed; i++) {
+    Epoch::reclaim();
+  }
+  REQUIRE(freed);
+}
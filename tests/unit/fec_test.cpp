@@ -0,0 +1,219 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/fec.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+static std::string makeReport(uint16_t loss, uint32_t counter)
+{
+  std::string report(FEC_REPORT_SIZE, 0);
+  report[0] = FEC_REPORT_PACKET_TYPE;
+  for(int i = 0; i < 4; i++) {
+    report[1 + i] = (char)(counter >> (24 - i * 8));
+  }
+  report[5] = (char)(loss >> 8);
+  report[6] = (char)(loss & 0xFF);
+  return report;
+}
+
+static std::string makePacket(int i)
+{
+  // Different lengths, so recovering the length is tested as well
+  return std::string(100 + i * 7, (char)('a' + i));
+}
+
+// Encodes the packets with the given group size, drops the ones marked as
+// lost on the way and returns what the decoder delivered
+static std::vector<std::string>
+transmit(FecEncoder& encoder, FecDecoder& decoder, int count, const std::vector<int>& lost)
+{
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    delivered.push_back(packet.str());
+    return true;
+  };
+
+  std::string framed, parity;
+  for(int i = 0; i < count; i++) {
+    encoder.encode(makePacket(i), 0, framed, parity);
+    if(std::find(lost.begin(), lost.end(), i) == lost.end()) {
+      decoder.decode(framed, deliver);
+    }
+    if(!parity.empty()) {
+      decoder.decode(parity, deliver);
+    }
+  }
+
+  return delivered;
+}
+
+TEST_CASE("fec group size follows the loss")
+{
+  REQUIRE(fecGroupSize(0) == 0);
+  REQUIRE(fecGroupSize(0.01) == 16);
+  REQUIRE(fecGroupSize(0.03) == 8);
+  REQUIRE(fecGroupSize(0.2) == 4);
+
+  FecEncoder encoder;
+  REQUIRE(encoder.getGroupSize() == 0);
+  encoder.handleReport(makeReport(1000, 1));  // 10%, smoothed to 5%
+  REQUIRE(encoder.getGroupSize() == 4);
+  for(int i = 0; i < 4; i++) {
+    encoder.handleReport(makeReport(0, 2 + i));
+  }
+  REQUIRE(encoder.getGroupSize() == 0);
+}
+
+TEST_CASE("fec without parity only frames the packets")
+{
+  FecEncoder encoder;
+  FecDecoder decoder;
+
+  auto delivered = transmit(encoder, decoder, 10, {3});
+  REQUIRE(delivered.size() == 9);
+  REQUIRE(delivered[3] == makePacket(4));
+  REQUIRE(decoder.getRecovered() == 0);
+}
+
+TEST_CASE("fec recovers a single loss per group")
+{
+  FecEncoder encoder;
+  FecDecoder decoder;
+  encoder.handleReport(makeReport(2000, 1));
+  REQUIRE(encoder.getGroupSize() == 4);
+
+  // Packet 1 is recovered once the parity of its group arrives, packet 7 as
+  // well (the last one of its group), 8 and 9 share the group so they are not
+  auto delivered = transmit(encoder, decoder, 12, {1, 7, 8, 9});
+  REQUIRE(decoder.getRecovered() == 2);
+  REQUIRE(delivered.size() == 10);
+  REQUIRE(delivered[3] == makePacket(1));
+  REQUIRE(delivered[7] == makePacket(7));
+}
+
+TEST_CASE("fec drops duplicates of the recovered packets")
+{
+  FecEncoder encoder;
+  FecDecoder decoder;
+  encoder.handleReport(makeReport(2000, 1));
+
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    delivered.push_back(packet.str());
+    return true;
+  };
+
+  std::string framed[4], parity;
+  for(int i = 0; i < 4; i++) {
+    encoder.encode(makePacket(i), 0, framed[i], parity);
+  }
+  REQUIRE(!parity.empty());
+
+  decoder.decode(framed[0], deliver);
+  decoder.decode(framed[1], deliver);
+  decoder.decode(framed[3], deliver);
+  decoder.decode(parity, deliver);
+  decoder.decode(framed[2], deliver);  // late, already recovered
+  decoder.decode(framed[0], deliver);
+
+  REQUIRE(delivered.size() == 4);
+  REQUIRE(delivered[3] == makePacket(2));
+}
+
+TEST_CASE("fec closes an incomplete group after the timeout")
+{
+  FecEncoder encoder;
+  encoder.handleReport(makeReport(2000, 1));
+
+  std::string framed, parity;
+  encoder.encode(makePacket(0), 100, framed, parity);
+  encoder.encode(makePacket(1), 105, framed, parity);
+  REQUIRE(parity.empty());
+  REQUIRE(encoder.getDeadline() == 100 + FEC_GROUP_TIMEOUT);
+
+  REQUIRE(!encoder.expire(110, parity));
+  REQUIRE(encoder.expire(100 + FEC_GROUP_TIMEOUT, parity));
+  REQUIRE(parity[3] == 2);
+  REQUIRE(encoder.getDeadline() == -1);
+}
+
+TEST_CASE("fec decoder reports the loss")
+{
+  FecEncoder encoder;
+  FecDecoder decoder;
+
+  std::vector<int> lost;
+  for(int i = 0; i < 100; i += 10) {
+    lost.push_back(i + 5);
+  }
+  transmit(encoder, decoder, 100, lost);
+
+  std::string report;
+  REQUIRE(decoder.takeReport(FEC_REPORT_INTERVAL, report));
+  REQUIRE(!decoder.takeReport(FEC_REPORT_INTERVAL + 1, report));
+
+  encoder.handleReport(report);
+  REQUIRE(encoder.getLoss() == Catch::Approx(0.05));
+  REQUIRE(encoder.getGroupSize() == 4);
+}
+
+TEST_CASE("fec ignores replayed reports")
+{
+  FecEncoder encoder;
+  encoder.handleReport(makeReport(2000, 5));
+  REQUIRE(encoder.getGroupSize() == 4);
+
+  encoder.handleReport(makeReport(0, 5));
+  encoder.handleReport(makeReport(0, 4));
+  REQUIRE(encoder.getLoss() == Catch::Approx(0.1));
+}
+
+TEST_CASE("fec keeps the slot for the authenticated packet")
+{
+  FecEncoder encoder;
+  FecDecoder decoder;
+  encoder.handleReport(makeReport(2000, 1));
+
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    // Only the real packets pass as authenticated
+    for(int i = 0; i < 4; i++) {
+      if(packet.str() == makePacket(i)) {
+        delivered.push_back(packet.str());
+        return true;
+      }
+    }
+    return false;
+  };
+
+  std::string framed[4], parity;
+  for(int i = 0; i < 4; i++) {
+    encoder.encode(makePacket(i), 0, framed[i], parity);
+  }
+
+  // Forged packet with the sequence number of the first one
+  std::string forged = framed[0].substr(0, FEC_DATA_HEADER_SIZE) + "forged";
+  decoder.decode(forged, deliver);
+  for(int i = 0; i < 4; i++) {
+    decoder.decode(framed[i], deliver);
+  }
+
+  REQUIRE(delivered.size() == 4);
+  REQUIRE(delivered[0] == makePacket(0));
+
+  // Forged parity recovers garbage, which doesn't take the slot either
+  FecDecoder other;
+  other.decode(framed[0], deliver);
+  other.decode(framed[1], deliver);
+  other.decode(framed[3], deliver);
+  std::string forgedParity = parity.substr(0, FEC_PARITY_HEADER_SIZE) + std::string(parity.size(), 'x');
+  other.decode(forgedParity, deliver);
+  REQUIRE(other.getRecovered() == 0);
+  other.decode(parity, deliver);
+  REQUIRE(other.getRecovered() == 1);
+  REQUIRE(delivered.back() == makePacket(2));
+}
@@ -0,0 +1,165 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/header_compression.h"
+
+#include <catch2/catch_all.hpp>
+
+static std::string udpSegment(uint16_t sourcePort, uint16_t destinationPort, const std::string& payload)
+{
+  std::string segment(8, 0);
+  segment[0] = (char)(sourcePort >> 8);
+  segment[1] = (char)(sourcePort & 0xFF);
+  segment[2] = (char)(destinationPort >> 8);
+  segment[3] = (char)(destinationPort & 0xFF);
+  segment[4] = (char)((8 + payload.size()) >> 8);
+  segment[5] = (char)((8 + payload.size()) & 0xFF);
+  segment[6] = 0x12;  // checksum
+  segment[7] = 0x34;
+  return segment + payload;
+}
+
+static std::string tcpSegment(uint32_t seq, uint32_t ack, const std::string& payload)
+{
+  std::string segment(20, 0);
+  segment[0] = (char)0xC3;  // source port 50000
+  segment[1] = (char)0x50;
+  segment[2] = 0x00;  // destination port 22
+  segment[3] = 0x16;
+  for(int i = 0; i < 4; i++) {
+    segment[4 + i] = (char)(seq >> (24 - 8 * i));
+    segment[8 + i] = (char)(ack >> (24 - 8 * i));
+  }
+  segment[12] = 5 << 4;
+  segment[13] = 0x18;  // PSH, ACK
+  segment[14] = 0x01;  // window
+  segment[15] = (char)0xF6;
+  segment[16] = (char)0xAB;  // checksum
+  segment[17] = (char)0xCD;
+  return segment + payload;
+}
+
+static std::string roundTrip(
+    HeaderCompressor& compressor,
+    HeaderDecompressor& decompressor,
+    uint8_t protocol,
+    const std::string& segment,
+    Time now,
+    size_t* wireSize = nullptr)
+{
+  std::string message;
+  REQUIRE(compressor.compress(protocol, segment, now, message));
+  REQUIRE(HeaderDecompressor::isCompressed(message));
+  if(wireSize != nullptr) {
+    *wireSize = message.size();
+  }
+
+  uint8_t restoredProtocol = 0;
+  std::string restored;
+  REQUIRE(decompressor.decompress(message, restoredProtocol, restored));
+  REQUIRE(restoredProtocol == protocol);
+  return restored;
+}
+
+TEST_CASE("header compression udp")
+{
+  HeaderCompressor compressor;
+  HeaderDecompressor decompressor;
+  auto segment = udpSegment(5353, 5353, "hello world");
+
+  size_t wireSize;
+  for(int i = 0; i < HEADER_COMPRESSION_IR_REPEAT; i++) {
+    REQUIRE(roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_UDP, segment, 0, &wireSize) == segment);
+    REQUIRE(wireSize == segment.size() + 4);
+  }
+
+  REQUIRE(roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_UDP, segment, 10, &wireSize) == segment);
+  REQUIRE(wireSize == segment.size() - 3);
+}
+
+TEST_CASE("header compression tcp")
+{
+  HeaderCompressor compressor;
+  HeaderDecompressor decompressor;
+
+  uint32_t seq = 0xFFFFFF00;  // wraps around
+  uint32_t ack = 1000;
+  size_t wireSize = 0;
+  for(int i = 0; i < 20; i++) {
+    auto segment = tcpSegment(seq, ack, std::string(40, 'a' + i));
+    REQUIRE(roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_TCP, segment, i, &wireSize) == segment);
+    seq += 40;
+    ack += 7;
+  }
+
+  REQUIRE(wireSize < 40 + 14);
+}
+
+TEST_CASE("header compression tcp with options and urgent pointer")
+{
+  HeaderCompressor compressor;
+  HeaderDecompressor decompressor;
+
+  for(int i = 0; i < 5; i++) {
+    auto segment = tcpSegment(100 + i, 200, "payload");
+    segment[12] = 8 << 4;
+    segment[13] = 0x38;  // URG, PSH, ACK
+    segment[19] = 1;
+    segment.insert(20, std::string("\x01\x01\x08\x0a\x00\x00\x00\x01\x00\x00\x00\x02", 12));
+    REQUIRE(roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_TCP, segment, i) == segment);
+  }
+}
+
+TEST_CASE("header compression large delta starts a new reference")
+{
+  HeaderCompressor compressor;
+  HeaderDecompressor decompressor;
+
+  for(int i = 0; i < 5; i++) {
+    roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_TCP, tcpSegment(i, 0, "x"), i);
+  }
+
+  auto segment = tcpSegment(1 << 30, 0, "x");
+  REQUIRE(roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_TCP, segment, 10) == segment);
+}
+
+TEST_CASE("header compression survives a lost IR")
+{
+  HeaderCompressor compressor;
+  HeaderDecompressor decompressor;
+
+  std::string message;
+  REQUIRE(compressor.compress(HEADER_COMPRESSION_PROTOCOL_TCP, tcpSegment(1, 1, "x"), 0, message));
+
+  // the first IR is lost, any later one sets the same reference
+  for(uint32_t seq = 2; seq < 10; seq++) {
+    auto segment = tcpSegment(seq, 1, "x");
+    REQUIRE(roundTrip(compressor, decompressor, HEADER_COMPRESSION_PROTOCOL_TCP, segment, seq) == segment);
+  }
+}
+
+TEST_CASE("header compression drops unknown contexts")
+{
+  HeaderCompressor compressor;
+  HeaderDecompressor decompressor;
+  auto segment = udpSegment(1, 2, "x");
+
+  std::string message;
+  for(int i = 0; i <= HEADER_COMPRESSION_IR_REPEAT; i++) {
+    REQUIRE(compressor.compress(HEADER_COMPRESSION_PROTOCOL_UDP, segment, 0, message));
+  }
+
+  uint8_t protocol;
+  std::string restored;
+  REQUIRE(!decompressor.decompress(message, protocol, restored));
+}
+
+TEST_CASE("header compression skips other traffic")
+{
+  HeaderCompressor compressor;
+  std::string message;
+
+  REQUIRE(!compressor.compress(58, std::string(16, 0), 0, message));
+  REQUIRE(!compressor.compress(HEADER_COMPRESSION_PROTOCOL_TCP, std::string(10, 0), 0, message));
+  REQUIRE(!compressor.compress(HEADER_COMPRESSION_PROTOCOL_UDP, udpSegment(1, 2, std::string(600, 0)), 0, message));
+}
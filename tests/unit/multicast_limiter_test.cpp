@@ -0,0 +1,95 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/multicast_limiter.h"
+
+#include <string>
+
+#include <catch2/catch_all.hpp>
+
+static const auto MDNS = IpAddress::parse("ff02::fb");
+static const auto SSDP = IpAddress::parse("ff02::c");
+
+TEST_CASE("multicast limiter exhausts the burst and refills over time")
+{
+  MulticastLimiter limiter("ff02::fb=2/3");
+  REQUIRE(limiter.isEnabled());
+
+  for(int i = 0; i < 3; i++) {
+    REQUIRE(limiter.allow(MDNS, std::to_string(i), 0));
+  }
+  REQUIRE(!limiter.allow(MDNS, std::string("3"), 0));
+  REQUIRE(!limiter.allow(MDNS, std::string("4"), 400));
+
+  // 2 packets per second - one token every 500 ms
+  REQUIRE(limiter.allow(MDNS, std::string("5"), 500));
+  REQUIRE(!limiter.allow(MDNS, std::string("6"), 500));
+
+  // The bucket doesn't grow beyond the burst
+  for(int i = 0; i < 3; i++) {
+    REQUIRE(limiter.allow(MDNS, std::to_string(10 + i), 10000));
+  }
+  REQUIRE(!limiter.allow(MDNS, std::string("13"), 10000));
+
+  REQUIRE((limiter.getForwarded() == 7));
+  REQUIRE((limiter.getRateLimited() == 4));
+  REQUIRE((limiter.getDuplicates() == 0));
+}
+
+TEST_CASE("multicast limiter drops duplicates within the window")
+{
+  MulticastLimiter limiter("ff02::fb=100/100/1000");
+
+  REQUIRE(limiter.allow(MDNS, std::string("query"), 0));
+  REQUIRE(!limiter.allow(MDNS, std::string("query"), 999));
+  REQUIRE(limiter.allow(MDNS, std::string("other query"), 999));
+  REQUIRE(limiter.allow(MDNS, std::string("query"), 1000));
+
+  REQUIRE((limiter.getForwarded() == 3));
+  REQUIRE((limiter.getDuplicates() == 1));
+}
+
+TEST_CASE("multicast limiter doesn't remember rate limited payloads")
+{
+  MulticastLimiter limiter("ff02::fb=1/1/5000");
+
+  REQUIRE(limiter.allow(MDNS, std::string("first"), 0));
+  REQUIRE(!limiter.allow(MDNS, std::string("second"), 0));
+
+  // Retransmission after a refill goes through instead of being a duplicate
+  REQUIRE(limiter.allow(MDNS, std::string("second"), 1000));
+
+  REQUIRE((limiter.getRateLimited() == 1));
+  REQUIRE((limiter.getDuplicates() == 0));
+}
+
+TEST_CASE("multicast limiter skips invalid entries")
+{
+  REQUIRE(!MulticastLimiter("").isEnabled());
+  REQUIRE(!MulticastLimiter("ff02::fb").isEnabled());
+  REQUIRE(!MulticastLimiter("ff02::fb=0/5").isEnabled());
+  REQUIRE(!MulticastLimiter("ff02::fb=5/0").isEnabled());
+  REQUIRE(!MulticastLimiter("ff02::fb=5").isEnabled());
+  REQUIRE(!MulticastLimiter("ff02::fb=5/5/-1").isEnabled());
+  REQUIRE(!MulticastLimiter("fc94::1=5/5").isEnabled());
+
+  // Valid entries next to the broken ones still apply
+  MulticastLimiter limiter("fc94::1=1/1, garbage, ff02::fb=1/1");
+  REQUIRE(limiter.isEnabled());
+  REQUIRE(limiter.allow(MDNS, std::string("a"), 0));
+  REQUIRE(!limiter.allow(MDNS, std::string("b"), 0));
+  REQUIRE(limiter.allow(SSDP, std::string("c"), 0));
+  REQUIRE(limiter.allow(SSDP, std::string("d"), 0));
+}
+
+TEST_CASE("multicast limiter applies the default limit to other groups")
+{
+  MulticastLimiter limiter("*=1/1, ff02::fb=1/2");
+
+  REQUIRE(limiter.allow(SSDP, std::string("a"), 0));
+  REQUIRE(!limiter.allow(SSDP, std::string("b"), 0));
+
+  REQUIRE(limiter.allow(MDNS, std::string("a"), 0));
+  REQUIRE(limiter.allow(MDNS, std::string("b"), 0));
+  REQUIRE(!limiter.allow(MDNS, std::string("c"), 0));
+}
@@ -0,0 +1,181 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/multipath.h"
+
+#include <string>
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+static MultipathPath makePath(double rtt, Time lastReply = 1000)
+{
+  MultipathPath path;
+  path.fd = 3;
+  path.srtt = rtt;
+  path.lastReply = lastReply;
+  return path;
+}
+
+TEST_CASE("multipath path is measured with the probes")
+{
+  MultipathPath path;
+  path.fd = 3;
+  REQUIRE(!path.isUsable(0));
+
+  path.probeSentAt(100, "a");
+  path.replyReceivedAt(140);
+  REQUIRE(path.isUsable(140));
+  REQUIRE(path.srtt == 40);
+
+  // Unanswered probe counts as a loss once the next one goes out
+  path.probeSentAt(600, "b");
+  path.probeSentAt(1100, "c");
+  REQUIRE(path.loss > 0);
+  REQUIRE(!path.isUsable(140 + MULTIPATH_PATH_TIMEOUT));
+}
+
+TEST_CASE("multipath balancing follows the path cost")
+{
+  std::vector<MultipathPath> paths = {makePath(10), makePath(20), makePath(100), makePath(10, 0)};
+
+  std::vector<int> picks, counts(paths.size());
+  for(int i = 0; i < 300; i++) {
+    pickMultipathPaths(paths, MultipathMode::balance, 1000, picks);
+    REQUIRE(picks.size() == 1);
+    counts[picks[0]]++;
+  }
+
+  // 2:1 for the first two, the slow one is left out as is the unvalidated one
+  REQUIRE(counts[0] == 200);
+  REQUIRE(counts[1] == 100);
+  REQUIRE(counts[2] == 0);
+  REQUIRE(counts[3] == 0);
+}
+
+TEST_CASE("multipath redundant mode uses the two best paths")
+{
+  std::vector<MultipathPath> paths = {makePath(50), makePath(10), makePath(20)};
+
+  std::vector<int> picks;
+  pickMultipathPaths(paths, MultipathMode::redundant, 1000, picks);
+  REQUIRE(picks == (std::vector<int>{1, 2}));
+
+  paths = {makePath(50, 0)};
+  pickMultipathPaths(paths, MultipathMode::redundant, 1000, picks);
+  REQUIRE(picks.empty());
+}
+
+TEST_CASE("reorder buffer restores the order and drops the duplicates")
+{
+  ReorderBuffer buffer;
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    delivered.push_back(packet.str());
+    return true;
+  };
+
+  buffer.push(10, std::string("a"), 0, deliver);
+  buffer.push(12, std::string("c"), 0, deliver);
+  buffer.push(13, std::string("d"), 0, deliver);
+  REQUIRE(delivered.size() == 1);
+
+  buffer.push(11, std::string("b"), 5, deliver);
+  buffer.push(12, std::string("c"), 5, deliver);
+  buffer.push(10, std::string("a"), 5, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b", "c", "d"}));
+  REQUIRE(buffer.getDuplicates() == 2);
+  REQUIRE(buffer.getDeadline() == -1);
+}
+
+TEST_CASE("reorder buffer gives up on a gap after the timeout")
+{
+  ReorderBuffer buffer;
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    delivered.push_back(packet.str());
+    return true;
+  };
+
+  buffer.push(0, std::string("a"), 100, deliver);
+  buffer.push(2, std::string("c"), 100, deliver);
+  buffer.push(3, std::string("d"), 110, deliver);
+  REQUIRE(buffer.getDeadline() == 100 + MULTIPATH_REORDER_TIMEOUT);
+
+  buffer.expire(110, deliver);
+  REQUIRE(delivered.size() == 1);
+  buffer.expire(100 + MULTIPATH_REORDER_TIMEOUT, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "c", "d"}));
+
+  // The late one still gets through, but only once
+  buffer.push(1, std::string("b"), 200, deliver);
+  buffer.push(1, std::string("b"), 200, deliver);
+  REQUIRE(delivered.size() == 4);
+  buffer.push(4, std::string("e"), 200, deliver);
+  REQUIRE(delivered.back() == "e");
+}
+
+TEST_CASE("reorder buffer handles the sequence number wrap")
+{
+  ReorderBuffer buffer;
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    delivered.push_back(packet.str());
+    return true;
+  };
+
+  buffer.push(0xFFFFFFFE, std::string("a"), 0, deliver);
+  buffer.push(0, std::string("c"), 0, deliver);
+  buffer.push(0xFFFFFFFF, std::string("b"), 0, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b", "c"}));
+
+  // Packet too far ahead pushes the window forward over the gap. It's
+  // delivered first, as that's how it gets authenticated.
+  buffer.push(2, std::string("e"), 0, deliver);
+  buffer.push(MULTIPATH_REORDER_WINDOW + 2, std::string("f"), 0, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b", "c", "f", "e"}));
+  buffer.push(MULTIPATH_REORDER_WINDOW + 1, std::string("g"), 0, deliver);
+  REQUIRE(delivered.size() == 5);
+  buffer.expire(MULTIPATH_REORDER_TIMEOUT, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b", "c", "f", "e", "g"}));
+  buffer.push(MULTIPATH_REORDER_WINDOW + 2, std::string("f"), 0, deliver);
+  REQUIRE(delivered.size() == 6);
+}
+
+TEST_CASE("reorder buffer doesn't let forged packets move the window")
+{
+  ReorderBuffer buffer;
+  std::vector<std::string> delivered;
+  auto deliver = [&](string_view packet) {
+    if(packet.str() == "forged") {
+      return false;
+    }
+    delivered.push_back(packet.str());
+    return true;
+  };
+
+  // Neither the start
+  buffer.push(1000, std::string("forged"), 0, deliver);
+  buffer.push(0, std::string("a"), 0, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a"}));
+
+  // Nor a jump far ahead
+  buffer.push(1u << 30, std::string("forged"), 0, deliver);
+  buffer.push(1, std::string("b"), 0, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b"}));
+
+  // Nor taking the place of the next one
+  buffer.push(2, std::string("forged"), 0, deliver);
+  buffer.push(2, std::string("c"), 0, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b", "c"}));
+
+  // Forged packet held ahead doesn't shadow the real one either
+  buffer.push(5, std::string("forged"), 0, deliver);
+  buffer.push(5, std::string("f"), 0, deliver);
+  buffer.push(4, std::string("e"), 0, deliver);
+  buffer.push(3, std::string("d"), 0, deliver);
+  REQUIRE(delivered == (std::vector<std::string>{"a", "b", "c", "f", "d", "e"}));
+  buffer.push(5, std::string("f"), 0, deliver);
+  REQUIRE(delivered.size() == 6);
+  REQUIRE(buffer.getDeadline() == -1);
+}
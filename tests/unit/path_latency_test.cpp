@@ -0,0 +1,44 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/path_latency.h"
+
+#include <catch2/catch_all.hpp>
+
+static PathLatency measure(double rtt, int samples, Time now)
+{
+  PathLatency latency;
+  for(int i = 0; i < samples; i++) {
+    latency.addSample(rtt, now);
+  }
+  return latency;
+}
+
+TEST_CASE("path latency is smoothed")
+{
+  PathLatency latency;
+  latency.addSample(100, 0);
+  REQUIRE(latency.srtt == 100);
+  REQUIRE(latency.jitter == 50);
+
+  latency.addSample(20, 10);
+  REQUIRE(latency.srtt == 90);
+  REQUIRE(latency.jitter == Catch::Approx(57.5));
+  REQUIRE(latency.samples == 2);
+  REQUIRE(latency.lastSample == 10);
+}
+
+TEST_CASE("path switch needs a clearly better candidate")
+{
+  auto current = measure(50, 5, 1000);
+
+  REQUIRE(isBetterPath(measure(20, 3, 1000), current, 1000, 5000));
+  // Not measured enough
+  REQUIRE(!isBetterPath(measure(20, 2, 1000), current, 1000, 5000));
+  // Within the hysteresis
+  REQUIRE(!isBetterPath(measure(45, 5, 1000), current, 1000, 5000));
+  REQUIRE(!isBetterPath(measure(3, 5, 1000), measure(7, 5, 1000), 1000, 5000));
+  // Stale measurements
+  REQUIRE(!isBetterPath(measure(20, 3, 1000), current, 7000, 5000));
+  REQUIRE(!isBetterPath(measure(20, 3, 7000), current, 7000, 5000));
+}
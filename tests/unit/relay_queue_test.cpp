@@ -0,0 +1,99 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/relay_queue.h"
+
+#include <vector>
+
+#include <catch2/catch_all.hpp>
+
+static const auto HEAVY = IpAddress::parse("fc94::1");
+static const auto LIGHT = IpAddress::parse("fc94::2");
+
+TEST_CASE("relay queue passes packets through when the stream is ready")
+{
+  std::vector<HusarnetAddress> sent;
+  RelayQueue queue([&](HusarnetAddress peer, string_view) { sent.push_back(peer); }, []() { return true; });
+
+  REQUIRE(queue.send(HEAVY, std::string(100, 'x'), 0) == -1);
+  REQUIRE(queue.send(LIGHT, std::string(100, 'x'), 0) == -1);
+  std::vector<HusarnetAddress> expected = {HEAVY, LIGHT};
+  REQUIRE(sent == expected);
+}
+
+TEST_CASE("relay queue shares the stream fairly")
+{
+  bool ready = false;
+  std::vector<HusarnetAddress> sent;
+  RelayQueue queue([&](HusarnetAddress peer, string_view) { sent.push_back(peer); }, [&]() { return ready; });
+
+  for(int i = 0; i < 20; i++) {
+    queue.send(HEAVY, std::string(1000, 'x'), 0);
+  }
+  for(int i = 0; i < 4; i++) {
+    queue.send(LIGHT, std::string(100, 'x'), 0);
+  }
+  REQUIRE(sent.empty());
+
+  ready = true;
+  queue.drain(0);
+  REQUIRE(sent.size() == 24);
+
+  // Every turn is worth a quantum - two of the heavy packets, or all of the
+  // light ones
+  std::vector<HusarnetAddress> firstRound = {HEAVY, HEAVY, LIGHT, LIGHT, LIGHT, LIGHT};
+  REQUIRE(std::vector<HusarnetAddress>(sent.begin(), sent.begin() + 6) == firstRound);
+}
+
+TEST_CASE("relay queue drops above the limit")
+{
+  RelayQueue queue([](HusarnetAddress, string_view) {}, []() { return false; });
+
+  for(size_t i = 0; i < RELAY_QUEUE_LIMIT + 5; i++) {
+    queue.send(HEAVY, std::string("x"), 0);
+  }
+
+  auto stats = queue.getStats();
+  REQUIRE(stats["drops"] == 5);
+  REQUIRE(stats["peers"][HEAVY.toString()]["queued"] == RELAY_QUEUE_LIMIT);
+}
+
+TEST_CASE("relay queue rate limits a peer")
+{
+  size_t sentBytes = 0;
+  RelayQueue queue([&](HusarnetAddress, string_view data) { sentBytes += data.size(); }, []() { return true; });
+
+  std::string error;
+  REQUIRE(queue.setConfig(
+      nlohmann::json::parse(R"({"peers": {")" + HEAVY.toString() + R"(": 100000}})"), error));
+
+  // 100 kB/s with a 5 kB burst
+  Time wait = -1;
+  for(int i = 0; i < 50; i++) {
+    wait = queue.send(HEAVY, std::string(1000, 'x'), 0);
+  }
+  REQUIRE(sentBytes == 5000);
+  REQUIRE(wait > 0);
+
+  queue.drain(100);
+  REQUIRE(sentBytes == 10000);  // the bucket never holds more than a burst
+
+  queue.drain(110);
+  REQUIRE(sentBytes == 11000);
+
+  // Peers without a limit are not affected
+  size_t before = sentBytes;
+  REQUIRE(queue.send(LIGHT, std::string(1000, 'x'), 110) >= 0);
+  REQUIRE(sentBytes == before + 1000);
+}
+
+TEST_CASE("relay config rejects invalid values")
+{
+  RelayConfig config;
+  std::string error;
+
+  REQUIRE(!RelayConfig::fromJson(nlohmann::json::parse(R"({"rate_limit": "fast"})"), config, error));
+  REQUIRE(!RelayConfig::fromJson(nlohmann::json::parse(R"({"peers": {"10.0.0.1": 1000}})"), config, error));
+  REQUIRE(RelayConfig::fromJson(nlohmann::json::parse(R"({"rate_limit": 1000})"), config, error));
+  REQUIRE(config.getRateLimit(HEAVY) == 1000);
+}
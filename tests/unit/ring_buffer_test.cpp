@@ -0,0 +1,79 @@
+// Copyright (c) 2025 Husarnet sp. z o.o.
+// Authors: listed in project_root/README.md
+// License: specified in project_root/LICENSE.txt
+#include "husarnet/ring_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <catch2/catch_all.hpp>
+
+static void write(RingBuffer& buffer, const std::string& data)
+{
+  size_t written = 0;
+  while(written < data.size()) {
+    size_t size = std::min(buffer.writableSize(), data.size() - written);
+    REQUIRE(size > 0);
+    memcpy(buffer.writePointer(), data.data() + written, size);
+    buffer.commit(size);
+    written += size;
+  }
+}
+
+TEST_CASE("ring buffer contiguous")
+{
+  RingBuffer buffer(16);
+  REQUIRE(buffer.capacity() == 16);
+  REQUIRE(buffer.writableSize() == 16);
+
+  write(buffer, "hello world");
+  REQUIRE(buffer.size() == 11);
+  REQUIRE(buffer.available() == 5);
+
+  auto view = buffer.peek(6, 5);
+  REQUIRE(view.isContiguous());
+  REQUIRE(view.first.str() == "world");
+
+  buffer.consume(6);
+  REQUIRE(buffer.peek(0, 5).first.str() == "world");
+}
+
+TEST_CASE("ring buffer wraps around")
+{
+  RingBuffer buffer(8);
+  write(buffer, "abcdef");
+  buffer.consume(4);
+
+  // free space is split between the end and the beginning
+  REQUIRE(buffer.writableSize() == 2);
+  write(buffer, "ghijkl");
+  REQUIRE(buffer.size() == 8);
+  REQUIRE(buffer.writableSize() == 0);
+
+  auto view = buffer.peek(0, 8);
+  REQUIRE(!view.isContiguous());
+  REQUIRE(view.size() == 8);
+  REQUIRE(view.first.str() == "efgh");
+  REQUIRE(view.second.str() == "ijkl");
+  REQUIRE(view[5] == 'j');
+
+  std::string scratch;
+  REQUIRE(view.linearize(scratch).str() == "efghijkl");
+
+  // views not crossing the end are never copied
+  REQUIRE(buffer.peek(4, 3).isContiguous());
+  REQUIRE(buffer.peek(4, 3).first.str() == "ijk");
+}
+
+TEST_CASE("ring buffer starts over when emptied")
+{
+  RingBuffer buffer(8);
+  write(buffer, "abcdef");
+  buffer.consume(6);
+
+  REQUIRE(buffer.size() == 0);
+  REQUIRE(buffer.writableSize() == 8);
+
+  write(buffer, "12345678");
+  REQUIRE(buffer.peek(0, 8).isContiguous());
+}